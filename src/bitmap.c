@@ -0,0 +1,75 @@
+/*
+ * bitmap.c
+ *
+ * This file contains functions for bitmaps stored in arrays of 64-bit words.
+ *
+ * Bits past the length of a bitmap are always kept clear, so whole words can be counted and searched without masking off the end.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+/*
+ * returns the number of bits set in the first len bits of a bitmap
+ */
+size_t bitmap_count(const uint64_t *map, size_t len)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < BITMAP_WORDS(len); i++)
+		count += __builtin_popcountll(map[i]);
+	return count;
+}
+
+/*
+ * returns the index of the first set bit at or after pos, skipping clear words whole
+ *
+ * returns len if there are no set bits left
+ */
+size_t bitmap_next(const uint64_t *map, size_t len, size_t pos)
+{
+	size_t i = pos / BITMAP_WORD_BITS;
+	uint64_t word;
+
+	if (pos >= len)
+		return len;
+
+	word = map[i] & (~(uint64_t) 0 << (pos % BITMAP_WORD_BITS));
+	while (word == 0)
+	{
+		if (++i >= BITMAP_WORDS(len))
+			return len;
+		word = map[i];
+	}
+	return i * BITMAP_WORD_BITS + __builtin_ctzll(word);
+}
+
+/*
+ * sets the first len bits of a bitmap, leaving the bits after them in the last word clear
+ */
+void bitmap_fill(uint64_t *map, size_t len)
+{
+	size_t words = len / BITMAP_WORD_BITS;
+
+	memset(map, 0xff, words * sizeof(uint64_t));
+	if (len % BITMAP_WORD_BITS != 0)
+		map[words] = ~(uint64_t) 0 >> (BITMAP_WORD_BITS - len % BITMAP_WORD_BITS);
+}
+
+/*
+ * clears the bits of a bitmap from pos up to (but not including) len
+ */
+void bitmap_clear_range(uint64_t *map, size_t pos, size_t len)
+{
+	while (pos < len && pos % BITMAP_WORD_BITS != 0)
+	{
+		BITMAP_CLEAR(map, pos);
+		pos++;
+	}
+	if (pos >= len)
+		return;
+	memset(map + pos / BITMAP_WORD_BITS, 0, (BITMAP_WORDS(len) - pos / BITMAP_WORD_BITS) * sizeof(uint64_t));
+}
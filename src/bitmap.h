@@ -0,0 +1,36 @@
+/*
+ * bitmap.h
+ *
+ * This file contains macros and functions for bitmaps stored in arrays of 64-bit words
+ */
+
+#ifndef	BITMAP_H
+#define	BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of bits in each word of a bitmap
+#define	BITMAP_WORD_BITS	64
+
+// Number of words needed for a bitmap of n bits
+#define	BITMAP_WORDS(n)		(((size_t) (n) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+// Tests, sets and clears bit i of a bitmap
+#define	BITMAP_TEST(map, i)	((map)[(size_t) (i) / BITMAP_WORD_BITS] >> ((size_t) (i) % BITMAP_WORD_BITS) & 1)
+#define	BITMAP_SET(map, i)	((map)[(size_t) (i) / BITMAP_WORD_BITS] |= (uint64_t) 1 << ((size_t) (i) % BITMAP_WORD_BITS))
+#define	BITMAP_CLEAR(map, i)	((map)[(size_t) (i) / BITMAP_WORD_BITS] &= ~((uint64_t) 1 << ((size_t) (i) % BITMAP_WORD_BITS)))
+
+// Returns the number of bits set in the first len bits of a bitmap
+size_t bitmap_count(const uint64_t *map, size_t len);
+
+// Returns the index of the first set bit at or after pos, or len if there are none
+size_t bitmap_next(const uint64_t *map, size_t len, size_t pos);
+
+// Sets the first len bits of a bitmap and clears the rest of its last word
+void bitmap_fill(uint64_t *map, size_t len);
+
+// Clears bits from pos up to len
+void bitmap_clear_range(uint64_t *map, size_t pos, size_t len);
+
+#endif
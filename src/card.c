@@ -5,6 +5,8 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -14,284 +16,961 @@
 #include <wchar.h>
 
 #include "util.h"
+#include "bitmap.h"
 #include "card.h"
+#include "cardfile.h"
+#include "cardindex.h"
+#include "deckcache.h"
+#include "dedupe.h"
+#include "intern.h"
+#include "scan.h"
+#include "uring.h"
+
+// Card files smaller than this are parsed by a single thread
+#define	CHUNK_MIN_SIZE		(1 << 20)
+
+// Number of ranges per thread that large card files are split into, so threads that finish early can take more work
+#define	CHUNKS_PER_THREAD	4
+
+// Card file loaded by read_deck
+typedef struct fileload{
+	const char *filename;
+
+	// Contents of the file
+	cardfile_t cardfile;
+
+	// Error that stopped the file from loading
+	loaderror_t error;
+
+	// True if the file was read by read_small_files, so it doesn't have to be mapped
+	bool loaded;
+
+	// True if the file is compressed or isn't a regular file, so the deck should be read by the stream thread
+	bool streamed;
+
+	// Index of the first range of the file in deckload_t.chunks and the number of ranges
+	int first_chunk;
+	int chunkcount;
+} fileload_t;
+
+// Range of a card file parsed by a worker thread
+typedef struct chunkload{
+	// Index of the file in deckload_t.files
+	int file;
+
+	// Offsets of the first byte of the range and the byte after its last
+	size_t start;
+	size_t end;
+
+	// Lines read from the range
+	cardbatch_t batch;
+
+	// Error that stopped the range from being parsed
+	loaderror_t error;
+} chunkload_t;
+
+// Card files shared by the worker threads of read_deck
+typedef struct deckload{
+	fileload_t *files;
+	int filecount;
+
+	chunkload_t *chunks;
+	int chunkcount;
+
+	// Text of every range, split between the batches of the ranges
+	char *text;
+
+	// Index of the next file or range to load
+	atomic_int next;
+
+	// Index of the first file that failed to map, or filecount if none have
+	atomic_int failed;
+
+	// True if files that have to be streamed are left unread instead of being read into a buffer
+	bool find_streamed;
+} deckload_t;
 
 // Array holding card structs
-card_t **card_list;
+card_t *card_list;
 int card_list_len;
 
+// State bitmaps of card_list, which share one allocation starting at card_states[0]
+uint64_t *card_states[CARDSTATE_COUNT];
+
+int deleted_cards;
+
+// Text of every card, referred to by offsets in card_t
+char *card_text;
+size_t card_text_len;
+
+// Set by the -c option before a deck is read
+bool compact_text = false;
+
+// Set by the -m option before a deck is read
+bool low_memory = false;
+
+// Cleared by the --no-cache option before a deck is read
+bool use_deck_cache = true;
+
+size_t intern_saved_bytes;
+
+// Set by the --dedupe options before a deck is read
+dedupemode_t dedupe_mode = DEDUPE_NONE;
+
+int deduped_cards;
+
+// Number of cards read from each card file of the deck, set by read_deck
+int *deck_file_cards;
+
+// Number of cards, characters of text and words of each state bitmap that card_list, card_text and card_states can hold, for decks built by append_card_batch
+static size_t card_list_size;
+static size_t card_text_size;
+static size_t card_state_words;
+
+// True if the last line given to append_card_batch is the front of a card still waiting for its back
+static bool have_front;
+
+// Cards added by append_card_batch, for finding duplicates of the cards added after them
+static dedupetable_t append_dedupe;
+
+// Reads the small files of a deckload_t with io_uring if it's available
+static void read_small_deck_files(deckload_t *load, char **filenames);
+
+// Maps card files until there are none left; used as a worker thread
+static void *map_files_worker(void *arg);
+
+// Parses ranges of card files until there are none left; used as a worker thread
+static void *parse_chunks_worker(void *arg);
+
+// Splits the mapped card files of a deckload_t into ranges
+static int split_files(deckload_t *load, int threads);
+
+// Pairs the lines of every range into cards and replaces card_list with them
+static int join_chunks(deckload_t *load, int *file_cards);
+
+// Makes sure card_list, card_text and card_states can hold more cards and text without moving; returns errno on error
+static int grow_card_list(size_t new_len, size_t new_text_len);
+
+// Copies a line of a batch to the end of card_text, which must have room for it, and returns its offset
+static uint32_t copy_batch_line(const cardbatch_t *batch, int line);
+
 /*
  * reads a file containing card text and stores its contents into cards contained in card_list, replacing the previous contents of card_list if successful, and resizing review_list to hold the maximum amount of cards needed to review
  *
+ * every file is mapped and parsed on worker threads, except that the small files of decks with many files are read in batches with io_uring first; files larger than CHUNK_MIN_SIZE are split into ranges at line starts so several threads can parse them. The lines of every range are then paired into cards in the order the files were given, giving the same cards as parsing the files one by one
+ *
+ * if the deck was read before and none of its files have changed since, card_list is mapped from its deck cache instead of parsing the files; otherwise the cache is rebuilt after the files are parsed
+ *
+ * if streamed isn't NULL and one of the files is compressed or isn't a regular file, nothing is read and *streamed is set to true, so the deck can be read by the stream thread instead; those files are found as they're mapped, so other decks don't have to be looked through first
+ *
  * returns errno on file or memory allocation errors
  */
-int read_deck(char **filenames, int filecount)
+int read_deck(char **filenames, int filecount, bool *streamed)
 {
-	// Temp array used to store card data before it's transferred to card_list
-	card_t **temp_card_list;
+	deckload_t load;
+	deckcache_t cache;
+	int *file_cards = NULL;
+	int threads = get_cpu_count();
+	int error_code = 0;
+
+	if (streamed != NULL)
+		*streamed = false;
+	if (low_memory)
+		return index_deck(filenames, filecount);
+
+	// The state of the files is recorded before they're parsed, so a file changed while it's being parsed makes the cache out of date
+	init_deck_cache(&cache, filenames, filecount);
+	if (load_deck_cache(&cache) == 0)
+	{
+		free_deck_cache(&cache);
+		return 0;
+	}
 
-	// The number of cards in the array
-	int temp_card_list_len;
+	// Pick the block scanner before any worker threads use it
+	select_scanner();
 
-	// The number of elements the array can hold
-	int temp_card_list_size;
+	if ((load.files = calloc(filecount, sizeof(fileload_t))) == NULL)
+	{
+		perror("calloc");
+		error_code = errno;
+		free_deck_cache(&cache);
+		return error_code;
+	}
+	for (int i = 0; i < filecount; i++)
+		load.files[i].filename = filenames[i];
+	load.filecount = filecount;
+	load.chunks = NULL;
+	load.chunkcount = 0;
+	load.text = NULL;
+	load.find_streamed = streamed != NULL;
+
+	// Read the small files of decks made of many files with io_uring, then map the rest
+	if (filecount >= URING_MIN_FILES)
+		read_small_deck_files(&load, filenames);
+	atomic_init(&load.next, 0);
+	atomic_init(&load.failed, filecount);
+	run_threads(MIN(threads, filecount), map_files_worker, &load);
+
+	// A file found to need the stream thread makes the whole deck read by it
+	for (int i = 0; i < filecount && load.find_streamed; i++)
+	{
+		if (load.files[i].streamed)
+		{
+			*streamed = true;
+			goto read_deck_end;
+		}
+	}
 
-	// Current card being manipulated
-	card_t *card = NULL;
+	// Split the files into ranges and parse them
+	if (split_files(&load, threads) != 0)
+	{
+		perror("calloc");
+		error_code = errno;
+		goto read_deck_end;
+	}
+	atomic_store(&load.next, 0);
+	run_threads(MIN(threads, load.chunkcount), parse_chunks_worker, &load);
 
-	temp_card_list_size = CARD_ARRAY_ESTSIZE;
-	if ((temp_card_list = calloc(temp_card_list_size, sizeof(card_t *))) == NULL)
+	if ((file_cards = calloc(filecount, sizeof(int))) == NULL)
 	{
 		perror("calloc");
-		return errno;
+		error_code = errno;
+		goto read_deck_end;
 	}
 
-	// Buffer used to store characters read on each line
-	wchar_t buffer[MAX_LINE_CHARS];
+	// Report the error of the first file that failed, like reading the files one by one would
+	for (int i = 0; i < filecount && error_code == 0; i++)
+	{
+		fileload_t *file = &load.files[i];
+		int lines = 0;
+
+		for (int j = file->first_chunk; j < file->first_chunk + file->chunkcount && file->error.code == 0; j++)
+		{
+			file->error = load.chunks[j].error;
+			lines += load.chunks[j].batch.len;
+		}
+
+		// Error: a card's front has been read, but not its back
+		if (file->error.code == 0 && lines % 2 != 0)
+		{
+			file->error.code = EIO;
+			file->error.func = NULL;
+		}
 
-	// Buffer position
-	int bp;
+		if ((error_code = file->error.code) != 0)
+			print_load_error(file->filename, &file->error);
+		file_cards[i] = lines / 2;
+	}
 
-	// Current character being read
-	wint_t c;
+	if (error_code == 0 && (error_code = join_chunks(&load, file_cards)) == 0)
+	{
+		deck_file_cards = file_cards;
+		file_cards = NULL;
+		save_deck_cache(&cache);
+	}
 
-	// True if the front of the card is being read
-	bool front;
+	read_deck_end:
+	free(file_cards);
+	for (int i = 0; i < filecount; i++)
+		unmap_card_file(&load.files[i].cardfile);
+	for (int i = 0; i < load.chunkcount; i++)
+		free_batch(&load.chunks[i].batch);
+	free(load.chunks);
+	free(load.text);
+	free(load.files);
+	free_deck_cache(&cache);
+	return error_code;
+}
 
-	front = true;
-	temp_card_list_len = bp = 0;
+/*
+ * returns a pointer to the free text of a batch if it can hold n more characters, or NULL if it can't
+ */
+void *get_batch_text(cardbatch_t *batch, size_t n)
+{
+	if (batch->text_len + n > batch->text_size)
+		return NULL;
+	return batch->text + batch->text_len * CARD_CHAR_SIZE;
+}
 
-	// Open card files and read them
-	FILE *cardfile;
+/*
+ * adds a line of len characters to a batch; the line must have been written to the space returned by get_batch_text, with room for a null terminator after it
+ *
+ * returns errno on error
+ */
+int add_batch_line(cardbatch_t *batch, size_t len)
+{
+	// Lines are referred to by 32-bit offsets
+	if (batch->text_len + len + 1 > UINT32_MAX)
+		return EOVERFLOW;
 
-	// Loop through all files passed to this function
-	for (int filenum = 0; filenum < filecount; filenum++)
+	if (batch->len == batch->size)
 	{
-		if ((cardfile = fopen(filenames[filenum], "r")) == NULL)
-		{
-			perror("fopen");
+		cardline_t *temp;
+		int size = batch->size == 0 ? CARD_ARRAY_ESTSIZE : batch->size * 2;
+
+		if ((temp = reallocarray(batch->lines, size, sizeof(cardline_t))) == NULL)
 			return errno;
-		}
+		batch->lines = temp;
+		batch->size = size;
+	}
 
-		// Process characters from the file one by one
-		while ((c = fgetwc(cardfile)) != WEOF)
-		{
-			if (c == L'#')
-			{
-				// Found a comment, move to next line
-				while (c != '\n')
-					c = fgetwc(cardfile);
-				continue;
-			}
+	char *text = batch->text + batch->text_len * CARD_CHAR_SIZE;
+
+	batch->lines[batch->len].off = batch->text_len;
+	batch->lines[batch->len].len = len;
+	batch->lines[batch->len].hash = hash_bytes(text, len * CARD_CHAR_SIZE);
+	batch->len++;
+	if (compact_text)
+		text[len] = '\0';
+	else
+		((wchar_t *) text)[len] = L'\0';
+	batch->text_len += len + 1;
+	return 0;
+}
 
-			if (c == L'\n' || bp == MAX_LINE_CHARS - 1)
-			{
-				// Null-terminate the buffer so it can safely be copied into strings
-				buffer[bp++] = L'\0';
+/*
+ * frees the lines of a batch; its text belongs to whatever set up the batch
+ */
+void free_batch(cardbatch_t *batch)
+{
+	free(batch->lines);
+	batch->lines = NULL;
+	batch->len = batch->size = 0;
+}
 
-				// Check if the front or back of the card is being read
-				if (front)
-				{
-					// Allocate mem for a new card and its front string
-					if ((card = malloc(sizeof(card_t))) == NULL)
-					{
-						perror("malloc");
-						goto read_deck_error;
-					}
-					if ((card->front = calloc(bp, sizeof(wchar_t))) == NULL)
-					{
-						perror("calloc");
-						free(card);
-						goto read_deck_error;
-					}
-
-					// Initializing state
-					card->state = CARDSTATE_DO_REVIEW;
-
-					// Copy buffer into the front string of the card
-					wcsncpy(card->front, buffer, bp);
-				}
-				else
-				{
-					// Allocate mem for the back string of the card
-					if ((card->back = calloc(bp, sizeof(wchar_t))) == NULL)
-					{
-						perror("calloc");
-						free(card->front);
-						free(card);
-						goto read_deck_error;
-					}
-					
-					// Copy buffer into the back text of the card
-					wcsncpy(card->back, buffer, bp);
-
-					// Store a pointer to the card in the list if there's enough space in the array,
-					// if not, resize the array
-					if (temp_card_list_len == temp_card_list_size)
-					{
-						temp_card_list_size += CARD_ARRAY_ESTSIZE;
-						if ((temp_card_list = reallocarray(temp_card_list, temp_card_list_size, sizeof(card_t *))) == NULL)
-						{
-							perror("reallocarray");
-							free_card(card);
-							goto read_deck_error;
-						}
-					}
-					temp_card_list[temp_card_list_len++] = card;
-					card = NULL;
-				}
+/*
+ * returns the text of one side of card i in card_list as a wide string
+ *
+ * if compact_text is true, the text is decoded into a buffer for that side, so the string is only valid until the same side of a card is asked for again. In low-memory mode, the text is only valid until another card is read
+ */
+wchar_t *card_side_text(int i, cardside_t side)
+{
+	// Decoded text of each side of the last card asked for
+	static wchar_t *decoded[2];
+	static size_t decoded_size[2];
 
-				// Invert the value of front and reset the buffer position
-				front = front ? false : true;
-				bp = 0;
-			}
-			else
-			{
-				// Collect characters in buffer
+	static wchar_t empty[1];
 
-				// Handle escape sequences
-				if (c == L'\\')
-				{
-					switch (c = fgetwc(cardfile))
-					{
-						case L'n':
-							c = L'\n';
-							break;
-						case L'\n':
-							// Backslash was placed at the end of a line
-							buffer[bp++] = L'\\';
-							ungetwc(c, cardfile);
-							continue;
-					}
-					
-				}
+	const card_t *card;
+	const char *text;
 
-				buffer[bp++] = c;
-			}
+	if (!low_memory)
+	{
+		card = &card_list[i];
+		text = card_text;
+	}
+	else if ((card = get_indexed_card(i, &text)) == NULL)
+		return empty;
 
-		}
+	uint32_t off = side == CARDSIDE_FRONT ? card->front : card->back;
+	uint32_t len = side == CARDSIDE_FRONT ? card->front_len : card->back_len;
+
+	if (!compact_text)
+		return (wchar_t *) text + off;
+
+	// Every character takes at least one byte, so len + 1 characters is always enough space
+	if (len + 1 > decoded_size[side])
+	{
+		wchar_t *temp;
+		if ((temp = reallocarray(decoded[side], len + 1, sizeof(wchar_t))) == NULL)
+			return empty;
+		decoded[side] = temp;
+		decoded_size[side] = len + 1;
+	}
+	decoded[side][decode_text(text + off, len, decoded[side])] = L'\0';
+	return decoded[side];
+}
+
+/*
+ * frees card_list and the text of its cards
+ */
+void free_card_list(void)
+{
+	// Cards loaded from a deck cache are in its mapping instead of their own allocations
+	if (!unmap_deck_cache())
+	{
+		free(card_list);
+		free(card_text);
+	}
+	free_card_index();
+	free(card_states[0]);
+	free(deck_file_cards);
+	deck_file_cards = NULL;
+	free_dedupe_table(&append_dedupe);
+	deduped_cards = 0;
+	card_list = NULL;
+	for (int i = 0; i < CARDSTATE_COUNT; i++)
+		card_states[i] = NULL;
+	card_text = NULL;
+	card_list_len = 0;
+	deleted_cards = 0;
+	card_text_len = 0;
+	card_list_size = card_text_size = card_state_words = 0;
+	have_front = false;
+}
+
+/*
+ * adds the lines of a batch to the end of card_list, pairing them into cards with the state CARDSTATE_DO_REVIEW; a front left without its back is finished by the first line of the next batch
+ *
+ * card_list has to be empty, only have cards added by this function, or have been made growable by own_card_list, since its arrays are grown in place. Text isn't interned, so identical lines are stored more than once
+ *
+ * if dedupe_mode isn't DEDUPE_NONE, cards that are duplicates of cards added before them aren't added, though their text is still copied
+ *
+ * returns errno on error
+ */
+int append_card_batch(const cardbatch_t *batch)
+{
+	size_t new_len = card_list_len + (batch->len + have_front) / 2;
+	int error_code;
 
-		if (fclose(cardfile) == EOF)
+	if ((error_code = grow_card_list(new_len, card_text_len + batch->text_len)) != 0)
+		return error_code;
+	if (dedupe_mode != DEDUPE_NONE && (error_code = reserve_dedupe_table(&append_dedupe, new_len)) != 0)
+		return error_code;
+
+	memcpy(card_text + card_text_len * CARD_CHAR_SIZE, batch->text, batch->text_len * CARD_CHAR_SIZE);
+	for (int i = 0; i < batch->len; i++)
+	{
+		card_t *card = &card_list[card_list_len];
+		const cardline_t *line = &batch->lines[i];
+
+		if (!have_front)
 		{
-			perror("fclose");
-			goto read_deck_error;
+			card->front = card_text_len + line->off;
+			card->front_len = line->len;
 		}
+		else
+		{
+			card->back = card_text_len + line->off;
+			card->back_len = line->len;
+
+			// The text of cards in this batch is already in card_text, so they can be compared with the cards before them
+			if (dedupe_mode != DEDUPE_NONE && dedupe_card(&append_dedupe, card_list, card_text, card_list_len) != card_list_len)
+				deduped_cards++;
+			else
+			{
+				BITMAP_SET(card_states[CARDSTATE_DO_REVIEW], card_list_len);
+				card_list_len++;
+			}
+		}
+		have_front = !have_front;
+	}
+	card_text_len += batch->text_len;
+	return 0;
+}
+
+/*
+ * makes card_list, card_text and card_states growable in place by append_card_batch, add_card and replace_card_text; a deck loaded from a deck cache is copied out of the cache first, since its mapping is read-only
+ *
+ * returns errno on error
+ */
+int own_card_list(void)
+{
+	// Decks built by append_card_batch are already growable, and decks in low-memory mode have no card_list
+	if (card_list_size != 0 || card_list == NULL)
+		return 0;
+
+	if (deck_cache_loaded())
+	{
+		card_t *new_card_list;
+		char *new_text;
 
-		if (card != NULL)
+		if ((new_card_list = reallocarray(NULL, card_list_len, sizeof(card_t))) == NULL)
+			return errno;
+		if ((new_text = reallocarray(NULL, MAX(card_text_len, 1), CARD_CHAR_SIZE)) == NULL)
 		{
-			// Error: a card's front has been read, but not its back
-			fprintf(stderr, "sortstudycli: no back text found for a card in file \"%s\"\n", filenames[filenum]);
-			free(card->front);
-			free(card);
-			errno = EIO;
-			goto read_deck_error;
+			free(new_card_list);
+			return errno;
 		}
+		memcpy(new_card_list, card_list, (size_t) card_list_len * sizeof(card_t));
+		memcpy(new_text, card_text, card_text_len * CARD_CHAR_SIZE);
+		unmap_deck_cache();
+		card_list = new_card_list;
+		card_text = new_text;
 	}
 
-	if (temp_card_list_len == 0)
+	card_list_size = card_list_len;
+	card_text_size = card_text_len;
+	card_state_words = BITMAP_WORDS(card_list_len);
+	return 0;
+}
+
+/*
+ * makes sure count more cards with text_len more characters of text can be added with add_card and replace_card_text without them failing; own_card_list has to have been called
+ *
+ * returns errno on error
+ */
+int reserve_cards(int count, size_t text_len)
+{
+	return grow_card_list((size_t) card_list_len + count, card_text_len + text_len);
+}
+
+/*
+ * adds lines line and line + 1 of a batch to the end of card_list as a new card with the state CARDSTATE_DO_REVIEW; own_card_list has to have been called
+ *
+ * returns errno on error
+ */
+int add_card(const cardbatch_t *batch, int line)
+{
+	card_t *card;
+	int error_code;
+
+	if ((error_code = grow_card_list((size_t) card_list_len + 1, card_text_len + batch->lines[line].len + batch->lines[line + 1].len + 2)) != 0)
+		return error_code;
+
+	card = &card_list[card_list_len];
+	card->front = copy_batch_line(batch, line);
+	card->front_len = batch->lines[line].len;
+	card->back = copy_batch_line(batch, line + 1);
+	card->back_len = batch->lines[line + 1].len;
+	set_card_state(card_list_len, CARDSTATE_DO_REVIEW);
+	card_list_len++;
+	return 0;
+}
+
+/*
+ * replaces the text of card i with lines line and line + 1 of a batch, keeping its state; the old text is left unused in card_text, since other cards may share it. own_card_list has to have been called
+ *
+ * returns errno on error
+ */
+int replace_card_text(int i, const cardbatch_t *batch, int line)
+{
+	int error_code;
+
+	if ((error_code = grow_card_list(card_list_len, card_text_len + batch->lines[line].len + batch->lines[line + 1].len + 2)) != 0)
+		return error_code;
+
+	card_list[i].front = copy_batch_line(batch, line);
+	card_list[i].front_len = batch->lines[line].len;
+	card_list[i].back = copy_batch_line(batch, line + 1);
+	card_list[i].back_len = batch->lines[line + 1].len;
+	return 0;
+}
+
+/*
+ * returns true if the text of card i is lines line and line + 1 of a batch
+ */
+bool card_matches_batch(int i, const cardbatch_t *batch, int line)
+{
+	const card_t *card = &card_list[i];
+	const cardline_t *front = &batch->lines[line], *back = &batch->lines[line + 1];
+
+	return card->front_len == front->len && card->back_len == back->len
+		&& memcmp(card_text + (size_t) card->front * CARD_CHAR_SIZE, batch->text + (size_t) front->off * CARD_CHAR_SIZE, front->len * CARD_CHAR_SIZE) == 0
+		&& memcmp(card_text + (size_t) card->back * CARD_CHAR_SIZE, batch->text + (size_t) back->off * CARD_CHAR_SIZE, back->len * CARD_CHAR_SIZE) == 0;
+}
+
+/*
+ * deletes card i by giving it the state TO_DELETE; card_list is never compacted, so deleted cards are left as tombstones that views and next_card skip over
+ */
+void delete_card(int i)
+{
+	set_card_state(i, CARDSTATE_TO_DELETE);
+	deleted_cards++;
+}
+
+/*
+ * returns the state of card i in card_list
+ */
+cardstate_t get_card_state(int i)
+{
+	if (BITMAP_TEST(card_states[CARDSTATE_DO_REVIEW], i))
+		return CARDSTATE_DO_REVIEW;
+	if (BITMAP_TEST(card_states[CARDSTATE_TO_DELETE], i))
+		return CARDSTATE_TO_DELETE;
+	return CARDSTATE_DONT_REVIEW;
+}
+
+/*
+ * sets the state of card i in card_list, removing it from the bitmap of its old state
+ */
+void set_card_state(int i, cardstate_t state)
+{
+	for (int s = 0; s < CARDSTATE_COUNT; s++)
+		BITMAP_CLEAR(card_states[s], i);
+	BITMAP_SET(card_states[state], i);
+}
+
+/*
+ * returns the number of cards in card_list with a state
+ */
+int count_cards(cardstate_t state)
+{
+	return bitmap_count(card_states[state], card_list_len);
+}
+
+/*
+ * returns the index of the first card at or after i with a state, or card_list_len if there are none
+ */
+int next_card(cardstate_t state, int i)
+{
+	if (i < 0)
+		i = 0;
+	return bitmap_next(card_states[state], card_list_len, i);
+}
+
+/*
+ * gives every card with the state from the state to, one word of each bitmap at a time
+ */
+void change_card_states(cardstate_t from, cardstate_t to)
+{
+	uint64_t *from_bits = card_states[from];
+	uint64_t *to_bits = card_states[to];
+
+	if (from == to)
+		return;
+	for (size_t i = 0; i < BITMAP_WORDS(card_list_len); i++)
 	{
-		// Error: no cards were fully read
-		fprintf(stderr, "sortstudycli: no cards found in file(s)\n");
-		free(temp_card_list);
-		return EIO;
+		to_bits[i] |= from_bits[i];
+		from_bits[i] = 0;
 	}
+}
 
-	// Resize temp_card_list to fit the actual number of card pointers it contains
-	if ((temp_card_list = reallocarray(temp_card_list, temp_card_list_len, sizeof(card_t *))) == NULL)
+/*
+ * gives every card in card_list a state
+ */
+void set_all_card_states(cardstate_t state)
+{
+	for (int s = 0; s < CARDSTATE_COUNT; s++)
 	{
-		perror("reallocarray");
-		goto read_deck_error;
+		if (s == (int) state)
+			bitmap_fill(card_states[s], card_list_len);
+		else
+			bitmap_clear_range(card_states[s], 0, card_list_len);
 	}
+}
 
-	// Allocate new mem for card_list; if successful, free everything in card_list and set its value to the new pointer
-	card_t **temp_card_list_ptr;
-	if ((temp_card_list_ptr = calloc(temp_card_list_len, sizeof(card_t *))) == NULL)
+/*
+ * reads the small regular files of a deckload_t with read_small_files, leaving the rest for map_files_worker; nothing is read if io_uring isn't available or memory can't be allocated
+ */
+static void read_small_deck_files(deckload_t *load, char **filenames)
+{
+	cardfile_t *files;
+	bool *read = NULL;
+
+	if ((files = calloc(load->filecount, sizeof(cardfile_t))) == NULL || (read = calloc(load->filecount, sizeof(bool))) == NULL)
+		goto read_small_deck_files_end;
+
+	if (read_small_files(filenames, files, read, load->filecount) > 0)
 	{
-		perror("calloc");
-		goto read_deck_error;
+		for (int i = 0; i < load->filecount; i++)
+		{
+			if (!read[i])
+				continue;
+			load->files[i].cardfile = files[i];
+			load->files[i].loaded = true;
+		}
 	}
-	free_card_list(card_list, card_list_len);
-	card_list = temp_card_list_ptr;
 
-	// Copy the elements of temp_card_list into card_list, then set card_list_len
-	for (int i = 0; i < temp_card_list_len; i++)
-		card_list[i] = temp_card_list[i];
-	card_list_len = temp_card_list_len;
+	read_small_deck_files_end:
+	free(files);
+	free(read);
+}
+
+/*
+ * maps card files from a deckload_t until there are none left
+ *
+ * files after one that has failed to map are skipped, since read_deck won't use them
+ */
+static void *map_files_worker(void *arg)
+{
+	deckload_t *load = arg;
+	fileload_t *file;
+	int i, failed;
 
-	free(temp_card_list);
-	return 0;
-	
-	// Free temp list & its contents on random errors
-	read_deck_error:
-	free_card_list(temp_card_list, temp_card_list_len);
-	return errno;
+	while ((i = atomic_fetch_add(&load->next, 1)) < load->filecount)
+	{
+		if (i > atomic_load(&load->failed))
+			continue;
+
+		file = &load->files[i];
+		if (file->loaded)
+			continue;
+		if ((load->find_streamed ? map_unstreamed_card_file(file->filename, &file->cardfile, &file->streamed, &file->error)
+			: map_card_file(file->filename, &file->cardfile, &file->error)) != 0)
+		{
+			// Lower failed to this file's index if it's the first failure so far
+			failed = atomic_load(&load->failed);
+			while (i < failed && !atomic_compare_exchange_weak(&load->failed, &failed, i));
+		}
+	}
+	return NULL;
 }
 
 /*
- * frees a card pointer (type card_t *)
+ * parses ranges of card files from a deckload_t into their batches until there are none left
  */
-void free_card(card_t *card)
+static void *parse_chunks_worker(void *arg)
 {
-	free(card->front);
-	free(card->back);
-	free(card);
+	deckload_t *load = arg;
+	chunkload_t *chunk;
+	int i;
+
+	while ((i = atomic_fetch_add(&load->next, 1)) < load->chunkcount)
+	{
+		chunk = &load->chunks[i];
+		parse_card_range(&load->files[chunk->file].cardfile, chunk->start, chunk->end, &chunk->batch, &chunk->error);
+	}
+	return NULL;
 }
 
 /*
- * frees a card list (type card_t **) and all of its elements
+ * splits the mapped card files of a deckload_t into ranges that start at line starts; files before the first one that failed to map are split
+ *
+ * the text of every range is given enough of one array to hold the most text its bytes can decode to, so join_chunks can join the text of every range in place
+ *
+ * returns errno on error
  */
-void free_card_list(card_t **list, int len)
+static int split_files(deckload_t *load, int threads)
 {
-	for (int i = 0; i < len; i++)
-		free_card(list[i]);
-	free(list);
+	int failed = atomic_load(&load->failed);
+	int max_chunks = threads == 1 ? 1 : threads * CHUNKS_PER_THREAD;
+	int count = 0;
+	size_t len, text_size = 0;
+
+	// Pick the number of ranges for each file
+	for (int i = 0; i < failed; i++)
+	{
+		len = load->files[i].cardfile.len;
+		load->files[i].first_chunk = count;
+		load->files[i].chunkcount = MIN(MAX(len / CHUNK_MIN_SIZE, 1), (size_t) max_chunks);
+		count += load->files[i].chunkcount;
+		text_size += len + load->files[i].chunkcount;
+	}
+
+	if ((load->chunks = calloc(count, sizeof(chunkload_t))) == NULL)
+		return errno;
+	load->chunkcount = count;
+	if (count != 0 && (load->text = reallocarray(NULL, text_size, CARD_CHAR_SIZE)) == NULL)
+		return errno;
+	text_size = 0;
+
+	// Place range boundaries at the first line start after evenly spaced offsets
+	for (int i = 0; i < failed; i++)
+	{
+		fileload_t *file = &load->files[i];
+		size_t start = 0, end;
+
+		len = file->cardfile.len;
+		for (int j = 0; j < file->chunkcount; j++)
+		{
+			chunkload_t *chunk = &load->chunks[file->first_chunk + j];
+
+			end = j == file->chunkcount - 1 ? len : find_line_start(&file->cardfile, len / file->chunkcount * (j + 1));
+			chunk->file = i;
+			chunk->start = start;
+			chunk->end = MAX(start, end);
+			start = chunk->end;
+
+			chunk->batch.text = load->text + text_size * CARD_CHAR_SIZE;
+			chunk->batch.text_size = chunk->end - chunk->start + 1;
+			text_size += chunk->batch.text_size;
+		}
+	}
+
+	return 0;
 }
 
 /*
- * Deletes every card in card_list with a state of TO_DELETE
+ * pairs the lines of the ranges of every file into cards, in the order the files were given, then replaces card_list with the new cards
+ *
+ * each line is moved down to the end of the text of the lines before it, unless an identical line has already been moved; cards then share that line's text instead. The unused end of the text is given back afterwards
+ *
+ * if dedupe_mode isn't DEDUPE_NONE, each card is looked up in a dedupe table as soon as it's paired, and dropped if it's a duplicate of a card before it, taking it out of the count of its file in file_cards. Exact duplicates take no text, since their lines were interned
  *
  * returns errno on error
  */
-int delete_marked_cards(void)
+static int join_chunks(deckload_t *load, int *file_cards)
 {
-	// Allocate new mem for card_list and review_list
-	card_t **new_card_list;
-	int new_len;
-
-	new_len = card_list_len;
-	for (int i = 0; i < card_list_len; i++)
-		if (card_list[i]->state == CARDSTATE_TO_DELETE)
-			new_len--;
-	
-	if (new_len * sizeof(card_t *) > PTRDIFF_MAX)
+	card_t *new_card_list, *temp;
+	uint64_t *new_states;
+	char *new_text;
+	interntable_t table;
+	dedupetable_t dedupe = {NULL, 0, 0};
+	int new_len = 0, np = 0, dropped = 0;
+
+	for (int i = 0; i < load->chunkcount; i++)
+		new_len += load->chunks[i].batch.len;
+	new_len /= 2;
+
+	if (new_len == 0)
+	{
+		// Error: no cards were fully read
+		fprintf(stderr, "sortstudycli: no cards found in file(s)\n");
 		return EIO;
+	}
 
-	if ((new_card_list = calloc(new_len, sizeof(card_t *))) == NULL)
+	if ((new_card_list = calloc(new_len, sizeof(card_t))) == NULL)
+	{
+		perror("calloc");
+		return errno;
+	}
+	if (init_intern_table(&table, (size_t) new_len * 2) != 0)
+	{
+		perror("malloc");
+		free(new_card_list);
+		return errno;
+	}
+	if (dedupe_mode != DEDUPE_NONE && reserve_dedupe_table(&dedupe, new_len) != 0)
+	{
+		perror("malloc");
+		free_intern_table(&table);
+		free(new_card_list);
 		return errno;
+	}
+
+	// Number of characters of text kept so far
+	size_t text_len = 0;
 
-	// Position in new_card_list
-	int np;
+	// Number of characters of text shared with identical lines
+	size_t saved = 0;
 
-	// Add card pointers to new_card_list and free cards marked for deletion
-	np = 0;
-	for (int i = 0; i < card_list_len; i++)
+	// True if the next line is the front of a card, which may be at the end of a different range than its back
+	bool front = true;
+
+	for (int i = 0; i < load->chunkcount; i++)
 	{
-		if (card_list[i]->state != CARDSTATE_TO_DELETE)
-		{
-			// Card isn't marked for deletion, add its pointer to new_card_list
-			new_card_list[np++] = card_list[i];
-		}
-		else
+		cardbatch_t *batch = &load->chunks[i].batch;
+
+		for (int j = 0; j < batch->len; j++)
 		{
-			// Card is marked for deletion, free it
-			free_card(card_list[i]);
+			cardline_t *line = &batch->lines[j];
+			card_t *card = &new_card_list[np];
+			uint32_t off;
+
+			// Error: card text can't be referred to by 32-bit offsets
+			if (text_len + line->len + 1 > UINT32_MAX)
+			{
+				fprintf(stderr, "sortstudycli: deck is too large\n");
+				free_intern_table(&table);
+				free_dedupe_table(&dedupe);
+				free(new_card_list);
+				return EOVERFLOW;
+			}
+
+			// Lines are only ever moved down, so this never overwrites lines that haven't been moved yet
+			memmove(load->text + text_len * CARD_CHAR_SIZE, batch->text + line->off * CARD_CHAR_SIZE, (line->len + 1) * CARD_CHAR_SIZE);
+			if ((off = intern_text(&table, load->text, CARD_CHAR_SIZE, text_len, line->len, line->hash)) == text_len)
+				text_len += line->len + 1;
+			else
+				saved += line->len + 1;
+
+			if (front)
+			{
+				card->front = off;
+				card->front_len = line->len;
+			}
+			else
+			{
+				card->back = off;
+				card->back_len = line->len;
+
+				// The next card is paired in the same place if this one is dropped
+				if (dedupe_mode != DEDUPE_NONE && dedupe_card(&dedupe, new_card_list, load->text, np) != np)
+				{
+					file_cards[load->chunks[i].file]--;
+					dropped++;
+				}
+				else
+					np++;
+			}
+			front = !front;
 		}
 	}
 
-	// Free card_list itself and set it to new_card_list
-	free(card_list);
+	free_intern_table(&table);
+	free_dedupe_table(&dedupe);
+	new_len = np;
+
+	// Give back the cards that were dropped
+	if (dropped != 0 && (temp = reallocarray(new_card_list, new_len, sizeof(card_t))) != NULL)
+		new_card_list = temp;
+
+	if ((new_states = calloc(BITMAP_WORDS(new_len) * CARDSTATE_COUNT, sizeof(uint64_t))) == NULL)
+	{
+		perror("calloc");
+		free(new_card_list);
+		return errno;
+	}
+
+	// Give back the text the ranges didn't use
+	if ((new_text = reallocarray(load->text, text_len, CARD_CHAR_SIZE)) == NULL)
+		new_text = load->text;
+	load->text = NULL;
+
+	free_card_list();
 	card_list = new_card_list;
 	card_list_len = new_len;
+	for (int i = 0; i < CARDSTATE_COUNT; i++)
+		card_states[i] = new_states + BITMAP_WORDS(new_len) * i;
+	set_all_card_states(CARDSTATE_DO_REVIEW);
+	card_text = new_text;
+	card_text_len = text_len;
+	intern_saved_bytes = saved * CARD_CHAR_SIZE;
+	deduped_cards = dropped;
+	return 0;
+}
+
+/*
+ * grows card_list, card_text and card_states to twice the size they need to hold new_len cards and new_text_len characters of text, if they can't hold them already, so adding cards takes amortized constant time
+ *
+ * returns errno on error
+ */
+static int grow_card_list(size_t new_len, size_t new_text_len)
+{
+	if (new_len > INT_MAX || new_text_len > UINT32_MAX)
+		return EOVERFLOW;
 
+	if (new_len + 1 > card_list_size)
+	{
+		size_t size = MAX(new_len + 1, MAX(card_list_size * 2, CARD_ARRAY_ESTSIZE));
+		card_t *temp;
+
+		if ((temp = reallocarray(card_list, size, sizeof(card_t))) == NULL)
+			return errno;
+		card_list = temp;
+		card_list_size = size;
+	}
+	if (new_text_len > card_text_size)
+	{
+		size_t size = MAX(new_text_len, card_text_size * 2);
+		char *temp;
+
+		if ((temp = reallocarray(card_text, size, CARD_CHAR_SIZE)) == NULL)
+			return errno;
+		card_text = temp;
+		card_text_size = size;
+	}
+	if (BITMAP_WORDS(new_len) > card_state_words)
+	{
+		size_t words = MAX(BITMAP_WORDS(new_len), card_state_words * 2);
+		uint64_t *temp, *old = card_states[0];
+
+		if ((temp = calloc(words * CARDSTATE_COUNT, sizeof(uint64_t))) == NULL)
+			return errno;
+		for (int i = 0; i < CARDSTATE_COUNT; i++)
+		{
+			if (card_state_words != 0)
+				memcpy(temp + words * i, card_states[i], card_state_words * sizeof(uint64_t));
+			card_states[i] = temp + words * i;
+		}
+		free(old);
+		card_state_words = words;
+	}
 	return 0;
 }
+
+/*
+ * copies line of a batch, with its null terminator, to the end of card_text
+ *
+ * returns the offset of the copy in card_text
+ */
+static uint32_t copy_batch_line(const cardbatch_t *batch, int line)
+{
+	const cardline_t *l = &batch->lines[line];
+	uint32_t off = card_text_len;
+
+	memcpy(card_text + card_text_len * CARD_CHAR_SIZE, batch->text + (size_t) l->off * CARD_CHAR_SIZE, (l->len + 1) * CARD_CHAR_SIZE);
+	card_text_len += l->len + 1;
+	return off;
+}
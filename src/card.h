@@ -7,40 +7,179 @@
 #ifndef	CARD_H
 #define	CARD_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
 // The estimated size for card_list when reading a deck
 #define	CARD_ARRAY_ESTSIZE	100
 
-// The maximum amount of characters read for each line in a card file
-#define	MAX_LINE_CHARS		5000
+// Size of each character of card text
+#define	CARD_CHAR_SIZE		(compact_text ? sizeof(char) : sizeof(wchar_t))
 
 // Card and card state types
 typedef enum cardstate{
 	CARDSTATE_DONT_REVIEW,
 	CARDSTATE_DO_REVIEW,
-	CARDSTATE_TO_DELETE
+
+	// The card has been deleted
+	CARDSTATE_TO_DELETE,
+
+	// Number of card states
+	CARDSTATE_COUNT
 } cardstate_t;
 typedef struct card{
-	wchar_t *front;
-	wchar_t *back;
-	cardstate_t state;
+	// Offsets of the null-terminated front and back text in card_text, in characters of CARD_CHAR_SIZE
+	uint32_t front;
+	uint32_t back;
+
+	// Lengths of the front and back text in characters of CARD_CHAR_SIZE, not including the null terminators
+	uint32_t front_len;
+	uint32_t back_len;
 } card_t;
 
-// Array of card pointers
-extern card_t **card_list;
+// Which cards read_deck removes as duplicates of cards read before them
+typedef enum dedupemode{
+	DEDUPE_NONE,
+
+	// Cards with identical front and back text
+	DEDUPE_EXACT,
+
+	// Cards whose text is the same ignoring case and whitespace
+	DEDUPE_NORMALIZED
+} dedupemode_t;
+
+// Sides of a card
+typedef enum cardside{
+	CARDSIDE_FRONT,
+	CARDSIDE_BACK
+} cardside_t;
+
+// Line of a batch stored in the batch's text
+typedef struct cardline{
+	// Offset of the line in the text of the batch
+	uint32_t off;
+
+	// Length of the line in characters
+	uint32_t len;
+
+	// Hash of the text of the line, used to find identical lines
+	uint32_t hash;
+} cardline_t;
+
+// Lines read from a card file and the text they're stored in; every two lines make the front and back of a card
+typedef struct cardbatch{
+	cardline_t *lines;
+
+	// Number of lines in the array
+	int len;
+
+	// Number of lines the array can hold
+	int size;
+
+	// Null-terminated text of every line, one after another, in characters of CARD_CHAR_SIZE; this is part of a larger array owned by whatever set up the batch
+	char *text;
+
+	// Number of characters in text and the number it can hold
+	size_t text_len;
+	size_t text_size;
+} cardbatch_t;
+
+// Array of cards; cards keep their place in it once a deck is read, and views (view.h) pick the order they're shown in. In low-memory mode this is NULL and cards are read with get_indexed_card
+extern card_t *card_list;
 
 // Length of card_list
 extern int card_list_len;
 
-// Reads a deck of cards from one or more files
-int read_deck(char **filenames, int filecount);
+// Bitmaps of the states of the cards in card_list; bit i of card_states[state] is set if card i has that state, and each card is in exactly one bitmap
+extern uint64_t *card_states[CARDSTATE_COUNT];
+
+// Number of cards in card_list that have been deleted
+extern int deleted_cards;
+
+// Text of every card in card_list; wide characters, or multibyte text if compact_text is true
+extern char *card_text;
+
+// Number of characters of CARD_CHAR_SIZE in card_text
+extern size_t card_text_len;
+
+// True if card text is kept as the multibyte text of the card files and only decoded to wide characters when it's shown
+extern bool compact_text;
+
+// True if decks are read in low-memory mode (cardindex.h), which leaves card_list and card_text empty
+extern bool low_memory;
+
+// True if decks are loaded from and saved to deck caches (deckcache.h)
+extern bool use_deck_cache;
+
+// Number of bytes of card text saved by storing identical text once when the deck was read
+extern size_t intern_saved_bytes;
+
+// Duplicate cards removed when the deck is read (dedupe.h)
+extern dedupemode_t dedupe_mode;
+
+// Number of duplicate cards removed when the deck was read
+extern int deduped_cards;
+
+// Number of cards read from each card file of the deck, in the order the files were given; the cards of each file follow the cards of the file before it in card_list. NULL if the deck wasn't read by read_deck
+extern int *deck_file_cards;
+
+// Reads a deck of cards from one or more files, or sets streamed if it should be read by the stream thread instead
+int read_deck(char **filenames, int filecount, bool *streamed);
+
+// Adds the lines of a batch to the end of card_list; returns errno on error
+int append_card_batch(const cardbatch_t *batch);
+
+// Makes card_list growable by the functions that add cards to it; returns errno on error
+int own_card_list(void);
+
+// Makes sure cards and text can be added to card_list without failing; returns errno on error
+int reserve_cards(int count, size_t text_len);
+
+// Adds two lines of a batch to the end of card_list as a new card; returns errno on error
+int add_card(const cardbatch_t *batch, int line);
+
+// Replaces the text of a card with two lines of a batch; returns errno on error
+int replace_card_text(int i, const cardbatch_t *batch, int line);
+
+// Returns true if the text of a card is two lines of a batch
+bool card_matches_batch(int i, const cardbatch_t *batch, int line);
+
+// Returns a pointer to the free text of a batch if it can hold n more characters, or NULL if it can't
+void *get_batch_text(cardbatch_t *batch, size_t n);
+
+// Adds a line of len characters, written to the space returned by get_batch_text, to a batch
+int add_batch_line(cardbatch_t *batch, size_t len);
+
+// Frees the lines of a batch
+void free_batch(cardbatch_t *batch);
+
+// Returns the text of one side of card i in card_list as a wide string
+wchar_t *card_side_text(int i, cardside_t side);
+
+// Frees card_list and the text of its cards
+void free_card_list(void);
+
+// Returns the state of card i in card_list
+cardstate_t get_card_state(int i);
+
+// Sets the state of card i in card_list
+void set_card_state(int i, cardstate_t state);
+
+// Returns the number of cards in card_list with a state
+int count_cards(cardstate_t state);
+
+// Returns the index of the first card at or after i with a state, or card_list_len if there are none
+int next_card(cardstate_t state, int i);
 
-// Frees a card from its pointer
-void free_card(card_t *card);
+// Gives every card with the state from the state to
+void change_card_states(cardstate_t from, cardstate_t to);
 
-// Frees the a card array and all of its elements
-void free_card_list(card_t **, int);
+// Gives every card in card_list a state
+void set_all_card_states(cardstate_t state);
 
-// Deletes cards in card_list that have the state TO_DELETE
-int delete_marked_cards(void);
+// Deletes card i in card_list, leaving it in card_list as a tombstone
+void delete_card(int i);
 
 #endif
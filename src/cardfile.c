@@ -0,0 +1,686 @@
+/*
+ * cardfile.c
+ *
+ * This file contains functions for mapping card files into memory and parsing their contents into cards.
+ *
+ * Card files are mapped with mmap so the parser can find line boundaries in place; compressed card files and pipes are read into a buffer instead. The structural scanner in scan.c finds newlines, comments and escapes, and lines without comments or escape sequences are decoded (or in compact mode, copied) straight from the mapping into the text of a batch. Only lines containing "#" or "\\" are copied into a buffer to be resolved first.
+ */
+
+// memrchr is a GNU extension
+#define	_GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "card.h"
+#include "cardfile.h"
+#include "decompress.h"
+#include "scan.h"
+
+// Size of each read when a card file can't be mapped
+#define	READ_CHUNK_SIZE		65536
+
+// Initial size of the buffer used for lines that contain comments or escape sequences
+#define	LINEBUF_ESTSIZE		256
+
+// Growable buffer holding the unescaped bytes of a line
+typedef struct linebuf{
+	char *s;
+	size_t len;
+	size_t size;
+} linebuf_t;
+
+// Records an error for print_load_error and returns its errno value
+static int set_load_error(loaderror_t *error, int code, const char *func);
+
+// Reads a file that can't be mapped (e.g. a pipe) into a malloc'd buffer
+static int read_card_fd(int fd, cardfile_t *file, loaderror_t *error);
+
+// Appends bytes to a line buffer; returns errno on error
+static int linebuf_append(linebuf_t *buf, const char *s, size_t n);
+
+// Returns true if a line (without its newline) has a comment
+static bool has_comment(const char *line, size_t len);
+
+// Finds the next line of the text being scanned, resolving comments and escapes
+static int next_line(scanner_t *scanner, size_t *pp, linebuf_t *buf, const char **line, size_t *line_len);
+
+// Maps a card file into memory, or sets *streamed if it has to be streamed and streamed isn't NULL; returns errno on error
+static int map_file(const char *filename, cardfile_t *file, bool *streamed, loaderror_t *error);
+
+// Reads a line containing comments or escape sequences into a line buffer
+static int read_escaped_line(scanner_t *scanner, size_t *pp, size_t q, linebuf_t *buf, bool *terminated);
+
+/*
+ * maps a card file into memory; regular files are mapped with mmap, anything else (including compressed files) is read into a buffer
+ *
+ * a filename of "-" is standard input
+ *
+ * returns errno on error
+ */
+int map_card_file(const char *filename, cardfile_t *file, loaderror_t *error)
+{
+	return map_file(filename, file, NULL, error);
+}
+
+/*
+ * maps a card file into memory like map_card_file, unless it's compressed or isn't a regular file; then *streamed is set to true and nothing is read, since the stream thread reads those files as they're decompressed or written instead of waiting for their end
+ *
+ * returns errno on error
+ */
+int map_unstreamed_card_file(const char *filename, cardfile_t *file, bool *streamed, loaderror_t *error)
+{
+	*streamed = false;
+	return map_file(filename, file, streamed, error);
+}
+
+/*
+ * maps a card file into memory for map_card_file and map_unstreamed_card_file; if streamed isn't NULL, files that have to be streamed set it instead of being read into a buffer
+ *
+ * returns errno on error
+ */
+static int map_file(const char *filename, cardfile_t *file, bool *streamed, loaderror_t *error)
+{
+	int fd;
+	struct stat st;
+	int error_code;
+
+	// Pipes are never opened here, since what was written to them would be lost when they're closed before the stream thread reads them; files that can't be found are left for open to report
+	if (streamed != NULL && stat(filename, &st) == 0 && !S_ISREG(st.st_mode))
+	{
+		*streamed = true;
+		file->data = NULL;
+		file->len = 0;
+		return 0;
+	}
+
+	if ((fd = open_card_file(filename)) == -1)
+		return set_load_error(error, errno, "open");
+
+	if (fstat(fd, &st) == -1)
+	{
+		error_code = set_load_error(error, errno, "fstat");
+		goto map_card_file_error;
+	}
+
+	// Compressed files are decompressed into a buffer like files that can't be mapped
+	if (!S_ISREG(st.st_mode) || is_compressed_fd(fd))
+	{
+		if (streamed != NULL)
+		{
+			*streamed = true;
+			file->data = NULL;
+			file->len = 0;
+			close(fd);
+			return 0;
+		}
+		if ((error_code = read_card_fd(fd, file, error)) != 0)
+		{
+			close(fd);
+			return error_code;
+		}
+		close(fd);
+		return 0;
+	}
+
+	file->data = NULL;
+	file->len = st.st_size;
+	file->mapped = true;
+
+	// mmap can't map empty files
+	if (file->len != 0)
+	{
+		void *map;
+		if ((map = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		{
+			error_code = set_load_error(error, errno, "mmap");
+			goto map_card_file_error;
+		}
+		madvise(map, file->len, MADV_SEQUENTIAL);
+		file->data = map;
+	}
+
+	close(fd);
+	return 0;
+
+	map_card_file_error:
+	close(fd);
+	return error_code;
+}
+
+/*
+ * opens a card file for reading, duplicating standard input if the filename is "-" so the file can always be closed
+ *
+ * returns -1 on error
+ */
+int open_card_file(const char *filename)
+{
+	if (strcmp(filename, "-") == 0)
+		return dup(STDIN_FILENO);
+	return open(filename, O_RDONLY);
+}
+
+/*
+ * unmaps or frees the contents of a card file
+ */
+void unmap_card_file(cardfile_t *file)
+{
+	if (file->data == NULL)
+		return;
+	if (file->mapped)
+		munmap((void *) file->data, file->len);
+	else
+		free((void *) file->data);
+	file->data = NULL;
+	file->len = 0;
+}
+
+/*
+ * parses the bytes of a card file from start to end, adding every line in them to batch; start and end should be line starts found with find_line_start
+ *
+ * every character and line break takes at least one byte, so the text of batch only needs room for end - start characters and a null terminator
+ *
+ * the first line of each pair is the front of a card and the second line is the back; a "#" skips the rest of its line (including the newline), and "\n" in a line is replaced with a newline
+ *
+ * returns errno on error
+ */
+int parse_card_range(const cardfile_t *file, size_t start, size_t end, cardbatch_t *batch, loaderror_t *error)
+{
+	scanner_t scanner;
+
+	// Offset of the start of the current line
+	size_t p = 0;
+
+	// Buffer for lines with comments or escape sequences
+	linebuf_t buf = {NULL, 0, 0};
+
+	// Text of the line being stored and its length in bytes
+	const char *line;
+	size_t line_len;
+
+	void *text;
+
+	scan_init(&scanner, file->data + start, end - start);
+
+	for (;;)
+	{
+		if (next_line(&scanner, &p, &buf, &line, &line_len) != 0)
+		{
+			set_load_error(error, errno, "realloc");
+			goto parse_card_range_error;
+		}
+		if (line == NULL)
+			break;
+
+		if ((text = get_batch_text(batch, line_len + 1)) == NULL)
+		{
+			set_load_error(error, ENOBUFS, "parse_card_range");
+			goto parse_card_range_error;
+		}
+
+		// Compact text is stored as it was written in the file
+		if (compact_text)
+			memcpy(text, line, line_len);
+		else
+			line_len = decode_text(line, line_len, text);
+
+		if (add_batch_line(batch, line_len) != 0)
+		{
+			set_load_error(error, errno, "reallocarray");
+			goto parse_card_range_error;
+		}
+	}
+
+	free(buf.s);
+	return 0;
+
+	parse_card_range_error:
+	free(buf.s);
+	return error->code;
+}
+
+/*
+ * adds base plus the offset of the start of every card in a card file to an array of offsets, without storing any card text, so cards can be read from the file one at a time later
+ *
+ * returns errno on error, recording a card without back text like read_deck would
+ */
+int find_card_starts(const cardfile_t *file, uint64_t base, uint64_t **starts, int *len, int *size, loaderror_t *error)
+{
+	scanner_t scanner;
+	linebuf_t buf = {NULL, 0, 0};
+	const char *line;
+	size_t line_len, p = 0, line_start;
+
+	// True if the next line is the front of a card
+	bool front = true;
+
+	scan_init(&scanner, file->data, file->len);
+
+	for (;;)
+	{
+		line_start = p;
+		if (next_line(&scanner, &p, &buf, &line, &line_len) != 0)
+		{
+			set_load_error(error, errno, "realloc");
+			goto find_card_starts_error;
+		}
+		if (line == NULL)
+			break;
+
+		if (front)
+		{
+			if (*len == INT_MAX)
+			{
+				set_load_error(error, EOVERFLOW, "find_card_starts");
+				goto find_card_starts_error;
+			}
+			if (*len == *size)
+			{
+				uint64_t *temp;
+				int new_size = *size == 0 ? CARD_ARRAY_ESTSIZE : *size > INT_MAX / 2 ? INT_MAX : *size * 2;
+
+				if ((temp = reallocarray(*starts, new_size, sizeof(uint64_t))) == NULL)
+				{
+					set_load_error(error, errno, "reallocarray");
+					goto find_card_starts_error;
+				}
+				*starts = temp;
+				*size = new_size;
+			}
+			(*starts)[(*len)++] = base + line_start;
+		}
+		front = !front;
+	}
+
+	free(buf.s);
+
+	// Error: a card's front has been read, but not its back
+	if (!front)
+		return set_load_error(error, EIO, NULL);
+	return 0;
+
+	find_card_starts_error:
+	free(buf.s);
+	return error->code;
+}
+
+/*
+ * counts the cards of a card file without keeping their text, the same way parse_card_range would pair its lines
+ *
+ * returns the number of cards, or -1 on error
+ */
+int count_file_cards(const cardfile_t *file, loaderror_t *error)
+{
+	scanner_t scanner;
+	linebuf_t buf = {NULL, 0, 0};
+	const char *line;
+	size_t line_len, p = 0;
+	long lines = 0;
+
+	scan_init(&scanner, file->data, file->len);
+
+	for (;;)
+	{
+		if (next_line(&scanner, &p, &buf, &line, &line_len) != 0)
+		{
+			set_load_error(error, errno, "realloc");
+			free(buf.s);
+			return -1;
+		}
+		if (line == NULL)
+			break;
+		lines++;
+	}
+
+	free(buf.s);
+
+	// Error: a card's front has been read, but not its back
+	if (lines % 2 != 0)
+	{
+		set_load_error(error, EIO, NULL);
+		return -1;
+	}
+	if (lines / 2 > INT_MAX)
+	{
+		set_load_error(error, EOVERFLOW, "count_file_cards");
+		return -1;
+	}
+	return lines / 2;
+}
+
+/*
+ * finds the first line start at or after pos, so a file can be split into ranges that parse_card_range parses the same way as the whole file
+ *
+ * a newline only starts a new line when the line before it has no comment, since a comment joins its line with the next one; escapes never carry over newlines, so whether a line has a comment only depends on that line
+ *
+ * returns the length of the file if there are no line starts after pos
+ */
+size_t find_line_start(const cardfile_t *file, size_t pos)
+{
+	const char *data = file->data;
+	const char *newline, *line;
+
+	if (pos == 0)
+		return 0;
+	if (pos >= file->len)
+		return file->len;
+
+	// Find the newline ending the line that pos - 1 is on, and the start of that line
+	if ((newline = memchr(data + pos - 1, '\n', file->len - pos + 1)) == NULL)
+		return file->len;
+	line = memrchr(data, '\n', pos - 1);
+	line = line == NULL ? data : line + 1;
+
+	for (;;)
+	{
+		if (!has_comment(line, newline - line))
+			return newline + 1 - data;
+
+		line = newline + 1;
+		if ((newline = memchr(line, '\n', data + file->len - line)) == NULL)
+			return file->len;
+	}
+}
+
+/*
+ * finds the last line start in a card file that has only been partly read, so the lines before it can be parsed without waiting for the rest of the file
+ *
+ * a line only ends at a newline if the physical line before the newline has no comment, like in find_line_start
+ *
+ * returns 0 if no line has been fully read
+ */
+size_t find_last_line_start(const cardfile_t *file)
+{
+	const char *data = file->data;
+	const char *newline, *line;
+	size_t end = file->len;
+
+	while ((newline = memrchr(data, '\n', end)) != NULL)
+	{
+		line = memrchr(data, '\n', newline - data);
+		line = line == NULL ? data : line + 1;
+		if (!has_comment(line, newline - line))
+			return newline + 1 - data;
+		end = line - data;
+	}
+	return 0;
+}
+
+/*
+ * prints an error recorded while loading a card file, in the same format perror would have printed it in
+ */
+void print_load_error(const char *filename, const loaderror_t *error)
+{
+	if (error->func == NULL)
+		fprintf(stderr, "sortstudycli: no back text found for a card in file \"%s\"\n", filename);
+	else
+		fprintf(stderr, "%s: %s\n", error->func, strerror(error->code));
+}
+
+/*
+ * records an error for print_load_error
+ *
+ * returns code
+ */
+static int set_load_error(loaderror_t *error, int code, const char *func)
+{
+	error->code = code;
+	error->func = func;
+	return code;
+}
+
+/*
+ * reads the entire contents of fd into a malloc'd buffer, decompressing them if the file is compressed
+ *
+ * returns errno on error
+ */
+static int read_card_fd(int fd, cardfile_t *file, loaderror_t *error)
+{
+	cardreader_t reader;
+	char *data = NULL, *temp;
+	size_t len = 0, size = 0;
+	ssize_t bytes_read;
+
+	if (open_card_reader(&reader, fd, error) != 0)
+	{
+		close_card_reader(&reader);
+		return error->code;
+	}
+
+	for (;;)
+	{
+		if (len + READ_CHUNK_SIZE > size)
+		{
+			size = size == 0 ? READ_CHUNK_SIZE : size * 2;
+			if ((temp = realloc(data, size)) == NULL)
+			{
+				set_load_error(error, errno, "realloc");
+				goto read_card_fd_error;
+			}
+			data = temp;
+		}
+
+		if ((bytes_read = read_card_reader(&reader, data + len, size - len, error)) == -1)
+			goto read_card_fd_error;
+		if (bytes_read == 0)
+			break;
+		len += bytes_read;
+	}
+
+	close_card_reader(&reader);
+	file->data = data;
+	file->len = len;
+	file->mapped = false;
+	return 0;
+
+	read_card_fd_error:
+	close_card_reader(&reader);
+	free(data);
+	return error->code;
+}
+
+/*
+ * appends n bytes from s to a line buffer
+ *
+ * returns errno on error
+ */
+static int linebuf_append(linebuf_t *buf, const char *s, size_t n)
+{
+	if (buf->len + n > buf->size)
+	{
+		size_t size = buf->size == 0 ? LINEBUF_ESTSIZE : buf->size;
+		char *temp;
+
+		while (size < buf->len + n)
+			size *= 2;
+		if ((temp = realloc(buf->s, size)) == NULL)
+			return errno;
+		buf->s = temp;
+		buf->size = size;
+	}
+	memcpy(buf->s + buf->len, s, n);
+	buf->len += n;
+	return 0;
+}
+
+/*
+ * returns true if a line, not including its newline, contains a "#" that isn't escaped
+ */
+static bool has_comment(const char *line, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		if (line[i] == '\\')
+			i++;
+		else if (line[i] == '#')
+			return true;
+	}
+	return false;
+}
+
+/*
+ * finds the line starting at *pp in the text being scanned and moves *pp past its end; *line is set to the text of the line, which is either in the scanned text or in buf, and *line_len to its length in bytes
+ *
+ * *line is set to NULL if there are no lines left
+ *
+ * returns errno on error
+ */
+static int next_line(scanner_t *scanner, size_t *pp, linebuf_t *buf, const char **line, size_t *line_len)
+{
+	const char *data = scanner->data;
+	size_t len = scanner->len;
+	size_t p = *pp, q;
+
+	// True if the line was ended by a newline instead of the end of the text
+	bool terminated;
+
+	*line = NULL;
+	if (p >= len)
+		return 0;
+
+	q = scan_next(scanner);
+	if (q == len || data[q] == '\n')
+	{
+		// Plain line, use its text directly from the file
+		*line = data + p;
+		*line_len = q - p;
+		terminated = q < len;
+		*pp = q + 1;
+	}
+	else
+	{
+		// The line has a comment or an escape, resolve it in the buffer
+		if (read_escaped_line(scanner, pp, q, buf, &terminated) != 0)
+			return errno;
+		// Nothing is put in the buffer for a line that resolves to nothing, which is still a line
+		*line = buf->s != NULL ? buf->s : "";
+		*line_len = buf->len;
+	}
+
+	// Text after the last newline of a file only counts as a line if there is some
+	if (!terminated && *line_len == 0)
+		*line = NULL;
+	return 0;
+}
+
+/*
+ * reads a line that contains comments or escape sequences into buf, resolving both; the line starts at *pp, which is moved past the end of the line, and q is the offset of its first structural character
+ *
+ * a comment skips the rest of its line including the newline, so the line continues on the next line of the file
+ *
+ * escapes:
+ * 	\n		newline
+ * 	\ at line end	a backslash (the newline still ends the line)
+ * 	\c		the character c (e.g. "\\" or "\#")
+ *
+ * returns errno on error
+ */
+static int read_escaped_line(scanner_t *scanner, size_t *pp, size_t q, linebuf_t *buf, bool *terminated)
+{
+	const char *data = scanner->data;
+	size_t len = scanner->len;
+	size_t p;
+	char c;
+
+	buf->len = 0;
+	*terminated = false;
+	p = *pp;
+	for (;;)
+	{
+		if (linebuf_append(buf, data + p, q - p) != 0)
+			return errno;
+		if (q == len)
+			break;
+
+		switch (data[q])
+		{
+			case '\n':
+				*pp = q + 1;
+				*terminated = true;
+				return 0;
+			case '#':
+				// Skip the comment
+				while ((q = scan_next(scanner)) < len && data[q] != '\n');
+				p = q == len ? len : q + 1;
+				break;
+			case '\\':
+				if (q + 1 == len)
+				{
+					// Backslash at the end of the file
+					c = '\\';
+					p = len;
+				}
+				else if (data[q + 1] == '\n')
+				{
+					// Backslash at the end of a line, keep it and let the newline end the line
+					c = '\\';
+					p = q + 1;
+				}
+				else
+				{
+					c = data[q + 1] == 'n' ? '\n' : data[q + 1];
+					p = q + 2;
+					scan_seek(scanner, p);
+				}
+				if (linebuf_append(buf, &c, 1) != 0)
+					return errno;
+				break;
+		}
+
+		if (p == len)
+			break;
+		q = scan_next(scanner);
+	}
+
+	*pp = len;
+	return 0;
+}
+
+/*
+ * decodes n bytes of multibyte text into wide characters stored in text, which must have room for n characters; invalid sequences are decoded as U+FFFD
+ *
+ * returns the number of characters decoded
+ */
+size_t decode_text(const char *s, size_t n, wchar_t *text)
+{
+	size_t i, len, r;
+	mbstate_t state;
+
+	memset(&state, 0, sizeof(state));
+	i = len = 0;
+	while (i < n)
+	{
+		if ((unsigned char) s[i] < 0x80)
+		{
+			text[len++] = (unsigned char) s[i++];
+			continue;
+		}
+
+		r = mbrtowc(text + len, s + i, n - i, &state);
+		if (r == (size_t) -1 || r == (size_t) -2)
+		{
+			text[len++] = 0xFFFD;
+			memset(&state, 0, sizeof(state));
+			r = 1;
+		}
+		else
+		{
+			len++;
+			if (r == 0)
+				r = 1;
+		}
+		i += r;
+	}
+	return len;
+}
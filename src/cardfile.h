@@ -0,0 +1,71 @@
+/*
+ * cardfile.h
+ *
+ * This file contains functions for mapping card files into memory and parsing them into cards
+ */
+
+#ifndef	CARDFILE_H
+#define	CARDFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+#include "card.h"
+
+// The contents of a card file held in memory
+typedef struct cardfile{
+	// Bytes of the file (not null-terminated)
+	const char *data;
+
+	// Number of bytes in data
+	size_t len;
+
+	// True if data is an mmap of the file, false if it was read into a malloc'd buffer
+	bool mapped;
+} cardfile_t;
+
+// Error recorded while loading a card file, so it can be printed later by the thread reading the deck
+typedef struct loaderror{
+	// errno value of the error
+	int code;
+
+	// Name of the function that failed, or NULL if the file has a card without back text
+	const char *func;
+} loaderror_t;
+
+// Maps a card file into memory; returns errno on error
+int map_card_file(const char *filename, cardfile_t *file, loaderror_t *error);
+
+// Maps a card file into memory unless it has to be read by the stream thread, in which case streamed is set; returns errno on error
+int map_unstreamed_card_file(const char *filename, cardfile_t *file, bool *streamed, loaderror_t *error);
+
+// Opens a card file, or standard input if the filename is "-"; returns -1 on error
+int open_card_file(const char *filename);
+
+// Unmaps or frees the contents of a card file
+void unmap_card_file(cardfile_t *file);
+
+// Parses the lines of a card file between two line starts and adds them to a batch; returns errno on error
+int parse_card_range(const cardfile_t *file, size_t start, size_t end, cardbatch_t *batch, loaderror_t *error);
+
+// Adds base plus the offset of every card in a card file to an array of offsets; returns errno on error
+int find_card_starts(const cardfile_t *file, uint64_t base, uint64_t **starts, int *len, int *size, loaderror_t *error);
+
+// Counts the cards of a card file; returns the number of cards, or -1 on error
+int count_file_cards(const cardfile_t *file, loaderror_t *error);
+
+// Returns the offset of the first line start at or after pos in a card file
+size_t find_line_start(const cardfile_t *file, size_t pos);
+
+// Returns the offset of the last line start in a card file that has only been partly read, or 0 if there are none
+size_t find_last_line_start(const cardfile_t *file);
+
+// Decodes multibyte text into wide characters; returns the number of characters decoded
+size_t decode_text(const char *s, size_t n, wchar_t *text);
+
+// Prints an error recorded while loading a card file
+void print_load_error(const char *filename, const loaderror_t *error);
+
+#endif
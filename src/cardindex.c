@@ -0,0 +1,438 @@
+/*
+ * cardindex.c
+ *
+ * This file contains functions for low-memory mode.
+ *
+ * In low-memory mode, reading a deck only finds the offset of the first byte of each card in its card files, so the deck takes 8 bytes per card plus its state bits, and card_list and card_text are left empty. The text of a card is read from its file when the card is shown and kept in a least recently used cache of at most CARDCACHE_SLOTS cards and CARDCACHE_MAX_BYTES bytes. Views, queues and state bitmaps only use card indexes, so shuffling, flipping and reviews work the same as they do in memory.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "bitmap.h"
+#include "card.h"
+#include "cardfile.h"
+#include "cardindex.h"
+#include "scan.h"
+
+// Number of entries in the hash table of cached cards, which is kept at most half full
+#define	CARDCACHE_TABLE_SIZE	(CARDCACHE_SLOTS * 2)
+
+// Text of a card kept in the card cache
+typedef struct cachedcard{
+	// Index of the card in card_list, or -1 if the slot is unused
+	int card;
+
+	// Offsets and lengths of the sides of the card in text
+	card_t sides;
+
+	// Text of both sides of the card, in characters of CARD_CHAR_SIZE
+	char *text;
+
+	// Number of bytes in text
+	size_t size;
+
+	// Slots of the cards used just before and just after this one, or -1 if there are none; unused slots are linked by next
+	int prev, next;
+} cachedcard_t;
+
+// Card files of the indexed deck
+static char **index_files;
+static int index_filecount;
+
+// Offset in the deck of the first byte of each card file, followed by the length of the deck
+static uint64_t *file_starts;
+
+// Offset in the deck of the first byte of each card in card_list
+static uint64_t *card_starts;
+
+// Cached cards and the slots of the most and least recently used ones
+static cachedcard_t cache_slots[CARDCACHE_SLOTS];
+static int cache_mru = -1, cache_lru = -1;
+
+// First unused slot, linked to the others by their next field
+static int cache_free = -1;
+
+// Slots of cached cards, found by hashing their indexes with linear probing, or -1 for unused entries
+static int cache_table[CARDCACHE_TABLE_SIZE];
+
+// Number of bytes of text of the cached cards
+static size_t cache_bytes;
+
+// Card file that's open for reading cards, and its index in index_files
+static int open_fd = -1;
+static int open_file = -1;
+
+// Empties the card cache
+static void reset_card_cache(void);
+
+// Returns the position in cache_table of a card, or of the unused entry it would be put in
+static size_t find_table_entry(int card);
+
+// Removes the least recently used card from the cache
+static void evict_card(void);
+
+// Moves a slot to the front of the list of recently used cards
+static void use_slot(int slot);
+
+// Reads the text of card i from its file into a slot; returns errno on error
+static int read_card(int i, cachedcard_t *slot);
+
+/*
+ * finds the start of every card in one or more files and replaces card_list with a card index of them; the files have to be regular files, since cards are read from them again as they're shown
+ *
+ * returns errno on error
+ */
+int index_deck(char **filenames, int filecount)
+{
+	uint64_t *new_starts = NULL, *new_file_starts, *new_states, *temp;
+	int len = 0, size = 0;
+	uint64_t base = 0;
+
+	select_scanner();
+
+	if ((new_file_starts = calloc(filecount + 1, sizeof(uint64_t))) == NULL)
+	{
+		perror("calloc");
+		return errno;
+	}
+
+	for (int i = 0; i < filecount; i++)
+	{
+		cardfile_t file;
+		loaderror_t error;
+
+		if (map_card_file(filenames[i], &file, &error) != 0)
+			goto index_deck_error;
+
+		// Error: cards can't be read again from pipes, compressed files and other files that can't be mapped
+		if (!file.mapped)
+		{
+			fprintf(stderr, "sortstudycli: \"%s\" can't be read in low-memory mode because it's compressed or isn't a regular file\n", filenames[i]);
+			unmap_card_file(&file);
+			free(new_starts);
+			free(new_file_starts);
+			return EINVAL;
+		}
+
+		new_file_starts[i] = base;
+		if (find_card_starts(&file, base, &new_starts, &len, &size, &error) != 0)
+		{
+			unmap_card_file(&file);
+			goto index_deck_error;
+		}
+		base += file.len;
+		unmap_card_file(&file);
+		continue;
+
+		index_deck_error:
+		print_load_error(filenames[i], &error);
+		free(new_starts);
+		free(new_file_starts);
+		return error.code;
+	}
+	new_file_starts[filecount] = base;
+
+	if (len == 0)
+	{
+		// Error: no cards were fully read
+		fprintf(stderr, "sortstudycli: no cards found in file(s)\n");
+		free(new_starts);
+		free(new_file_starts);
+		return EIO;
+	}
+
+	if ((new_states = calloc(BITMAP_WORDS(len) * CARDSTATE_COUNT, sizeof(uint64_t))) == NULL)
+	{
+		perror("calloc");
+		free(new_starts);
+		free(new_file_starts);
+		return errno;
+	}
+
+	// Give back the part of the array that wasn't used
+	if ((temp = reallocarray(new_starts, len, sizeof(uint64_t))) != NULL)
+		new_starts = temp;
+
+	free_card_list();
+	card_starts = new_starts;
+	file_starts = new_file_starts;
+	index_files = filenames;
+	index_filecount = filecount;
+	card_list_len = len;
+	for (int i = 0; i < CARDSTATE_COUNT; i++)
+		card_states[i] = new_states + BITMAP_WORDS(len) * i;
+	set_all_card_states(CARDSTATE_DO_REVIEW);
+	intern_saved_bytes = 0;
+	reset_card_cache();
+	return 0;
+}
+
+/*
+ * returns card i of an indexed deck and sets *text to the text its offsets refer to
+ *
+ * cards that aren't in the card cache are read from their file, evicting the least recently used cards if the cache is full. The text stays valid until another card is read, so both sides of a card can be used at once
+ *
+ * returns NULL if the card couldn't be read
+ */
+const card_t *get_indexed_card(int i, const char **text)
+{
+	size_t pos = find_table_entry(i);
+	int slot = cache_table[pos];
+	cachedcard_t card;
+
+	if (slot == -1)
+	{
+		if (read_card(i, &card) != 0)
+			return NULL;
+
+		while (cache_lru != -1 && (cache_free == -1 || cache_bytes + card.size > CARDCACHE_MAX_BYTES))
+			evict_card();
+
+		// Evicting cards can move the entry the card goes in
+		pos = find_table_entry(i);
+		slot = cache_free;
+		cache_free = cache_slots[slot].next;
+		cache_slots[slot] = card;
+		cache_slots[slot].prev = cache_slots[slot].next = -1;
+		cache_table[pos] = slot;
+		cache_bytes += card.size;
+	}
+
+	use_slot(slot);
+	*text = cache_slots[slot].text;
+	return &cache_slots[slot].sides;
+}
+
+/*
+ * frees the card index and the cached text of its cards
+ */
+void free_card_index(void)
+{
+	reset_card_cache();
+	if (open_fd != -1)
+		close(open_fd);
+	open_fd = open_file = -1;
+	free(card_starts);
+	free(file_starts);
+	card_starts = file_starts = NULL;
+	index_files = NULL;
+	index_filecount = 0;
+}
+
+/*
+ * returns the number of bytes used by the card index and cached card text
+ */
+size_t card_index_size(void)
+{
+	if (card_starts == NULL)
+		return 0;
+	return ((size_t) card_list_len + index_filecount + 1) * sizeof(uint64_t) + cache_bytes;
+}
+
+/*
+ * frees the text of every cached card and marks every slot as unused
+ */
+static void reset_card_cache(void)
+{
+	for (int i = 0; i < CARDCACHE_SLOTS; i++)
+	{
+		if (cache_slots[i].card != -1)
+			free(cache_slots[i].text);
+		cache_slots[i].card = -1;
+		cache_slots[i].text = NULL;
+		cache_slots[i].next = i + 1 < CARDCACHE_SLOTS ? i + 1 : -1;
+	}
+	for (int i = 0; i < CARDCACHE_TABLE_SIZE; i++)
+		cache_table[i] = -1;
+	cache_free = 0;
+	cache_mru = cache_lru = -1;
+	cache_bytes = 0;
+}
+
+/*
+ * returns the position in cache_table of the slot of a card, or of the unused entry the card's slot would be put in if it isn't cached
+ */
+static size_t find_table_entry(int card)
+{
+	size_t pos = (uint32_t) card * 2654435761U % CARDCACHE_TABLE_SIZE;
+
+	while (cache_table[pos] != -1 && cache_slots[cache_table[pos]].card != card)
+		pos = (pos + 1) % CARDCACHE_TABLE_SIZE;
+	return pos;
+}
+
+/*
+ * removes the least recently used card from the cache, freeing its text
+ *
+ * entries after the card's in cache_table are moved back to fill the gap it leaves, so lookups never stop early at the unused entry
+ */
+static void evict_card(void)
+{
+	int slot = cache_lru;
+	size_t pos = find_table_entry(cache_slots[slot].card), next, home;
+
+	for (next = (pos + 1) % CARDCACHE_TABLE_SIZE; cache_table[next] != -1; next = (next + 1) % CARDCACHE_TABLE_SIZE)
+	{
+		home = (uint32_t) cache_slots[cache_table[next]].card * 2654435761U % CARDCACHE_TABLE_SIZE;
+
+		// Move the entry back if its home isn't cyclically between the gap and it
+		if ((next > pos && (home <= pos || home > next)) || (next < pos && home <= pos && home > next))
+		{
+			cache_table[pos] = cache_table[next];
+			pos = next;
+		}
+	}
+	cache_table[pos] = -1;
+
+	cache_lru = cache_slots[slot].prev;
+	if (cache_lru == -1)
+		cache_mru = -1;
+	else
+		cache_slots[cache_lru].next = -1;
+
+	cache_bytes -= cache_slots[slot].size;
+	free(cache_slots[slot].text);
+	cache_slots[slot].text = NULL;
+	cache_slots[slot].card = -1;
+	cache_slots[slot].next = cache_free;
+	cache_free = slot;
+}
+
+/*
+ * moves a slot to the front of the list of recently used cards; the slot can already be in the list or be newly filled
+ */
+static void use_slot(int slot)
+{
+	cachedcard_t *card = &cache_slots[slot];
+
+	if (cache_mru == slot)
+		return;
+
+	// Unlink the slot if it's in the list
+	if (card->prev != -1)
+		cache_slots[card->prev].next = card->next;
+	if (card->next != -1)
+		cache_slots[card->next].prev = card->prev;
+	if (cache_lru == slot)
+		cache_lru = card->prev;
+
+	card->prev = -1;
+	card->next = cache_mru;
+	if (cache_mru != -1)
+		cache_slots[cache_mru].prev = slot;
+	cache_mru = slot;
+	if (cache_lru == -1)
+		cache_lru = slot;
+}
+
+/*
+ * reads the bytes of card i from its file and parses them into the text of a slot, the same way read_deck would have
+ *
+ * a card's bytes run from its start to the start of the next card, or to the end of its file if it's the last card in it
+ *
+ * returns errno on error
+ */
+static int read_card(int i, cachedcard_t *slot)
+{
+	cardfile_t file;
+	cardbatch_t batch = {0};
+	loaderror_t error;
+	uint64_t start = card_starts[i], end;
+	size_t len, done = 0;
+	ssize_t bytes_read;
+	char *data, *text;
+	int f = 0, error_code;
+
+	// Find the file the card is in
+	for (int lo = 0, hi = index_filecount - 1; lo <= hi;)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (file_starts[mid] <= start)
+		{
+			f = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	end = file_starts[f + 1];
+	if (i + 1 < card_list_len)
+		end = MIN(end, card_starts[i + 1]);
+	len = end - start;
+
+	if (open_file != f)
+	{
+		if (open_fd != -1)
+			close(open_fd);
+		open_file = -1;
+		if ((open_fd = open(index_files[f], O_RDONLY)) == -1)
+			return errno;
+		open_file = f;
+	}
+
+	if ((data = malloc(MAX(len, 1))) == NULL)
+		return errno;
+	while (done < len)
+	{
+		if ((bytes_read = pread(open_fd, data + done, len - done, start - file_starts[f] + done)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			error_code = errno;
+			free(data);
+			return error_code;
+		}
+
+		// Error: the file has been cut short since it was indexed
+		if (bytes_read == 0)
+		{
+			free(data);
+			return EIO;
+		}
+		done += bytes_read;
+	}
+
+	if ((text = reallocarray(NULL, len + 1, CARD_CHAR_SIZE)) == NULL)
+	{
+		error_code = errno;
+		free(data);
+		return error_code;
+	}
+	file.data = data;
+	file.len = len;
+	file.mapped = false;
+	batch.text = text;
+	batch.text_size = len + 1;
+	error_code = parse_card_range(&file, 0, len, &batch, &error);
+	free(data);
+
+	// Error: the file has changed since it was indexed
+	if (error_code == 0 && batch.len != 2)
+		error_code = EIO;
+	if (error_code != 0)
+	{
+		free_batch(&batch);
+		free(text);
+		return error_code;
+	}
+
+	slot->card = i;
+	slot->sides.front = batch.lines[0].off;
+	slot->sides.front_len = batch.lines[0].len;
+	slot->sides.back = batch.lines[1].off;
+	slot->sides.back_len = batch.lines[1].len;
+	slot->size = batch.text_len * CARD_CHAR_SIZE;
+	if ((slot->text = realloc(text, slot->size)) == NULL)
+		slot->text = text;
+	free_batch(&batch);
+	return 0;
+}
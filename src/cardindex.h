@@ -0,0 +1,30 @@
+/*
+ * cardindex.h
+ *
+ * This file contains functions for low-memory mode, which keeps the offsets of cards in their card files instead of their text
+ */
+
+#ifndef	CARDINDEX_H
+#define	CARDINDEX_H
+
+#include "card.h"
+
+// Largest number of cards whose text is kept in memory at once
+#define	CARDCACHE_SLOTS		1024
+
+// Largest number of bytes of card text kept in memory at once
+#define	CARDCACHE_MAX_BYTES	(8 << 20)
+
+// Finds the cards of a deck in one or more files without reading their text; returns errno on error
+int index_deck(char **filenames, int filecount);
+
+// Returns card i of an indexed deck and sets *text to the text it refers to, reading it from its file if it isn't cached; returns NULL on error
+const card_t *get_indexed_card(int i, const char **text);
+
+// Frees the card index and the cached text of its cards
+void free_card_index(void);
+
+// Returns the number of bytes used by the card index and cached card text
+size_t card_index_size(void);
+
+#endif
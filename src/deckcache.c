@@ -0,0 +1,344 @@
+/*
+ * deckcache.c
+ *
+ * This file contains functions for deck caches (.ssdeck files).
+ *
+ * A deck cache holds card_list and card_text exactly as they are in memory after a deck is read, along with the size, modification time and inode of every card file the deck was read from. When the same card files are read again and none of them have changed, the cache is mapped read-only and card_list and card_text point straight into the mapping, so nothing is parsed, decoded or copied. Caches are kept in $XDG_CACHE_HOME/sortstudycli (or ~/.cache/sortstudycli), named after a hash of the full paths of their card files, and are rebuilt whenever a card file changes.
+ */
+
+// asprintf is a GNU extension
+#define	_GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "bitmap.h"
+#include "card.h"
+#include "deckcache.h"
+
+// Mapping of the deck cache card_list was loaded from, or NULL if it wasn't loaded from one
+static void *cache_map;
+static size_t cache_map_len;
+
+/*
+ * finds the cache of a deck read from card files, recording the state of every card file so load_deck_cache can tell if the cache is out of date
+ *
+ * decks can't be cached if use_deck_cache is false, if a card file isn't a regular file (e.g. a pipe), or if there's no cache directory; their caches are left without a path, and nothing is loaded from or saved to them
+ */
+void init_deck_cache(deckcache_t *cache, char **filenames, int filecount)
+{
+	char *dir = NULL, *path;
+	struct stat st;
+	uint64_t key = 0;
+
+	memset(cache, 0, sizeof(deckcache_t));
+	if (!use_deck_cache || filecount == 0)
+		return;
+	if ((cache->sources = calloc(filecount, sizeof(deckcachesrc_t))) == NULL)
+		return;
+
+	for (int i = 0; i < filecount; i++)
+	{
+		deckcachesrc_t *src = &cache->sources[i];
+
+		if (stat(filenames[i], &st) == -1 || !S_ISREG(st.st_mode))
+			goto init_deck_cache_error;
+		if ((path = realpath(filenames[i], NULL)) == NULL)
+			goto init_deck_cache_error;
+
+		// The order of the card files changes the order of the cards, so it changes the key
+		key = hash_bytes(path, strlen(path) + 1) ^ (key * 0x9e3779b97f4a7c15ULL);
+		free(path);
+
+		src->dev = st.st_dev;
+		src->ino = st.st_ino;
+		src->size = st.st_size;
+		src->mtime_sec = st.st_mtim.tv_sec;
+		src->mtime_nsec = st.st_mtim.tv_nsec;
+	}
+
+	if ((dir = get_cache_dir()) == NULL)
+		goto init_deck_cache_error;
+
+	// Compact text and decks with duplicates removed are kept in their own caches, so switching between modes doesn't rebuild the cache every time
+	if (asprintf(&cache->path, "%s/%016" PRIx64 "%s%s.ssdeck", dir, key, compact_text ? "-c" : "",
+		dedupe_mode == DEDUPE_EXACT ? "-d" : dedupe_mode == DEDUPE_NORMALIZED ? "-n" : "") == -1)
+	{
+		cache->path = NULL;
+		goto init_deck_cache_error;
+	}
+	free(dir);
+
+	memcpy(cache->header.magic, DECKCACHE_MAGIC, sizeof(cache->header.magic));
+	cache->header.version = DECKCACHE_VERSION;
+	cache->header.char_size = CARD_CHAR_SIZE;
+	cache->header.key = key;
+	cache->header.filecount = filecount;
+	return;
+
+	init_deck_cache_error:
+	free(dir);
+	free_deck_cache(cache);
+}
+
+/*
+ * frees what init_deck_cache allocated; a deck loaded from the cache stays mapped until free_card_list is called
+ */
+void free_deck_cache(deckcache_t *cache)
+{
+	free(cache->path);
+	free(cache->sources);
+	cache->path = NULL;
+	cache->sources = NULL;
+}
+
+/*
+ * maps a deck cache and replaces card_list and card_text with the cards and text in it, if it was made from the card files as they are now
+ *
+ * only the header and the table of card files are read; the cards and their text are left for the kernel to page in as they're shown
+ *
+ * returns errno if the cache can't be loaded, or ESTALE if it's out of date, in which case the card files have to be read
+ */
+int load_deck_cache(deckcache_t *cache)
+{
+	const deckcacheheader_t *header;
+	uint64_t *new_states;
+	struct stat st;
+	char *map;
+	const uint32_t *file_cards;
+	int *new_file_cards;
+	uint64_t file_cards_sum = 0;
+	size_t sources_size, file_cards_size, cards_size;
+	int fd, error_code;
+
+	if (cache->path == NULL)
+		return ENOENT;
+
+	if ((fd = open(cache->path, O_RDONLY)) == -1)
+		return errno;
+	if (fstat(fd, &st) == -1)
+	{
+		error_code = errno;
+		close(fd);
+		return error_code;
+	}
+	if ((size_t) st.st_size < sizeof(deckcacheheader_t))
+	{
+		close(fd);
+		return ESTALE;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	error_code = errno;
+	close(fd);
+	if (map == MAP_FAILED)
+		return error_code;
+
+	header = (const deckcacheheader_t *) map;
+	sources_size = cache->header.filecount * sizeof(deckcachesrc_t);
+	file_cards_size = cache->header.filecount * sizeof(uint32_t);
+	cards_size = (size_t) header->card_count * sizeof(card_t);
+
+	// The cache has to be for the same card files in the same mode, and have exactly as many bytes as its header says
+	if (memcmp(header->magic, cache->header.magic, sizeof(header->magic)) != 0
+		|| header->version != cache->header.version
+		|| header->char_size != cache->header.char_size
+		|| header->key != cache->header.key
+		|| header->filecount != cache->header.filecount
+		|| header->card_count == 0 || header->card_count > INT_MAX
+		|| header->text_len > UINT32_MAX
+		|| (size_t) st.st_size != sizeof(deckcacheheader_t) + sources_size + file_cards_size + cards_size + header->text_len * header->char_size
+		|| memcmp(map + sizeof(deckcacheheader_t), cache->sources, sources_size) != 0)
+	{
+		munmap(map, st.st_size);
+		return ESTALE;
+	}
+
+	// The cards of the card files have to add up to the cards of the deck
+	file_cards = (const uint32_t *) (map + sizeof(deckcacheheader_t) + sources_size);
+	for (uint32_t i = 0; i < cache->header.filecount; i++)
+		file_cards_sum += file_cards[i];
+	if (file_cards_sum != header->card_count)
+	{
+		munmap(map, st.st_size);
+		return ESTALE;
+	}
+
+	if ((new_file_cards = calloc(cache->header.filecount, sizeof(int))) == NULL)
+	{
+		error_code = errno;
+		munmap(map, st.st_size);
+		return error_code;
+	}
+	if ((new_states = calloc(BITMAP_WORDS(header->card_count) * CARDSTATE_COUNT, sizeof(uint64_t))) == NULL)
+	{
+		error_code = errno;
+		free(new_file_cards);
+		munmap(map, st.st_size);
+		return error_code;
+	}
+	for (uint32_t i = 0; i < cache->header.filecount; i++)
+		new_file_cards[i] = file_cards[i];
+
+	free_card_list();
+	card_list = (card_t *) (map + sizeof(deckcacheheader_t) + sources_size + file_cards_size);
+	card_list_len = header->card_count;
+	for (int i = 0; i < CARDSTATE_COUNT; i++)
+		card_states[i] = new_states + BITMAP_WORDS(card_list_len) * i;
+	set_all_card_states(CARDSTATE_DO_REVIEW);
+	card_text = map + sizeof(deckcacheheader_t) + sources_size + file_cards_size + cards_size;
+	card_text_len = header->text_len;
+	intern_saved_bytes = header->saved_bytes;
+	deduped_cards = header->deduped_cards;
+	deck_file_cards = new_file_cards;
+	cache_map = map;
+	cache_map_len = st.st_size;
+	return 0;
+}
+
+/*
+ * writes card_list and card_text to a deck cache, replacing the old cache file if there is one
+ *
+ * the cache is written to a temporary file that's renamed over the old one, so other instances of the program never map a cache that's only partly written. Caches are only an optimization, so errors aren't reported
+ */
+void save_deck_cache(deckcache_t *cache)
+{
+	uint32_t *file_cards;
+	char *temp_path;
+	bool written;
+	int fd;
+
+	if (cache->path == NULL || deck_file_cards == NULL)
+		return;
+	if ((file_cards = calloc(cache->header.filecount, sizeof(uint32_t))) == NULL)
+		return;
+	for (uint32_t i = 0; i < cache->header.filecount; i++)
+		file_cards[i] = deck_file_cards[i];
+
+	cache->header.card_count = card_list_len;
+	cache->header.text_len = card_text_len;
+	cache->header.saved_bytes = intern_saved_bytes;
+	cache->header.deduped_cards = deduped_cards;
+
+	make_parent_dirs(cache->path);
+	if (asprintf(&temp_path, "%s.%ld.tmp", cache->path, (long) getpid()) == -1)
+	{
+		free(file_cards);
+		return;
+	}
+	if ((fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1)
+	{
+		free(file_cards);
+		free(temp_path);
+		return;
+	}
+
+	written = write_all(fd, &cache->header, sizeof(deckcacheheader_t)) == 0
+		&& write_all(fd, cache->sources, cache->header.filecount * sizeof(deckcachesrc_t)) == 0
+		&& write_all(fd, file_cards, cache->header.filecount * sizeof(uint32_t)) == 0
+		&& write_all(fd, card_list, (size_t) card_list_len * sizeof(card_t)) == 0
+		&& write_all(fd, card_text, card_text_len * CARD_CHAR_SIZE) == 0;
+	if (close(fd) != 0)
+		written = false;
+	if (!written || rename(temp_path, cache->path) != 0)
+		unlink(temp_path);
+	free(file_cards);
+	free(temp_path);
+}
+
+/*
+ * unmaps the deck cache card_list and card_text were loaded from
+ *
+ * returns false if they weren't loaded from a deck cache, so they have to be freed instead
+ */
+bool unmap_deck_cache(void)
+{
+	if (cache_map == NULL)
+		return false;
+	munmap(cache_map, cache_map_len);
+	cache_map = NULL;
+	cache_map_len = 0;
+	return true;
+}
+
+/*
+ * returns true if card_list was loaded from a deck cache
+ */
+bool deck_cache_loaded(void)
+{
+	return cache_map != NULL;
+}
+
+/*
+ * returns the directory deck caches and library indexes are kept in, $XDG_CACHE_HOME/sortstudycli or ~/.cache/sortstudycli, as a malloc'd string
+ *
+ * returns NULL if neither $XDG_CACHE_HOME or $HOME are set, or if memory can't be allocated
+ */
+char *get_cache_dir(void)
+{
+	const char *base;
+	char *dir;
+	int r;
+
+	// Relative paths in $XDG_CACHE_HOME are invalid and should be ignored
+	if ((base = getenv("XDG_CACHE_HOME")) != NULL && base[0] == '/')
+		r = asprintf(&dir, "%s/" DECKCACHE_DIR, base);
+	else if ((base = getenv("HOME")) != NULL && base[0] != '\0')
+		r = asprintf(&dir, "%s/.cache/" DECKCACHE_DIR, base);
+	else
+		return NULL;
+	return r == -1 ? NULL : dir;
+}
+
+/*
+ * creates every directory leading up to the file at path that doesn't exist yet, like mkdir -p; errors are left for opening the file to find
+ */
+void make_parent_dirs(const char *path)
+{
+	char *dir, *p;
+
+	if ((dir = strdup(path)) == NULL)
+		return;
+	for (p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+	{
+		*p = '\0';
+		mkdir(dir, 0700);
+		*p = '/';
+	}
+	free(dir);
+}
+
+/*
+ * writes n bytes from buf to fd, retrying writes that are interrupted or only partly done
+ *
+ * returns errno on error
+ */
+int write_all(int fd, const void *buf, size_t n)
+{
+	const char *p = buf;
+	ssize_t written;
+
+	while (n > 0)
+	{
+		if ((written = write(fd, p, n)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += written;
+		n -= written;
+	}
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * deckcache.h
+ *
+ * This file contains the types and functions for deck caches, binary copies of read decks that are mapped instead of parsing card files again
+ */
+
+#ifndef	DECKCACHE_H
+#define	DECKCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Directory deck caches and library indexes are kept in, under the cache directory of the user
+#define	DECKCACHE_DIR		"sortstudycli"
+
+// Bytes at the start of every deck cache
+#define	DECKCACHE_MAGIC		"SSDECK\0"
+
+// Version of the deck cache format, changed whenever the layout of the file or of card_t changes
+#define	DECKCACHE_VERSION	3
+
+// Header at the start of a deck cache; it's followed by a deckcachesrc_t for each card file, the number of cards of each card file as a uint32_t, the cards of card_list, and card_text
+typedef struct deckcacheheader{
+	char magic[8];
+	uint32_t version;
+
+	// CARD_CHAR_SIZE of the text
+	uint32_t char_size;
+
+	// Hash of the full paths of the card files, which the name of the cache is made from
+	uint64_t key;
+
+	// Number of card files and cards
+	uint32_t filecount;
+	uint32_t card_count;
+
+	// Number of characters in card_text
+	uint64_t text_len;
+
+	// intern_saved_bytes of the deck
+	uint64_t saved_bytes;
+
+	// deduped_cards of the deck
+	uint64_t deduped_cards;
+} deckcacheheader_t;
+
+// Card file a deck cache was made from, as it was when the deck was read
+typedef struct deckcachesrc{
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+} deckcachesrc_t;
+
+// Deck cache of the card files being read
+typedef struct deckcache{
+	// Path of the cache file, or NULL if the deck can't be cached
+	char *path;
+
+	// Header and card files the cache file has to match
+	deckcacheheader_t header;
+	deckcachesrc_t *sources;
+} deckcache_t;
+
+// Finds the cache of a deck of card files; the cache is left without a path if it can't be used
+void init_deck_cache(deckcache_t *cache, char **filenames, int filecount);
+
+// Frees what init_deck_cache allocated
+void free_deck_cache(deckcache_t *cache);
+
+// Replaces card_list with the cards of a deck cache if it's up to date; returns 0 if it was loaded
+int load_deck_cache(deckcache_t *cache);
+
+// Writes card_list to a deck cache
+void save_deck_cache(deckcache_t *cache);
+
+// Unmaps the deck cache card_list was loaded from; returns false if card_list wasn't loaded from one
+bool unmap_deck_cache(void);
+
+// Returns true if card_list was loaded from a deck cache
+bool deck_cache_loaded(void);
+
+// Returns the directory deck caches are kept in as a malloc'd string, or NULL if there isn't one
+char *get_cache_dir(void);
+
+// Creates every directory leading up to a file
+void make_parent_dirs(const char *path);
+
+// Writes n bytes to fd; returns errno on error
+int write_all(int fd, const void *buf, size_t n);
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * deckstream.c
+ *
+ * This file contains functions for progressive loading.
+ *
+ * A stream thread reads the card files of a deck one after another in blocks of STREAM_READ_SIZE bytes. Whenever a block ends, the lines read up to the last line start are parsed into a batch and handed over to the review thread, which adds them to card_list with append_card_batch the next time it polls. Only the review thread ever touches card_list, so nothing else in review mode needs locking. Review mode starts as soon as the first card has been read, and standard input and pipes can be studied while whatever is writing to them is still running.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "card.h"
+#include "cardfile.h"
+#include "decompress.h"
+#include "deckstream.h"
+#include "scan.h"
+
+// Batch of lines read by the stream thread
+typedef struct streambatch{
+	cardbatch_t batch;
+	struct streambatch *next;
+} streambatch_t;
+
+// Card files being read
+static char **stream_files;
+static int stream_filecount;
+
+static pthread_t stream_thread;
+
+// Lock and condition for everything shared with the stream thread
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+
+// Batches that haven't been added to card_list yet, oldest first
+static streambatch_t *stream_head, *stream_tail;
+
+// True once the stream thread has read every file or stopped on an error
+static bool stream_done;
+
+// Error that stopped the stream thread and the file it happened in
+static loaderror_t stream_error;
+static const char *stream_error_file;
+
+// Set by the review thread to stop the stream thread when card_list can't hold any more cards
+static atomic_bool stream_cancelled;
+
+// True from when the stream thread is started until it has been joined
+static bool stream_active;
+
+// Reads the card files of the deck; used as the stream thread
+static void *stream_worker(void *arg);
+
+// Reads one card file, handing over its lines as they're read; returns errno on error
+static int stream_file(const char *filename, loaderror_t *error);
+
+// Parses the first len bytes of a card file into a batch and hands it over; returns errno on error
+static int hand_over_range(const cardfile_t *file, size_t len, int *lines, loaderror_t *error);
+
+// Prints the error that stopped the stream thread; returns its errno value
+static int print_stream_error(void);
+
+/*
+ * returns true if one of the files of a deck is "-" (standard input); read_deck would have to wait for its end before parsing it, while the stream thread parses it as it's read
+ *
+ * other files that aren't regular files (like pipes) and compressed files also have to be streamed, but they're found by read_deck as it maps them, so the files of a deck aren't opened an extra time here
+ */
+bool needs_deck_stream(char **filenames, int filecount)
+{
+	for (int i = 0; i < filecount; i++)
+	{
+		if (strcmp(filenames[i], "-") == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * replaces card_list with the first cards of a deck read by a stream thread, which keeps reading the rest of the deck in the background
+ *
+ * returns errno if the deck couldn't be read, or if it was read to the end before its first card was shown and had errors that read_deck would have stopped on
+ */
+int start_deck_stream(char **filenames, int filecount)
+{
+	int error_code;
+
+	select_scanner();
+	free_card_list();
+	stream_files = filenames;
+	stream_filecount = filecount;
+	atomic_init(&stream_cancelled, false);
+
+	if ((error_code = pthread_create(&stream_thread, NULL, stream_worker, NULL)) != 0)
+	{
+		fprintf(stderr, "pthread_create: %s\n", strerror(error_code));
+		return error_code;
+	}
+	stream_active = true;
+
+	// Wait for the first card, since review mode needs one to show
+	while (card_list_len == 0 && stream_active)
+	{
+		pthread_mutex_lock(&stream_lock);
+		while (stream_head == NULL && !stream_done)
+			pthread_cond_wait(&stream_cond, &stream_lock);
+		pthread_mutex_unlock(&stream_lock);
+		absorb_streamed_cards();
+	}
+
+	if (!stream_active && stream_error.code != 0)
+		return print_stream_error();
+	if (card_list_len == 0)
+	{
+		// Error: no cards were fully read
+		fprintf(stderr, "sortstudycli: no cards found in file(s)\n");
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * returns true if the deck is still being read, so absorb_streamed_cards should be called now and then
+ */
+bool deck_stream_active(void)
+{
+	return stream_active;
+}
+
+/*
+ * adds the cards read by the stream thread since the last call to the end of card_list, and joins the stream thread once it has finished
+ *
+ * returns the number of cards added, or -1 if reading stopped on an error; cards read before the error are still added
+ */
+int absorb_streamed_cards(void)
+{
+	streambatch_t *sb, *next;
+	int before = card_list_len, error_code = 0;
+	bool done;
+
+	if (!stream_active)
+		return 0;
+
+	pthread_mutex_lock(&stream_lock);
+	sb = stream_head;
+	stream_head = stream_tail = NULL;
+	done = stream_done;
+	pthread_mutex_unlock(&stream_lock);
+
+	for (; sb != NULL; sb = next)
+	{
+		next = sb->next;
+		if (error_code == 0 && (error_code = append_card_batch(&sb->batch)) != 0)
+		{
+			// Stop reading, since there's no room for the rest of the deck
+			atomic_store(&stream_cancelled, true);
+			pthread_mutex_lock(&stream_lock);
+			stream_error.code = error_code;
+			stream_error.func = "append_card_batch";
+			stream_error_file = NULL;
+			pthread_mutex_unlock(&stream_lock);
+		}
+		free_batch(&sb->batch);
+		free(sb->batch.text);
+		free(sb);
+	}
+
+	if (error_code != 0 && !done)
+	{
+		// Wait for the stream thread to stop, throwing away what it reads until it does
+		pthread_join(stream_thread, NULL);
+		for (sb = stream_head; sb != NULL; sb = next)
+		{
+			next = sb->next;
+			free_batch(&sb->batch);
+			free(sb->batch.text);
+			free(sb);
+		}
+		stream_head = stream_tail = NULL;
+		stream_active = false;
+	}
+	else if (done)
+	{
+		pthread_join(stream_thread, NULL);
+		stream_active = false;
+	}
+
+	return !stream_active && stream_error.code != 0 ? -1 : card_list_len - before;
+}
+
+/*
+ * waits until the stream thread has read the whole deck and adds the rest of its cards to card_list
+ *
+ * returns errno if reading stopped on an error, after printing it
+ */
+int finish_deck_stream(void)
+{
+	while (stream_active)
+	{
+		pthread_mutex_lock(&stream_lock);
+		while (stream_head == NULL && !stream_done)
+			pthread_cond_wait(&stream_cond, &stream_lock);
+		pthread_mutex_unlock(&stream_lock);
+		absorb_streamed_cards();
+	}
+
+	if (stream_error.code != 0)
+		return print_stream_error();
+	return 0;
+}
+
+/*
+ * reads the card files of the deck in order until they've all been read or one has an error
+ */
+static void *stream_worker(void *arg)
+{
+	loaderror_t error = {0, NULL};
+	int i;
+
+	(void) arg;
+	for (i = 0; i < stream_filecount; i++)
+		if (stream_file(stream_files[i], &error) != 0 || atomic_load(&stream_cancelled))
+			break;
+
+	pthread_mutex_lock(&stream_lock);
+	if (error.code != 0 && stream_error.code == 0)
+	{
+		stream_error = error;
+		stream_error_file = stream_files[i];
+	}
+	stream_done = true;
+	pthread_cond_signal(&stream_cond);
+	pthread_mutex_unlock(&stream_lock);
+	return NULL;
+}
+
+/*
+ * reads a card file in blocks, decompressing it if it's compressed, and hands over the lines before the last line start of what has been read after each block
+ *
+ * returns errno on error
+ */
+static int stream_file(const char *filename, loaderror_t *error)
+{
+	cardfile_t file = {NULL, 0, false};
+	cardreader_t reader;
+	char *buf = NULL, *temp;
+	size_t len = 0, size = 0, end;
+	ssize_t bytes_read;
+	bool eof = false;
+	int fd, lines = 0;
+
+	if ((fd = open_card_file(filename)) == -1)
+	{
+		error->code = errno;
+		error->func = "open";
+		return error->code;
+	}
+	if (open_card_reader(&reader, fd, error) != 0)
+	{
+		close_card_reader(&reader);
+		close(fd);
+		return error->code;
+	}
+
+	while (!eof && !atomic_load(&stream_cancelled))
+	{
+		if (len + STREAM_READ_SIZE > size)
+		{
+			size = MAX(size * 2, len + STREAM_READ_SIZE);
+			if ((temp = realloc(buf, size)) == NULL)
+			{
+				error->code = errno;
+				error->func = "realloc";
+				break;
+			}
+			buf = temp;
+		}
+
+		if ((bytes_read = read_card_reader(&reader, buf + len, size - len, error)) == -1)
+			break;
+		eof = bytes_read == 0;
+		len += bytes_read;
+
+		// Lines can only be parsed once the line start after them has been read, unless the file has ended
+		file.data = buf;
+		file.len = len;
+		if ((end = eof ? len : find_last_line_start(&file)) == 0)
+			continue;
+		if (hand_over_range(&file, end, &lines, error) != 0)
+			break;
+		memmove(buf, buf + end, len - end);
+		len -= end;
+	}
+
+	// Error: a card's front has been read, but not its back
+	if (error->code == 0 && eof && lines % 2 != 0)
+	{
+		error->code = EIO;
+		error->func = NULL;
+	}
+
+	close_card_reader(&reader);
+	close(fd);
+	free(buf);
+	return error->code;
+}
+
+/*
+ * parses the first len bytes of a card file, which have to end at a line start, into a batch and adds it to the batches waiting to be added to card_list
+ *
+ * returns errno on error
+ */
+static int hand_over_range(const cardfile_t *file, size_t len, int *lines, loaderror_t *error)
+{
+	streambatch_t *sb;
+
+	if ((sb = calloc(1, sizeof(streambatch_t))) == NULL)
+	{
+		error->code = errno;
+		error->func = "calloc";
+		return error->code;
+	}
+	if ((sb->batch.text = reallocarray(NULL, len + 1, CARD_CHAR_SIZE)) == NULL)
+	{
+		error->code = errno;
+		error->func = "reallocarray";
+		free(sb);
+		return error->code;
+	}
+	sb->batch.text_size = len + 1;
+
+	if (parse_card_range(file, 0, len, &sb->batch, error) != 0 || sb->batch.len == 0)
+	{
+		free_batch(&sb->batch);
+		free(sb->batch.text);
+		free(sb);
+		return error->code;
+	}
+	*lines += sb->batch.len;
+
+	pthread_mutex_lock(&stream_lock);
+	if (stream_tail == NULL)
+		stream_head = sb;
+	else
+		stream_tail->next = sb;
+	stream_tail = sb;
+	pthread_cond_signal(&stream_cond);
+	pthread_mutex_unlock(&stream_lock);
+	return 0;
+}
+
+/*
+ * prints the error that stopped the stream thread like read_deck would have printed it
+ *
+ * returns its errno value
+ */
+static int print_stream_error(void)
+{
+	if (stream_error_file == NULL)
+		fprintf(stderr, "%s: %s\n", stream_error.func, strerror(stream_error.code));
+	else
+		print_load_error(stream_error_file, &stream_error);
+	return stream_error.code;
+}
@@ -0,0 +1,30 @@
+/*
+ * deckstream.h
+ *
+ * This file contains functions for progressive loading, which reads a deck on a background thread while it's being reviewed
+ */
+
+#ifndef	DECKSTREAM_H
+#define	DECKSTREAM_H
+
+#include <stdbool.h>
+
+// Number of bytes read from a card file at a time
+#define	STREAM_READ_SIZE	(1 << 20)
+
+// Returns true if a deck has to be read progressively because one of its files is standard input
+bool needs_deck_stream(char **filenames, int filecount);
+
+// Starts reading a deck on a background thread and waits until its first card has been read; returns errno on error
+int start_deck_stream(char **filenames, int filecount);
+
+// Returns true if the deck is still being read
+bool deck_stream_active(void);
+
+// Adds the cards read since the last call to card_list; returns the number added, or -1 if reading stopped on an error
+int absorb_streamed_cards(void);
+
+// Waits until the whole deck has been read and added to card_list; returns errno on error
+int finish_deck_stream(void);
+
+#endif
@@ -0,0 +1,415 @@
+/*
+ * deckwatch.c
+ *
+ * This file contains functions for reloading the card files of a deck while it's being reviewed.
+ *
+ * The directory of every card file is watched with inotify for files that are written and closed or renamed into place, which catches both editors that write files in place and ones that write a new file and rename it over the old one. When a card file changes, only that file is read again, and its new cards are matched against the cards it had before by their text:
+ *
+ *	- a new card with the same text as an old card takes its place in card_list, keeping its state (including deleted) and its position in every view and queue
+ *	- a new card without a match takes the place of the next old card without a match since the last matched card, if there is one, as an edited card; its text is replaced and it's marked for review
+ *	- any other new card is added to the end of card_list, and any other old card is deleted
+ *
+ * Matching uses a hash table of the old cards of the file, so a reload takes time proportional to the size of the changed file rather than the deck.
+ */
+
+// inotify_init1 flags need _GNU_SOURCE with older C libraries
+#define	_GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "util.h"
+#include "card.h"
+#include "cardfile.h"
+#include "deckwatch.h"
+
+// Size of the buffer inotify events are read into
+#define	WATCH_EVENT_BUF_SIZE	4096
+
+// Card file of a deck being watched
+typedef struct watchedfile{
+	const char *filename;
+
+	// Watch descriptor of the directory the file is in, and the name of the file in it
+	int wd;
+	char *name;
+
+	// Indexes in card_list of the cards of the file, in the order they're in the file
+	int *cards;
+	int len;
+
+	// True if the file has changed since it was last read
+	bool changed;
+} watchedfile_t;
+
+// inotify instance the directories of the card files are watched with, or -1 if the deck isn't being watched
+static int watch_fd = -1;
+
+static watchedfile_t *watched;
+static int watched_count;
+
+// Cards deleted by the last reload
+static int *deleted;
+static int deleted_size;
+
+// Reads the events inotify has queued and marks the files they're for as changed
+static void read_watch_events(void);
+
+// Reads a changed card file again and matches its new cards against its old ones; returns errno on error
+static int reload_file(watchedfile_t *wf, deckreload_t *reload);
+
+// Returns a hash of the text of two lines of a batch, or of a card if batch is NULL
+static uint64_t card_hash(const cardbatch_t *batch, int line, int i);
+
+/*
+ * starts watching the card files of a deck that was just read by read_deck; decks read another way aren't watched, since which file each card came from isn't known. Decks with duplicate cards removed aren't watched either, since a card taken out of one file may be a duplicate of a card still in another
+ *
+ * returns errno on error
+ */
+int watch_deck(char **filenames, int filecount)
+{
+	int first = 0, error_code;
+
+	stop_watching_deck();
+	if (deck_file_cards == NULL || dedupe_mode != DEDUPE_NONE)
+		return 0;
+	if ((watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+		return errno;
+	if ((watched = calloc(filecount, sizeof(watchedfile_t))) == NULL)
+		goto watch_deck_error;
+	watched_count = filecount;
+
+	for (int i = 0; i < filecount; i++)
+	{
+		watchedfile_t *wf = &watched[i];
+		char *path, *dir_copy;
+
+		wf->filename = filenames[i];
+		wf->wd = -1;
+		wf->len = deck_file_cards[i];
+		if ((wf->cards = reallocarray(NULL, MAX(wf->len, 1), sizeof(int))) == NULL)
+			goto watch_deck_error;
+		for (int j = 0; j < wf->len; j++)
+			wf->cards[j] = first + j;
+		first += wf->len;
+
+		// Links are resolved so the directory the file is really in is watched
+		if ((path = realpath(filenames[i], NULL)) == NULL)
+			continue;
+		if ((dir_copy = strdup(path)) == NULL || (wf->name = strdup(basename(path))) == NULL)
+		{
+			free(dir_copy);
+			free(path);
+			goto watch_deck_error;
+		}
+		wf->wd = inotify_add_watch(watch_fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO);
+		free(dir_copy);
+		free(path);
+	}
+	return 0;
+
+	watch_deck_error:
+	error_code = errno;
+	stop_watching_deck();
+	return error_code;
+}
+
+/*
+ * returns true if the card files of the deck are being watched, so reload_changed_files should be called now and then
+ */
+bool deck_watched(void)
+{
+	return watch_fd != -1;
+}
+
+/*
+ * reloads every card file that has changed since the last call, adding, changing and deleting cards in card_list; cards that are added are added to the end of card_list, in the order of the files
+ *
+ * files that can't be read or parsed keep their old cards, and the first of them is recorded in reload
+ *
+ * returns the number of files reloaded, or -1 if memory couldn't be allocated, in which case watching stops
+ */
+int reload_changed_files(deckreload_t *reload)
+{
+	memset(reload, 0, sizeof(deckreload_t));
+	reload->first_added = card_list_len;
+	reload->deleted = deleted;
+	if (watch_fd == -1)
+		return 0;
+
+	read_watch_events();
+	for (int i = 0; i < watched_count; i++)
+	{
+		int error_code;
+
+		if (!watched[i].changed)
+			continue;
+		watched[i].changed = false;
+
+		if ((error_code = reload_file(&watched[i], reload)) == ENOMEM)
+		{
+			stop_watching_deck();
+			return -1;
+		}
+		if (error_code != 0)
+		{
+			if (reload->error_file == NULL)
+				reload->error_file = watched[i].filename;
+			continue;
+		}
+		reload->files++;
+	}
+	reload->deleted = deleted;
+	return reload->files;
+}
+
+/*
+ * stops watching the card files of the deck and frees what watch_deck allocated
+ */
+void stop_watching_deck(void)
+{
+	if (watch_fd != -1)
+		close(watch_fd);
+	watch_fd = -1;
+	for (int i = 0; i < watched_count; i++)
+	{
+		free(watched[i].name);
+		free(watched[i].cards);
+	}
+	free(watched);
+	watched = NULL;
+	watched_count = 0;
+	free(deleted);
+	deleted = NULL;
+	deleted_size = 0;
+}
+
+/*
+ * reads every event queued on watch_fd without waiting and marks the card files they name as changed; if events were lost, every card file is marked
+ */
+static void read_watch_events(void)
+{
+	char buf[WATCH_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(watch_fd, buf, sizeof(buf))) > 0)
+	{
+		for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len)
+		{
+			const struct inotify_event *event = (const struct inotify_event *) p;
+
+			for (int i = 0; i < watched_count; i++)
+			{
+				if ((event->mask & IN_Q_OVERFLOW) || (event->len != 0 && event->wd == watched[i].wd && strcmp(event->name, watched[i].name) == 0))
+					watched[i].changed = true;
+			}
+		}
+	}
+}
+
+/*
+ * reads a card file again and matches its new cards against its old cards as described at the top of this file; the cards it deletes are added to the end of deleted
+ *
+ * nothing in card_list is changed unless the whole file can be read and every change can be made; reloading a file that would leave the deck without cards is an error
+ *
+ * returns ENOMEM if memory can't be allocated, or another errno value if the file can't be read
+ */
+static int reload_file(watchedfile_t *wf, deckreload_t *reload)
+{
+	cardfile_t file = {NULL, 0, false};
+	cardbatch_t batch = {NULL, 0, 0, NULL, 0, 0};
+	loaderror_t error = {0, NULL};
+	int *table = NULL, *new_cards = NULL, *match = NULL;
+	uint64_t *old_hashes = NULL;
+	bool *matched = NULL;
+	size_t table_mask, text_len = 0;
+	int new_len, added = 0, deleting = 0, k, error_code = 0;
+
+	if (map_card_file(wf->filename, &file, &error) != 0)
+		return error.code == ENOMEM ? EIO : error.code;
+	if ((batch.text = reallocarray(NULL, file.len + 1, CARD_CHAR_SIZE)) == NULL)
+	{
+		unmap_card_file(&file);
+		return ENOMEM;
+	}
+	batch.text_size = file.len + 1;
+	if (parse_card_range(&file, 0, file.len, &batch, &error) != 0 || batch.len % 2 != 0)
+	{
+		error_code = error.code == 0 || error.code == ENOMEM ? EIO : error.code;
+		goto reload_file_end;
+	}
+	unmap_card_file(&file);
+	new_len = batch.len / 2;
+
+	// Hash table of the old cards of the file, which is at most half full
+	for (table_mask = 15; table_mask < (size_t) wf->len * 2; table_mask = table_mask * 2 + 1);
+	if ((table = malloc((table_mask + 1) * sizeof(int))) == NULL
+		|| (old_hashes = reallocarray(NULL, MAX(wf->len, 1), sizeof(uint64_t))) == NULL
+		|| (matched = calloc(MAX(wf->len, 1), sizeof(bool))) == NULL
+		|| (match = reallocarray(NULL, MAX(new_len, 1), sizeof(int))) == NULL
+		|| (new_cards = reallocarray(NULL, MAX(new_len, 1), sizeof(int))) == NULL)
+	{
+		error_code = ENOMEM;
+		goto reload_file_end;
+	}
+	memset(table, -1, (table_mask + 1) * sizeof(int));
+	for (int j = 0; j < wf->len; j++)
+	{
+		size_t slot;
+
+		old_hashes[j] = card_hash(NULL, 0, wf->cards[j]);
+		for (slot = old_hashes[j] & table_mask; table[slot] != -1; slot = (slot + 1) & table_mask);
+		table[slot] = j;
+	}
+
+	// Match every new card with an old card that has the same text
+	for (int j = 0; j < new_len; j++)
+	{
+		uint64_t hash = card_hash(&batch, j * 2, 0);
+
+		match[j] = -1;
+		for (size_t slot = hash & table_mask; table[slot] != -1; slot = (slot + 1) & table_mask)
+		{
+			int old = table[slot];
+
+			if (!matched[old] && old_hashes[old] == hash && card_matches_batch(wf->cards[old], &batch, j * 2))
+			{
+				match[j] = old;
+				matched[old] = true;
+				break;
+			}
+		}
+	}
+
+	// New cards without a match take the place of the next old card without a match after the last matched card, if it hasn't been deleted
+	k = 0;
+	for (int j = 0; j < new_len; j++)
+	{
+		if (match[j] != -1)
+		{
+			k = MAX(k, match[j] + 1);
+			continue;
+		}
+		while (k < wf->len && !matched[k] && get_card_state(wf->cards[k]) == CARDSTATE_TO_DELETE)
+			k++;
+		if (k < wf->len && !matched[k])
+		{
+			match[j] = k;
+			matched[k] = true;
+			k++;
+		}
+		else
+			added++;
+		text_len += batch.lines[j * 2].len + batch.lines[j * 2 + 1].len + 2;
+	}
+	for (int j = 0; j < wf->len; j++)
+		if (!matched[j] && get_card_state(wf->cards[j]) != CARDSTATE_TO_DELETE)
+			deleting++;
+
+	// Error: the reload would delete every card left in the deck
+	if (card_list_len - deleted_cards - deleting + added <= 0)
+	{
+		error_code = EIO;
+		goto reload_file_end;
+	}
+
+	// Make room for every change first, so nothing can fail once card_list starts changing
+	if (reload->deleted_len + deleting > deleted_size)
+	{
+		int size = MAX(reload->deleted_len + deleting, deleted_size * 2);
+		int *temp;
+
+		if ((temp = reallocarray(deleted, size, sizeof(int))) == NULL)
+		{
+			error_code = ENOMEM;
+			goto reload_file_end;
+		}
+		deleted = temp;
+		deleted_size = size;
+	}
+	if (own_card_list() != 0 || reserve_cards(added, text_len) != 0)
+	{
+		error_code = ENOMEM;
+		goto reload_file_end;
+	}
+
+	for (int j = 0; j < new_len; j++)
+	{
+		if (match[j] == -1)
+		{
+			add_card(&batch, j * 2);
+			new_cards[j] = card_list_len - 1;
+			reload->added++;
+			continue;
+		}
+
+		new_cards[j] = wf->cards[match[j]];
+		if (!card_matches_batch(new_cards[j], &batch, j * 2))
+		{
+			// The card was edited, so it's shown again in the next review
+			replace_card_text(new_cards[j], &batch, j * 2);
+			if (get_card_state(new_cards[j]) == CARDSTATE_DONT_REVIEW)
+				set_card_state(new_cards[j], CARDSTATE_DO_REVIEW);
+			reload->changed++;
+		}
+	}
+	for (int j = 0; j < wf->len; j++)
+	{
+		if (!matched[j] && get_card_state(wf->cards[j]) != CARDSTATE_TO_DELETE)
+		{
+			delete_card(wf->cards[j]);
+			deleted[reload->deleted_len++] = wf->cards[j];
+		}
+	}
+
+	free(wf->cards);
+	wf->cards = new_cards;
+	wf->len = new_len;
+	new_cards = NULL;
+
+	reload_file_end:
+	unmap_card_file(&file);
+	free_batch(&batch);
+	free(batch.text);
+	free(table);
+	free(old_hashes);
+	free(matched);
+	free(match);
+	free(new_cards);
+	return error_code;
+}
+
+/*
+ * returns a hash of the text of lines line and line + 1 of a batch, or of the text of card i in card_list if batch is NULL; both give the same hash for the same text
+ */
+static uint64_t card_hash(const cardbatch_t *batch, int line, int i)
+{
+	const char *front, *back;
+	size_t front_len, back_len;
+
+	if (batch == NULL)
+	{
+		front = card_text + (size_t) card_list[i].front * CARD_CHAR_SIZE;
+		front_len = card_list[i].front_len;
+		back = card_text + (size_t) card_list[i].back * CARD_CHAR_SIZE;
+		back_len = card_list[i].back_len;
+	}
+	else
+	{
+		front = batch->text + (size_t) batch->lines[line].off * CARD_CHAR_SIZE;
+		front_len = batch->lines[line].len;
+		back = batch->text + (size_t) batch->lines[line + 1].off * CARD_CHAR_SIZE;
+		back_len = batch->lines[line + 1].len;
+	}
+	return hash_bytes(front, front_len * CARD_CHAR_SIZE) * 31 + hash_bytes(back, back_len * CARD_CHAR_SIZE);
+}
@@ -0,0 +1,44 @@
+/*
+ * deckwatch.h
+ *
+ * This file contains the types and functions for watching the card files of a deck and reloading them when they change
+ */
+
+#ifndef	DECKWATCH_H
+#define	DECKWATCH_H
+
+#include <stdbool.h>
+
+// Changes made to card_list by reload_changed_files
+typedef struct deckreload{
+	// Index of the first card added to the end of card_list and the number of cards added
+	int first_added;
+	int added;
+
+	// Cards deleted because they were taken out of their card files; this belongs to deckwatch.c and is valid until the next reload
+	const int *deleted;
+	int deleted_len;
+
+	// Number of cards whose text was changed in place
+	int changed;
+
+	// Number of card files reloaded
+	int files;
+
+	// Card file that couldn't be reloaded, or NULL if every changed file was
+	const char *error_file;
+} deckreload_t;
+
+// Starts watching the card files a deck was read from with read_deck; returns errno on error
+int watch_deck(char **filenames, int filecount);
+
+// Returns true if the card files of the deck are being watched
+bool deck_watched(void);
+
+// Reloads the card files that have changed since the last call; returns the number of files reloaded, or -1 on an error that stops watching
+int reload_changed_files(deckreload_t *reload);
+
+// Stops watching the card files of the deck
+void stop_watching_deck(void);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ * decompress.c
+ *
+ * This file contains functions for reading card files that may be compressed.
+ *
+ * Card files compressed with gzip or zstd are recognized by their first bytes, not their names, so compressed decks can also be piped in. They're decompressed as they're read, READER_IN_SIZE bytes at a time, so no decompressed copy is ever written to disk and the only memory used besides the output is the input buffer and the state of the decompressor. Files made of several concatenated gzip members or zstd frames are read as one file.
+ *
+ * zstd support needs libzstd when building (HAVE_ZSTD); without it, zstd files are reported as unsupported.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#ifdef	HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "util.h"
+#include "cardfile.h"
+#include "decompress.h"
+
+// Number of bytes needed to recognize every compression format
+#define	MAGIC_SIZE		4
+
+// Records an error and returns its errno value
+static int set_reader_error(loaderror_t *error, int code, const char *func);
+
+// Reads more compressed bytes if every byte read so far has been used; returns errno on error
+static int fill_reader_input(cardreader_t *reader, loaderror_t *error);
+
+// Decompresses as many bytes as fit in buf from the input read so far; returns the number of bytes decompressed or -1 on error
+static ssize_t run_decompressor(cardreader_t *reader, void *buf, size_t n, loaderror_t *error);
+
+/*
+ * returns the compression format a file is in from its first len bytes
+ */
+compression_t detect_compression(const unsigned char *data, size_t len)
+{
+	if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+		return COMPRESSION_GZIP;
+	if (len >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+		return COMPRESSION_ZSTD;
+	return COMPRESSION_NONE;
+}
+
+/*
+ * returns true if the regular file fd refers to is compressed; the first bytes are read with pread, so the file offset isn't moved
+ */
+bool is_compressed_fd(int fd)
+{
+	unsigned char magic[MAGIC_SIZE];
+	ssize_t n;
+
+	if ((n = pread(fd, magic, sizeof(magic), 0)) <= 0)
+		return false;
+	return detect_compression(magic, n) != COMPRESSION_NONE;
+}
+
+/*
+ * starts reading fd through a reader, reading its first bytes to pick a decompressor; files that aren't compressed are read as they are
+ *
+ * returns errno on error
+ */
+int open_card_reader(cardreader_t *reader, int fd, loaderror_t *error)
+{
+	ssize_t bytes_read;
+
+	memset(reader, 0, sizeof(cardreader_t));
+	reader->fd = fd;
+	if ((reader->in = malloc(READER_IN_SIZE)) == NULL)
+		return set_reader_error(error, errno, "malloc");
+
+	// Pipes can give fewer bytes than were asked for, so keep reading until the magic bytes are all there
+	while (reader->in_len < MAGIC_SIZE && !reader->in_eof)
+	{
+		if ((bytes_read = read(fd, reader->in + reader->in_len, READER_IN_SIZE - reader->in_len)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return set_reader_error(error, errno, "read");
+		}
+		reader->in_eof = bytes_read == 0;
+		reader->in_len += bytes_read;
+	}
+
+	switch (reader->type = detect_compression(reader->in, reader->in_len))
+	{
+		case COMPRESSION_NONE:
+			break;
+		case COMPRESSION_GZIP:
+			// 16 added to the window bits only accepts gzip headers
+			if (inflateInit2(&reader->gzip, MAX_WBITS + 16) != Z_OK)
+			{
+				reader->type = COMPRESSION_NONE;
+				return set_reader_error(error, ENOMEM, "inflateInit2");
+			}
+			break;
+		case COMPRESSION_ZSTD:
+#ifdef	HAVE_ZSTD
+			if ((reader->zstd = ZSTD_createDStream()) == NULL)
+				return set_reader_error(error, ENOMEM, "ZSTD_createDStream");
+			ZSTD_initDStream(reader->zstd);
+			break;
+#else
+			// Error: the program was built without libzstd
+			return set_reader_error(error, ENOTSUP, "zstd");
+#endif
+	}
+	return 0;
+}
+
+/*
+ * reads up to n decompressed bytes into buf
+ *
+ * returns the number of bytes read, which is only 0 at the end of the file, or -1 on error; a compressed file that ends in the middle of a stream is an error
+ */
+ssize_t read_card_reader(cardreader_t *reader, void *buf, size_t n, loaderror_t *error)
+{
+	ssize_t bytes_read;
+
+	if (n == 0)
+		return 0;
+
+	if (reader->type == COMPRESSION_NONE)
+	{
+		// Give out the bytes read to find the compression format first
+		if (reader->in_pos < reader->in_len)
+		{
+			n = MIN(n, reader->in_len - reader->in_pos);
+			memcpy(buf, reader->in + reader->in_pos, n);
+			reader->in_pos += n;
+			return n;
+		}
+		if (reader->in_eof)
+			return 0;
+		while ((bytes_read = read(reader->fd, buf, n)) == -1)
+		{
+			if (errno != EINTR)
+			{
+				set_reader_error(error, errno, "read");
+				return -1;
+			}
+		}
+		reader->in_eof = bytes_read == 0;
+		return bytes_read;
+	}
+
+	for (;;)
+	{
+		if (fill_reader_input(reader, error) != 0)
+			return -1;
+
+		if (reader->stream_end)
+		{
+			if (reader->in_pos == reader->in_len)
+				return 0;
+
+			// Another gzip member follows; zstd streams go on to the next frame by themselves
+			if (reader->type == COMPRESSION_GZIP)
+				inflateReset(&reader->gzip);
+			reader->stream_end = false;
+		}
+
+		if ((bytes_read = run_decompressor(reader, buf, n, error)) != 0)
+			return bytes_read;
+
+		// Error: the file ended in the middle of a compressed stream
+		if (reader->in_pos == reader->in_len && reader->in_eof && !reader->stream_end)
+		{
+			set_reader_error(error, EIO, reader->type == COMPRESSION_GZIP ? "inflate" : "ZSTD_decompressStream");
+			return -1;
+		}
+	}
+}
+
+/*
+ * frees the input buffer and decompressor of a reader
+ */
+void close_card_reader(cardreader_t *reader)
+{
+	if (reader->type == COMPRESSION_GZIP)
+		inflateEnd(&reader->gzip);
+#ifdef	HAVE_ZSTD
+	ZSTD_freeDStream(reader->zstd);
+	reader->zstd = NULL;
+#endif
+	free(reader->in);
+	reader->in = NULL;
+	reader->type = COMPRESSION_NONE;
+}
+
+/*
+ * records an error like set_load_error in cardfile.c
+ *
+ * returns code
+ */
+static int set_reader_error(loaderror_t *error, int code, const char *func)
+{
+	error->code = code;
+	error->func = func;
+	return code;
+}
+
+/*
+ * reads up to READER_IN_SIZE more compressed bytes once every byte read so far has been given to the decompressor
+ *
+ * returns errno on error
+ */
+static int fill_reader_input(cardreader_t *reader, loaderror_t *error)
+{
+	ssize_t bytes_read;
+
+	if (reader->in_pos < reader->in_len || reader->in_eof)
+		return 0;
+
+	while ((bytes_read = read(reader->fd, reader->in, READER_IN_SIZE)) == -1)
+		if (errno != EINTR)
+			return set_reader_error(error, errno, "read");
+	reader->in_pos = 0;
+	reader->in_len = bytes_read;
+	reader->in_eof = bytes_read == 0;
+	return 0;
+}
+
+/*
+ * decompresses the unused input of a reader into buf until buf is full or the input runs out; output the decompressor held back from earlier calls is given out even if there's no input left
+ *
+ * sets stream_end when a gzip member or zstd frame has been fully decompressed
+ *
+ * returns the number of bytes decompressed, or -1 on error
+ */
+static ssize_t run_decompressor(cardreader_t *reader, void *buf, size_t n, loaderror_t *error)
+{
+	if (reader->type == COMPRESSION_GZIP)
+	{
+		z_stream *z = &reader->gzip;
+		int r;
+
+		z->next_in = reader->in + reader->in_pos;
+		z->avail_in = reader->in_len - reader->in_pos;
+		z->next_out = buf;
+		z->avail_out = MIN(n, (size_t) UINT_MAX);
+		r = inflate(z, Z_NO_FLUSH);
+		reader->in_pos = reader->in_len - z->avail_in;
+
+		if (r == Z_STREAM_END)
+			reader->stream_end = true;
+		else if (r != Z_OK && r != Z_BUF_ERROR)
+		{
+			set_reader_error(error, r == Z_MEM_ERROR ? ENOMEM : EIO, "inflate");
+			return -1;
+		}
+		return MIN(n, (size_t) UINT_MAX) - z->avail_out;
+	}
+
+#ifdef	HAVE_ZSTD
+	ZSTD_inBuffer in = {reader->in, reader->in_len, reader->in_pos};
+	ZSTD_outBuffer out = {buf, n, 0};
+	size_t r = ZSTD_decompressStream(reader->zstd, &out, &in);
+
+	reader->in_pos = in.pos;
+	if (ZSTD_isError(r))
+	{
+		set_reader_error(error, EIO, "ZSTD_decompressStream");
+		return -1;
+	}
+	reader->stream_end = r == 0;
+	return out.pos;
+#else
+	set_reader_error(error, ENOTSUP, "zstd");
+	return -1;
+#endif
+}
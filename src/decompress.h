@@ -0,0 +1,69 @@
+/*
+ * decompress.h
+ *
+ * This file contains the card reader type and functions for reading card files that may be compressed
+ */
+
+#ifndef	DECOMPRESS_H
+#define	DECOMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <zlib.h>
+
+#ifdef	HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cardfile.h"
+
+// Number of compressed bytes read from a file at a time
+#define	READER_IN_SIZE		65536
+
+// Compression formats of card files
+typedef enum compression{
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_ZSTD
+} compression_t;
+
+// File descriptor read through a decompressor picked from the first bytes of the file
+typedef struct cardreader{
+	int fd;
+	compression_t type;
+
+	// Bytes read from fd that haven't been used yet
+	unsigned char *in;
+	size_t in_pos;
+	size_t in_len;
+
+	// True once fd has been read to its end
+	bool in_eof;
+
+	// True once a compressed stream has ended and the next one hasn't started
+	bool stream_end;
+
+	z_stream gzip;
+#ifdef	HAVE_ZSTD
+	ZSTD_DStream *zstd;
+#endif
+} cardreader_t;
+
+// Returns the compression format that a file starting with len bytes of data is in
+compression_t detect_compression(const unsigned char *data, size_t len);
+
+// Returns true if the file a file descriptor refers to is compressed, without moving its file offset
+bool is_compressed_fd(int fd);
+
+// Starts reading a file descriptor, picking a decompressor from its first bytes; returns errno on error
+int open_card_reader(cardreader_t *reader, int fd, loaderror_t *error);
+
+// Reads up to n decompressed bytes into buf; returns the number of bytes read, 0 at the end of the file, or -1 on error
+ssize_t read_card_reader(cardreader_t *reader, void *buf, size_t n, loaderror_t *error);
+
+// Frees the buffers of a reader; its file descriptor is left open
+void close_card_reader(cardreader_t *reader);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * dedupe.c
+ *
+ * This file contains the hash table used to remove duplicate cards while a deck is being read.
+ *
+ * Cards are added to the table one at a time as they're read, so duplicates are found in the same pass that reads the deck. With DEDUPE_EXACT, cards are the same if their front and back text are identical. With DEDUPE_NORMALIZED, case is ignored, runs of whitespace count as a single space, and whitespace at the start and end of each side is ignored; the text is normalized one character at a time while it's hashed and compared, so nothing is copied.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "util.h"
+#include "card.h"
+#include "dedupe.h"
+
+// Reads the characters of one side of a card one at a time, normalized for DEDUPE_NORMALIZED
+typedef struct sidereader{
+	const char *text;
+
+	// Position of the next character and the length of the side, in characters of CARD_CHAR_SIZE
+	size_t pos;
+	size_t len;
+
+	// Decoding state of compact text
+	mbstate_t state;
+
+	// Character read after a run of whitespace, which is returned after the space it's replaced with, or WEOF if there isn't one
+	wint_t held;
+
+	// True once a character other than whitespace has been returned
+	bool started;
+} sidereader_t;
+
+// Starts reading one side of a card
+static void init_side_reader(sidereader_t *reader, const char *text, uint32_t off, uint32_t len);
+
+// Returns the next character of a side, or WEOF at its end
+static wint_t read_side_char(sidereader_t *reader);
+
+// Returns the next normalized character of a side, or WEOF at its end
+static wint_t read_normalized_char(sidereader_t *reader);
+
+// Returns a hash of the text of a card
+static uint64_t hash_card(const card_t *card, const char *text);
+
+// Returns true if two cards have the same text
+static bool same_card(const card_t *a, const card_t *b, const char *text);
+
+/*
+ * makes sure a table can hold count cards while staying at most half full, moving its cards to a larger array if it can't
+ *
+ * returns errno on error
+ */
+int reserve_dedupe_table(dedupetable_t *table, size_t count)
+{
+	dedupeentry_t *entries, *old = table->entries;
+	size_t size = 16, old_size = old == NULL ? 0 : table->mask + 1;
+
+	while (size < count * 2)
+		size *= 2;
+	if (size <= old_size)
+		return 0;
+
+	if ((entries = malloc(size * sizeof(dedupeentry_t))) == NULL)
+		return errno;
+	for (size_t i = 0; i < size; i++)
+		entries[i].card = -1;
+	for (size_t i = 0; i < old_size; i++)
+	{
+		size_t j;
+
+		if (old[i].card == -1)
+			continue;
+		for (j = old[i].hash & (size - 1); entries[j].card != -1; j = (j + 1) & (size - 1));
+		entries[j] = old[i];
+	}
+	free(old);
+	table->entries = entries;
+	table->mask = size - 1;
+	return 0;
+}
+
+/*
+ * frees a table, leaving it empty
+ */
+void free_dedupe_table(dedupetable_t *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->mask = 0;
+	table->count = 0;
+}
+
+/*
+ * looks for a card with the same text as card i of cards, whose text is in text; the table has to have room for card i, which reserve_dedupe_table makes
+ *
+ * returns the index of the card with the same text if there is one; otherwise card i is added to the table and i is returned
+ */
+int dedupe_card(dedupetable_t *table, const card_t *cards, const char *text, int i)
+{
+	uint64_t hash = hash_card(&cards[i], text);
+	size_t j;
+
+	for (j = hash & table->mask; table->entries[j].card != -1; j = (j + 1) & table->mask)
+	{
+		const dedupeentry_t *entry = &table->entries[j];
+
+		if (entry->hash == hash && same_card(&cards[entry->card], &cards[i], text))
+			return entry->card;
+	}
+
+	table->entries[j].hash = hash;
+	table->entries[j].card = i;
+	table->count++;
+	return i;
+}
+
+/*
+ * starts reading the len characters at off in text
+ */
+static void init_side_reader(sidereader_t *reader, const char *text, uint32_t off, uint32_t len)
+{
+	reader->text = text + (size_t) off * CARD_CHAR_SIZE;
+	reader->pos = 0;
+	reader->len = len;
+	memset(&reader->state, 0, sizeof(reader->state));
+	reader->held = WEOF;
+	reader->started = false;
+}
+
+/*
+ * returns the next character of a side, decoding compact text like decode_text does, or WEOF at the end of the side
+ */
+static wint_t read_side_char(sidereader_t *reader)
+{
+	wchar_t c;
+	size_t r;
+
+	if (reader->pos == reader->len)
+		return WEOF;
+	if (!compact_text)
+		return ((const wchar_t *) reader->text)[reader->pos++];
+	if ((unsigned char) reader->text[reader->pos] < 0x80)
+		return (unsigned char) reader->text[reader->pos++];
+
+	r = mbrtowc(&c, reader->text + reader->pos, reader->len - reader->pos, &reader->state);
+	if (r == (size_t) -1 || r == (size_t) -2)
+	{
+		c = 0xFFFD;
+		memset(&reader->state, 0, sizeof(reader->state));
+		r = 1;
+	}
+	reader->pos += MAX(r, 1);
+	return c;
+}
+
+/*
+ * returns the next character of a side in lowercase, with runs of whitespace read as one space and whitespace at the start and end of the side skipped, or WEOF at the end of the side
+ */
+static wint_t read_normalized_char(sidereader_t *reader)
+{
+	wint_t c;
+	bool space = false;
+
+	if (reader->held != WEOF)
+	{
+		c = reader->held;
+		reader->held = WEOF;
+		return c;
+	}
+
+	// ASCII is checked without the locale, since most card text is ASCII
+	while ((c = read_side_char(reader)) != WEOF && (c < 0x80 ? c == ' ' || (c >= '\t' && c <= '\r') : iswspace(c)))
+		space = true;
+	if (c == WEOF)
+		return WEOF;
+
+	if (c < 0x80)
+		c = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+	else
+		c = towlower(c);
+	if (space && reader->started)
+	{
+		reader->held = c;
+		return L' ';
+	}
+	reader->started = true;
+	return c;
+}
+
+/*
+ * returns a hash of the text of a card; cards that are the same for dedupe_mode always have the same hash
+ */
+static uint64_t hash_card(const card_t *card, const char *text)
+{
+	sidereader_t reader;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	wint_t c;
+
+	if (dedupe_mode != DEDUPE_NORMALIZED)
+	{
+		return hash_bytes(text + (size_t) card->front * CARD_CHAR_SIZE, card->front_len * CARD_CHAR_SIZE) * 0x9e3779b97f4a7c15ULL
+			^ hash_bytes(text + (size_t) card->back * CARD_CHAR_SIZE, card->back_len * CARD_CHAR_SIZE);
+	}
+
+	// FNV-1a over the normalized characters of both sides, with WEOF between them so text can't move from one side to the other
+	init_side_reader(&reader, text, card->front, card->front_len);
+	while ((c = read_normalized_char(&reader)) != WEOF)
+		h = (h ^ c) * 0x100000001b3ULL;
+	h = (h ^ WEOF) * 0x100000001b3ULL;
+	init_side_reader(&reader, text, card->back, card->back_len);
+	while ((c = read_normalized_char(&reader)) != WEOF)
+		h = (h ^ c) * 0x100000001b3ULL;
+
+	// Mix the high bits into the low bits, which pick the entry of the card
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * returns true if two cards in text are the same for dedupe_mode
+ */
+static bool same_card(const card_t *a, const card_t *b, const char *text)
+{
+	sidereader_t ra, rb;
+	wint_t c;
+
+	if (dedupe_mode != DEDUPE_NORMALIZED)
+	{
+		return a->front_len == b->front_len && a->back_len == b->back_len
+			&& memcmp(text + (size_t) a->front * CARD_CHAR_SIZE, text + (size_t) b->front * CARD_CHAR_SIZE, a->front_len * CARD_CHAR_SIZE) == 0
+			&& memcmp(text + (size_t) a->back * CARD_CHAR_SIZE, text + (size_t) b->back * CARD_CHAR_SIZE, a->back_len * CARD_CHAR_SIZE) == 0;
+	}
+
+	for (cardside_t side = CARDSIDE_FRONT; side <= CARDSIDE_BACK; side++)
+	{
+		init_side_reader(&ra, text, side == CARDSIDE_FRONT ? a->front : a->back, side == CARDSIDE_FRONT ? a->front_len : a->back_len);
+		init_side_reader(&rb, text, side == CARDSIDE_FRONT ? b->front : b->back, side == CARDSIDE_FRONT ? b->front_len : b->back_len);
+		do
+		{
+			if ((c = read_normalized_char(&ra)) != read_normalized_char(&rb))
+				return false;
+		} while (c != WEOF);
+	}
+	return true;
+}
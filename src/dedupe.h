@@ -0,0 +1,42 @@
+/*
+ * dedupe.h
+ *
+ * This file contains the hash table used to find cards with the same text when duplicate cards are removed
+ */
+
+#ifndef	DEDUPE_H
+#define	DEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "card.h"
+
+// Card stored in a dedupe table
+typedef struct dedupeentry{
+	// Hash of the text of the card
+	uint64_t hash;
+
+	// Index of the card in the array passed to dedupe_card, or -1 if the entry is unused
+	int card;
+} dedupeentry_t;
+
+// Open addressing hash table of cards; a zeroed table is empty and has no entries allocated
+typedef struct dedupetable{
+	dedupeentry_t *entries;
+
+	// Number of entries minus one (the number of entries is a power of 2), and the number of entries used
+	size_t mask;
+	size_t count;
+} dedupetable_t;
+
+// Makes sure a table can hold count cards without growing; returns errno on error
+int reserve_dedupe_table(dedupetable_t *table, size_t count);
+
+// Frees a table, leaving it empty
+void free_dedupe_table(dedupetable_t *table);
+
+// Returns the index of a card in the table with the same text as card i, adding card i to the table if there isn't one
+int dedupe_card(dedupetable_t *table, const card_t *cards, const char *text, int i);
+
+#endif
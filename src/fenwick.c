@@ -0,0 +1,121 @@
+/*
+ * fenwick.c
+ *
+ * This file contains functions for Fenwick trees, which count the positions of a list that are still in use.
+ *
+ * Removing a position, counting the positions in use before one, and finding the k-th position in use all take O(log n) time.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "fenwick.h"
+
+/*
+ * sets up a tree over len positions that are all in use; since every position counts 1, each node just holds the size of its range
+ *
+ * returns errno on error
+ */
+int init_fenwick(fenwick_t *f, int len)
+{
+	int *temp;
+
+	if ((temp = reallocarray(f->tree, len + 1, sizeof(int))) == NULL)
+		return errno;
+	f->tree = temp;
+	f->len = len;
+	f->total = len;
+	for (int i = 1; i <= len; i++)
+		f->tree[i] = i & -i;
+	return 0;
+}
+
+/*
+ * adds positions that are all in use to the end of a tree until it has len positions
+ *
+ * each new node holds its new positions plus the positions of its range that were already in the tree and are still in use, which are counted with the nodes before it
+ *
+ * returns errno on error
+ */
+int grow_fenwick(fenwick_t *f, int len)
+{
+	int *temp;
+	int old_len = f->len;
+	int old_total = fenwick_rank(f, old_len);
+
+	if (len <= old_len)
+		return 0;
+	if ((temp = reallocarray(f->tree, len + 1, sizeof(int))) == NULL)
+		return errno;
+	f->tree = temp;
+	for (int i = old_len + 1; i <= len; i++)
+	{
+		int start = i - (i & -i);
+
+		if (start >= old_len)
+			f->tree[i] = i & -i;
+		else
+			f->tree[i] = i - old_len + old_total - fenwick_rank(f, start);
+	}
+	f->len = len;
+	f->total += len - old_len;
+	return 0;
+}
+
+/*
+ * marks position i as no longer in use; i must be in use
+ */
+void fenwick_remove(fenwick_t *f, int i)
+{
+	for (i++; i <= f->len; i += i & -i)
+		f->tree[i]--;
+	f->total--;
+}
+
+/*
+ * returns the number of positions in use before position i
+ */
+int fenwick_rank(const fenwick_t *f, int i)
+{
+	int sum = 0;
+
+	for (; i > 0; i -= i & -i)
+		sum += f->tree[i];
+	return sum;
+}
+
+/*
+ * returns the k-th position in use, counting from 1, by walking down the tree from its largest range
+ *
+ * returns len if fewer than k positions are in use
+ */
+int fenwick_find(const fenwick_t *f, int k)
+{
+	int pos = 0;
+	int step = 1;
+
+	if (k > f->total)
+		return f->len;
+
+	while (step * 2 <= f->len)
+		step *= 2;
+	for (; step > 0; step /= 2)
+	{
+		if (pos + step <= f->len && f->tree[pos + step] < k)
+		{
+			pos += step;
+			k -= f->tree[pos];
+		}
+	}
+	return pos;
+}
+
+/*
+ * frees a tree
+ */
+void free_fenwick(fenwick_t *f)
+{
+	free(f->tree);
+	f->tree = NULL;
+	f->len = f->total = 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * fenwick.h
+ *
+ * This file contains the Fenwick tree type and functions for counting which positions of a list are still in use
+ */
+
+#ifndef	FENWICK_H
+#define	FENWICK_H
+
+// Fenwick (binary indexed) tree over a list of positions that are each either in use or not
+typedef struct fenwick{
+	// Sums of ranges of positions; tree[i] holds the sum of the (i & -i) positions ending at position i - 1
+	int *tree;
+
+	// Number of positions
+	int len;
+
+	// Number of positions in use
+	int total;
+} fenwick_t;
+
+// Sets up a tree over len positions that are all in use; returns errno on error
+int init_fenwick(fenwick_t *f, int len);
+
+// Adds positions that are all in use to the end of a tree until it has len positions; returns errno on error
+int grow_fenwick(fenwick_t *f, int len);
+
+// Marks position i as no longer in use
+void fenwick_remove(fenwick_t *f, int i);
+
+// Returns the number of positions in use before position i
+int fenwick_rank(const fenwick_t *f, int i);
+
+// Returns the k-th position in use, counting from 1
+int fenwick_find(const fenwick_t *f, int k);
+
+// Frees a tree
+void free_fenwick(fenwick_t *f);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * intern.c
+ *
+ * This file contains the hash table used to give identical card text a single copy.
+ *
+ * The table holds offsets into an array of text instead of pointers, so it's as small as possible and stays valid if the array is moved. It's filled once while a deck is being read and never has entries removed, so it uses linear probing.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+/*
+ * creates a table with room for count strings; the table is kept at most half full so probes stay short
+ *
+ * returns errno on error
+ */
+int init_intern_table(interntable_t *table, size_t count)
+{
+	size_t size = 16;
+
+	while (size < count * 2)
+		size *= 2;
+
+	if ((table->entries = malloc(size * sizeof(internentry_t))) == NULL)
+		return errno;
+	for (size_t i = 0; i < size; i++)
+		table->entries[i].off = INTERN_EMPTY;
+	table->mask = size - 1;
+	return 0;
+}
+
+/*
+ * frees a table
+ */
+void free_intern_table(interntable_t *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+}
+
+/*
+ * looks for text identical to the len characters at off in text (characters are char_size bytes), hashed to hash
+ *
+ * returns the offset of the identical text if there is any; otherwise off is added to the table and returned
+ */
+uint32_t intern_text(interntable_t *table, const char *text, size_t char_size, uint32_t off, uint32_t len, uint32_t hash)
+{
+	internentry_t *entry;
+
+	for (size_t i = hash & table->mask;; i = (i + 1) & table->mask)
+	{
+		entry = &table->entries[i];
+
+		if (entry->off == INTERN_EMPTY)
+		{
+			entry->off = off;
+			entry->len = len;
+			entry->hash = hash;
+			return off;
+		}
+
+		if (entry->hash == hash && entry->len == len && memcmp(text + (size_t) entry->off * char_size, text + (size_t) off * char_size, len * char_size) == 0)
+			return entry->off;
+	}
+}
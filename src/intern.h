@@ -0,0 +1,42 @@
+/*
+ * intern.h
+ *
+ * This file contains the hash table used to give identical card text a single copy
+ */
+
+#ifndef	INTERN_H
+#define	INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Offset of an unused entry
+#define	INTERN_EMPTY		UINT32_MAX
+
+// Text stored in an intern table
+typedef struct internentry{
+	// Offset and length of the text in the array passed to intern_text, in characters
+	uint32_t off;
+	uint32_t len;
+
+	uint32_t hash;
+} internentry_t;
+
+// Open addressing hash table of text in one array
+typedef struct interntable{
+	internentry_t *entries;
+
+	// Number of entries minus one (the number of entries is a power of 2)
+	size_t mask;
+} interntable_t;
+
+// Creates a table with room for count strings; returns errno on error
+int init_intern_table(interntable_t *table, size_t count);
+
+// Frees a table
+void free_intern_table(interntable_t *table);
+
+// Returns the offset of text identical to the text at off, adding the text at off to the table if there isn't any
+uint32_t intern_text(interntable_t *table, const char *text, size_t char_size, uint32_t off, uint32_t len, uint32_t hash);
+
+#endif
@@ -0,0 +1,918 @@
+/*
+ * journal.c
+ *
+ * This file contains the journal the progress of a deck is saved in.
+ *
+ * The progress of a deck is the state and schedule of each of its cards and the number of cards marked right and wrong. It's kept in two files in $XDG_DATA_HOME/sortstudycli (or ~/.local/share/sortstudycli), named after a hash of the full paths of the card files of the deck, like deck caches: a snapshot of the progress of every card that has any, and a journal of the cards graded or deleted since the snapshot was written. Cards are found in both by a hash of their text, so editing, adding or moving cards in the card files only loses the progress of the cards whose text changed.
+ *
+ * Each time a card is graded or deleted, a record of it is added to a queue, and a writer thread appends the queued records to the journal. The writer waits JOURNAL_COMMIT_MS after the first record for more to arrive, then writes them all and syncs the journal once, so a burst of grades costs one sync and no key press ever waits for the disk. Changes to many cards at once, like starting a new review, are saved by writing a new snapshot instead, which is also done every JOURNAL_COMPACT_RECORDS records so the journal replayed when the deck is opened stays short.
+ *
+ * Every snapshot has a generation, one more than the snapshot before it, and a journal only belongs to the snapshot with its generation; a journal left over from an older snapshot, after the program stopped between writing a snapshot and starting its journal, is ignored. Records have a check of their bytes, so a record that was only partly written when the program stopped ends the journal.
+ */
+
+// asprintf is a GNU extension
+#define	_GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "util.h"
+#include "bitmap.h"
+#include "card.h"
+#include "deckcache.h"
+#include "schedule.h"
+#include "review.h"
+#include "journal.h"
+
+// Directory progress is kept in, under the data directory of the user
+#define	JOURNAL_DIR		"sortstudycli"
+
+// Number of records read from a journal at once when it's replayed
+#define	JOURNAL_READ_RECORDS	4096
+
+// Header at the start of a snapshot; it's followed by count journalrecord_t
+typedef struct progressheader{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t generation;
+	uint32_t right_cards;
+	uint32_t wrong_cards;
+} progressheader_t;
+
+// Header at the start of a journal; it's followed by journalrecord_t until the end of the file
+typedef struct journalheader{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+
+	// Generation of the snapshot the journal belongs to
+	uint64_t generation;
+} journalheader_t;
+
+// Snapshot waiting to be written by the writer
+typedef struct snapshot{
+	journalrecord_t *entries;
+	uint32_t count;
+	uint32_t right_cards;
+	uint32_t wrong_cards;
+} snapshot_t;
+
+// True if progress is loaded and saved, and true if it's only loaded
+static bool journal_enabled = false;
+static bool journal_read_only = false;
+
+// Paths of the snapshot and journal of the deck
+static char *progress_path;
+static char *journal_path;
+
+// Saved progress of cards, from the snapshot and journal as they were when the deck was opened, and which entries were given to cards
+static journalrecord_t *saved;
+static uint32_t saved_count;
+static uint32_t saved_size;
+static bool *saved_used;
+
+// Hash table of the positions of the entries in saved, with UINT32_MAX in empty slots
+static uint32_t *saved_table;
+static size_t saved_mask;
+
+// Hash of the text of each card in card_list, or 0 if it hasn't been found yet
+static uint64_t *card_hashes;
+static int card_hashes_size;
+
+// Bitmap of the cards in card_list that were deleted because they were taken out of their card files, which aren't saved as deleted; it has room for card_hashes_size cards
+static uint64_t *removed_cards;
+
+// Number of records in the journal since the last snapshot, including the ones replayed
+static int journal_records;
+
+// Records and snapshot waiting to be written, and whether the writer should stop once they're written; shared with the writer under journal_lock
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+static journalrecord_t *pending;
+static int pending_len;
+static int pending_size;
+static snapshot_t *pending_snapshot;
+static bool journal_closing = false;
+
+// Writer thread, and whether it has been started
+static pthread_t writer_thread;
+static bool writer_started = false;
+
+// Records being written by the writer, swapped with pending each time it takes them
+static journalrecord_t *writing;
+static int writing_size;
+
+// Journal file opened by the writer, or -1, and its length
+static int journal_fd = -1;
+static off_t journal_len;
+
+// Generation of the last snapshot
+static uint64_t journal_generation;
+
+// Length of the valid part of the journal when it was replayed, or 0 if it has to be started over
+static off_t journal_valid_len;
+
+// Finds the paths of the snapshot and journal of a deck of card files; returns errno on error
+static int find_progress_paths(char **filenames, int filecount);
+
+// Reads the snapshot of the deck into saved; returns errno on error
+static int load_snapshot(void);
+
+// Replays the records of the journal of the deck into saved; returns errno on error
+static int load_journal(void);
+
+// Returns the saved progress of a card with a hash, or NULL if there isn't any
+static journalrecord_t *find_saved_entry(uint64_t hash);
+
+// Adds the progress of a card to saved, replacing its earlier progress; returns errno on error
+static int put_saved_entry(const journalrecord_t *rec);
+
+// Replaces saved with the entries of a snapshot; returns errno on error
+static int replace_saved(const snapshot_t *snap, uint32_t card_entries);
+
+// Returns the hash of the text of card i
+static uint64_t get_card_hash(int i);
+
+// Fills a record with the progress of card i
+static void fill_record(journalrecord_t *rec, int i);
+
+// Returns the check of a record
+static uint32_t check_record(const journalrecord_t *rec);
+
+// Starts the writer thread if it hasn't been started
+static void start_writer(void);
+
+// Writes queued records and snapshots until the journal is closed; used as the writer thread
+static void *journal_writer(void *arg);
+
+// Writes a snapshot and starts a new journal for it; returns errno on error
+static int write_snapshot(const snapshot_t *snap);
+
+// Appends records to the journal and syncs it; returns errno on error
+static int append_records(const journalrecord_t *records, int count);
+
+// Opens the journal to append to it, starting it over if it isn't valid; returns errno on error
+static int open_journal_file(void);
+
+// Empties the journal and writes its header; returns errno on error
+static int reset_journal_file(void);
+
+// Reads up to n bytes from fd; returns the number of bytes read, or -1 on error
+static ssize_t read_all(int fd, void *buf, size_t n);
+
+/*
+ * loads the snapshot and journal of a deck of card files, restores right_cards and wrong_cards, and gives the saved progress of the cards read so far to them
+ *
+ * progress isn't saved for decks with a card file that has no path, like standard input, in low-memory mode, or if there's no data directory. If the snapshot or journal exist but can't be read, progress isn't saved either, so it isn't overwritten; snapshots and journals from another version are started over. With read_only, nothing is written, and with reset, the saved progress is deleted instead of being loaded
+ *
+ * returns errno on error
+ */
+int open_journal(char **filenames, int filecount, bool read_only, bool reset)
+{
+	int err;
+
+	if (low_memory || find_progress_paths(filenames, filecount) != 0)
+		return 0;
+
+	if (reset && !read_only)
+	{
+		unlink(progress_path);
+		unlink(journal_path);
+	}
+	else if (((err = load_snapshot()) != 0 && err != EINVAL) || (err = load_journal()) != 0)
+		return err == ENOMEM ? err : 0;
+
+	journal_enabled = true;
+	journal_read_only = read_only;
+	return restore_progress(0, card_list_len);
+}
+
+/*
+ * gives the saved progress of count cards added to the end of card_list, starting at first, to them; cards saved as deleted are deleted, unless they're the last card left
+ *
+ * returns errno on error
+ */
+int restore_progress(int first, int count)
+{
+	if (!journal_enabled)
+		return 0;
+
+	if (first + count > card_hashes_size)
+	{
+		uint64_t *temp;
+		int size = MAX(first + count, card_hashes_size * 2);
+
+		if ((temp = reallocarray(card_hashes, size, sizeof(uint64_t))) == NULL)
+			return errno;
+		card_hashes = temp;
+		if ((temp = reallocarray(removed_cards, BITMAP_WORDS(size), sizeof(uint64_t))) == NULL)
+			return errno;
+		memset(&temp[BITMAP_WORDS(card_hashes_size)], 0, (BITMAP_WORDS(size) - BITMAP_WORDS(card_hashes_size)) * sizeof(uint64_t));
+		removed_cards = temp;
+		card_hashes_size = size;
+	}
+	memset(&card_hashes[first], 0, (size_t) count * sizeof(uint64_t));
+
+	// Hashes are only found now if there's progress to give cards, and are otherwise left for the first snapshot
+	if (saved_count == 0)
+		return 0;
+
+	for (int i = first; i < first + count; i++)
+	{
+		journalrecord_t *entry = find_saved_entry(get_card_hash(i));
+
+		if (entry == NULL)
+			continue;
+		saved_used[entry - saved] = true;
+		if (get_card_state(i) == CARDSTATE_TO_DELETE)
+			continue;
+
+		if (entry->state == CARDSTATE_TO_DELETE)
+		{
+			if (card_list_len - deleted_cards > 1)
+			{
+				delete_card(i);
+				if (scheduled_review)
+					unschedule_card(i);
+			}
+			continue;
+		}
+		if (entry->state < CARDSTATE_COUNT)
+			set_card_state(i, entry->state);
+		if (scheduled_review)
+			set_card_schedule(i, &entry->sched);
+	}
+	return 0;
+}
+
+/*
+ * queues a record of the state and schedule of card i and the current right_cards and wrong_cards for the writer to append to the journal; the journal is compacted into a snapshot once it has JOURNAL_COMPACT_RECORDS records
+ *
+ * records that can't be queued are dropped
+ */
+void journal_card(int i)
+{
+	journalrecord_t rec;
+
+	if (!journal_enabled || journal_read_only)
+		return;
+
+	fill_record(&rec, i);
+	rec.right_cards = right_cards;
+	rec.wrong_cards = wrong_cards;
+	rec.check = check_record(&rec);
+
+	// Keep saved up to date, so cards added later, like cards put back in their card files, get their latest progress
+	if (put_saved_entry(&rec) == 0)
+		saved_used[find_saved_entry(rec.hash) - saved] = true;
+
+	pthread_mutex_lock(&journal_lock);
+	if (pending_len == pending_size)
+	{
+		journalrecord_t *temp;
+		int size = MAX(pending_size * 2, 64);
+
+		if ((temp = reallocarray(pending, size, sizeof(journalrecord_t))) == NULL)
+		{
+			pthread_mutex_unlock(&journal_lock);
+			return;
+		}
+		pending = temp;
+		pending_size = size;
+	}
+	pending[pending_len++] = rec;
+	pthread_cond_signal(&journal_cond);
+	pthread_mutex_unlock(&journal_lock);
+	start_writer();
+
+	if (++journal_records >= JOURNAL_COMPACT_RECORDS)
+		journal_snapshot();
+}
+
+/*
+ * queues a snapshot of the progress of every card for the writer to write, replacing the records queued before it; cards that are marked for review and have never been scheduled have no progress, so they're left out, as are deleted cards that were taken out of their card files instead of being deleted by the user, and the saved progress of cards that weren't read is kept
+ *
+ * saved is replaced with the snapshot, since it's what the cards changed at once, like the cards marked for a new review or deleted as correct, have as their progress now
+ *
+ * the snapshot isn't written if memory can't be allocated
+ */
+void journal_snapshot(void)
+{
+	snapshot_t *snap;
+	uint32_t card_entries;
+
+	if (!journal_enabled || journal_read_only)
+		return;
+	if ((snap = malloc(sizeof(snapshot_t))) == NULL)
+		return;
+	if ((snap->entries = malloc(((size_t) card_list_len + saved_count) * sizeof(journalrecord_t))) == NULL)
+	{
+		free(snap);
+		return;
+	}
+
+	snap->count = 0;
+	for (int i = 0; i < card_list_len; i++)
+	{
+		journalrecord_t *rec = &snap->entries[snap->count];
+
+		fill_record(rec, i);
+		if (rec->state == CARDSTATE_DO_REVIEW && rec->sched.due == 0)
+			continue;
+		if (rec->state == CARDSTATE_TO_DELETE && BITMAP_TEST(removed_cards, i))
+			continue;
+		rec->check = check_record(rec);
+		snap->count++;
+	}
+	card_entries = snap->count;
+	for (uint32_t i = 0; i < saved_count; i++)
+	{
+		if (!saved_used[i])
+			snap->entries[snap->count++] = saved[i];
+	}
+	snap->right_cards = right_cards;
+	snap->wrong_cards = wrong_cards;
+
+	// If saved can't be replaced, it can't be trusted for the next snapshot, so this is the last one
+	if (replace_saved(snap, card_entries) != 0)
+		journal_read_only = true;
+
+	pthread_mutex_lock(&journal_lock);
+	if (pending_snapshot != NULL)
+	{
+		free(pending_snapshot->entries);
+		free(pending_snapshot);
+	}
+	pending_snapshot = snap;
+	pending_len = 0;
+	pthread_cond_signal(&journal_cond);
+	pthread_mutex_unlock(&journal_lock);
+	start_writer();
+
+	journal_records = 0;
+}
+
+/*
+ * records that count cards were deleted because they were taken out of their card files, so they aren't saved as deleted; if they're put back, they're added as new cards and get their saved progress again
+ */
+void forget_removed_cards(const int *cards, int count)
+{
+	if (!journal_enabled)
+		return;
+	for (int j = 0; j < count; j++)
+		BITMAP_SET(removed_cards, cards[j]);
+}
+
+/*
+ * forgets the hashes of every card after the text of cards changed, so they're found again when they're needed
+ */
+void rehash_journal_cards(void)
+{
+	if (card_hashes != NULL)
+		memset(card_hashes, 0, (size_t) card_hashes_size * sizeof(uint64_t));
+}
+
+/*
+ * makes the writer write every record and snapshot left in the queue, then waits for it to stop
+ */
+void close_journal(void)
+{
+	if (!writer_started)
+		return;
+	pthread_mutex_lock(&journal_lock);
+	journal_closing = true;
+	pthread_cond_signal(&journal_cond);
+	pthread_mutex_unlock(&journal_lock);
+	pthread_join(writer_thread, NULL);
+	writer_started = false;
+}
+
+/*
+ * returns the directory progress is kept in, $XDG_DATA_HOME/sortstudycli or ~/.local/share/sortstudycli, as a malloc'd string
+ *
+ * returns NULL if neither $XDG_DATA_HOME or $HOME are set, or if memory can't be allocated
+ */
+char *get_data_dir(void)
+{
+	const char *base;
+	char *dir;
+	int r;
+
+	// Relative paths in $XDG_DATA_HOME are invalid and should be ignored
+	if ((base = getenv("XDG_DATA_HOME")) != NULL && base[0] == '/')
+		r = asprintf(&dir, "%s/" JOURNAL_DIR, base);
+	else if ((base = getenv("HOME")) != NULL && base[0] != '\0')
+		r = asprintf(&dir, "%s/.local/share/" JOURNAL_DIR, base);
+	else
+		return NULL;
+	return r == -1 ? NULL : dir;
+}
+
+/*
+ * finds the paths of the snapshot and journal of a deck of card files from the full paths of the card files, like the path of a deck cache
+ *
+ * returns errno on error, including when a card file has no path
+ */
+static int find_progress_paths(char **filenames, int filecount)
+{
+	char *dir, *path;
+	uint64_t key = 0;
+	int err = 0;
+
+	for (int i = 0; i < filecount; i++)
+	{
+		if ((path = realpath(filenames[i], NULL)) == NULL)
+			return errno;
+		key = hash_bytes(path, strlen(path) + 1) ^ (key * 0x9e3779b97f4a7c15ULL);
+		free(path);
+	}
+
+	if ((dir = get_data_dir()) == NULL)
+		return ENOENT;
+	if (asprintf(&progress_path, "%s/%016" PRIx64 ".ssprogress", dir, key) == -1)
+	{
+		progress_path = NULL;
+		err = ENOMEM;
+	}
+	else if (asprintf(&journal_path, "%s/%016" PRIx64 ".ssjournal", dir, key) == -1)
+	{
+		free(progress_path);
+		progress_path = journal_path = NULL;
+		err = ENOMEM;
+	}
+	free(dir);
+	return err;
+}
+
+/*
+ * reads the snapshot of the deck into saved, and sets right_cards and wrong_cards and the generation of the journal from it; a deck without a snapshot has no saved progress
+ *
+ * returns errno on error, or EINVAL if the file isn't a snapshot of this version
+ */
+static int load_snapshot(void)
+{
+	progressheader_t header;
+	journalrecord_t *entries = NULL;
+	struct stat st;
+	int fd, err = 0;
+
+	if ((fd = open(progress_path, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : errno;
+	if (fstat(fd, &st) == -1)
+	{
+		err = errno;
+		goto load_snapshot_end;
+	}
+	if (read_all(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, PROGRESS_MAGIC, sizeof(PROGRESS_MAGIC)) != 0
+		|| header.version != JOURNAL_VERSION
+		|| (uint64_t) st.st_size != sizeof(header) + (uint64_t) header.count * sizeof(journalrecord_t))
+	{
+		err = EINVAL;
+		goto load_snapshot_end;
+	}
+
+	if ((entries = malloc((size_t) header.count * sizeof(journalrecord_t) + 1)) == NULL)
+	{
+		err = errno;
+		goto load_snapshot_end;
+	}
+	if (read_all(fd, entries, (size_t) header.count * sizeof(journalrecord_t)) != (ssize_t) (header.count * sizeof(journalrecord_t)))
+	{
+		err = EIO;
+		goto load_snapshot_end;
+	}
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		if ((err = put_saved_entry(&entries[i])) != 0)
+			goto load_snapshot_end;
+	}
+
+	right_cards = header.right_cards;
+	wrong_cards = header.wrong_cards;
+	journal_generation = header.generation;
+
+	load_snapshot_end:
+	free(entries);
+	close(fd);
+	return err;
+}
+
+/*
+ * replays the records of the journal of the deck into saved, setting right_cards and wrong_cards from the last one; the journal ends at the first record that was only partly written, and a journal that belongs to another snapshot is ignored
+ *
+ * returns errno on error
+ */
+static int load_journal(void)
+{
+	static journalrecord_t records[JOURNAL_READ_RECORDS];
+	journalheader_t header;
+	ssize_t n;
+	int fd, err = 0;
+
+	if ((fd = open(journal_path, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : errno;
+	if (read_all(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0
+		|| header.version != JOURNAL_VERSION || header.generation != journal_generation)
+		goto load_journal_end;
+
+	journal_valid_len = sizeof(header);
+	while ((n = read_all(fd, records, sizeof(records))) > 0)
+	{
+		for (size_t i = 0; i < n / sizeof(journalrecord_t); i++)
+		{
+			if (records[i].check != check_record(&records[i]))
+				goto load_journal_end;
+			if ((err = put_saved_entry(&records[i])) != 0)
+				goto load_journal_end;
+			right_cards = records[i].right_cards;
+			wrong_cards = records[i].wrong_cards;
+			journal_valid_len += sizeof(journalrecord_t);
+			journal_records++;
+		}
+		if ((size_t) n < sizeof(records))
+			break;
+	}
+	if (n == -1)
+		err = errno;
+
+	load_journal_end:
+	close(fd);
+	return err;
+}
+
+/*
+ * returns the saved progress of the card whose text has a hash, or NULL if there isn't any
+ */
+static journalrecord_t *find_saved_entry(uint64_t hash)
+{
+	if (saved_table == NULL)
+		return NULL;
+	for (size_t j = hash & saved_mask; saved_table[j] != UINT32_MAX; j = (j + 1) & saved_mask)
+	{
+		if (saved[saved_table[j]].hash == hash)
+			return &saved[saved_table[j]];
+	}
+	return NULL;
+}
+
+/*
+ * adds the progress of a card to saved, replacing the progress it had if it's already there, and growing saved and its hash table if they're full; the table is kept at most half full
+ *
+ * returns errno on error
+ */
+static int put_saved_entry(const journalrecord_t *rec)
+{
+	journalrecord_t *entry;
+	size_t j;
+
+	if ((entry = find_saved_entry(rec->hash)) != NULL)
+	{
+		*entry = *rec;
+		return 0;
+	}
+
+	if (saved_count == saved_size)
+	{
+		journalrecord_t *temp_saved;
+		bool *temp_used;
+		uint32_t size = MAX(saved_size * 2, 64);
+
+		if ((temp_saved = reallocarray(saved, size, sizeof(journalrecord_t))) == NULL)
+			return errno;
+		saved = temp_saved;
+		if ((temp_used = reallocarray(saved_used, size, sizeof(bool))) == NULL)
+			return errno;
+		saved_used = temp_used;
+		saved_size = size;
+	}
+
+	if (saved_table == NULL || ((size_t) saved_count + 1) * 2 > saved_mask + 1)
+	{
+		uint32_t *table;
+		size_t size = saved_table == NULL ? 64 : (saved_mask + 1) * 2;
+
+		if ((table = malloc(size * sizeof(uint32_t))) == NULL)
+			return errno;
+		memset(table, 0xFF, size * sizeof(uint32_t));
+		for (uint32_t i = 0; i < saved_count; i++)
+		{
+			for (j = saved[i].hash & (size - 1); table[j] != UINT32_MAX; j = (j + 1) & (size - 1));
+			table[j] = i;
+		}
+		free(saved_table);
+		saved_table = table;
+		saved_mask = size - 1;
+	}
+
+	for (j = rec->hash & saved_mask; saved_table[j] != UINT32_MAX; j = (j + 1) & saved_mask);
+	saved_table[j] = saved_count;
+	saved[saved_count] = *rec;
+	saved_used[saved_count++] = false;
+	return 0;
+}
+
+/*
+ * replaces saved with the entries of a snapshot, the first card_entries of which are the progress of cards in card_list and the rest the progress of cards that weren't read
+ *
+ * returns errno on error, in which case saved may be missing entries
+ */
+static int replace_saved(const snapshot_t *snap, uint32_t card_entries)
+{
+	int err;
+
+	if (saved_table != NULL)
+		memset(saved_table, 0xFF, (saved_mask + 1) * sizeof(uint32_t));
+	saved_count = 0;
+	for (uint32_t i = 0; i < snap->count; i++)
+	{
+		if ((err = put_saved_entry(&snap->entries[i])) != 0)
+			return err;
+		saved_used[find_saved_entry(snap->entries[i].hash) - saved] = i < card_entries;
+	}
+	return 0;
+}
+
+/*
+ * returns the hash of the front and back text of card i, as wide characters so it's the same in compact mode, finding it if it hasn't been found yet
+ */
+static uint64_t get_card_hash(int i)
+{
+	const wchar_t *front, *back;
+
+	if (card_hashes[i] != 0)
+		return card_hashes[i];
+
+	front = card_side_text(i, CARDSIDE_FRONT);
+	back = card_side_text(i, CARDSIDE_BACK);
+	card_hashes[i] = hash_bytes(front, wcslen(front) * sizeof(wchar_t)) * 0x9e3779b97f4a7c15ULL
+		^ hash_bytes(back, wcslen(back) * sizeof(wchar_t));
+	return card_hashes[i];
+}
+
+/*
+ * fills a record with the hash, state and schedule of card i; cards that aren't scheduled in this review keep the schedules they were saved with
+ */
+static void fill_record(journalrecord_t *rec, int i)
+{
+	const journalrecord_t *entry;
+
+	memset(rec, 0, sizeof(journalrecord_t));
+	rec->hash = get_card_hash(i);
+	rec->state = get_card_state(i);
+	if (scheduled_review)
+		rec->sched = *get_card_schedule(i);
+	else if ((entry = find_saved_entry(rec->hash)) != NULL)
+		rec->sched = entry->sched;
+	else
+		rec->sched.ease = SCHED_START_EASE;
+}
+
+/*
+ * returns the check of a record, a hash of every byte before its check
+ */
+static uint32_t check_record(const journalrecord_t *rec)
+{
+	return (uint32_t) hash_bytes(rec, offsetof(journalrecord_t, check));
+}
+
+/*
+ * starts the writer thread the first time there's something for it to write; if it can't be started, records stay queued
+ */
+static void start_writer(void)
+{
+	if (!writer_started && pthread_create(&writer_thread, NULL, journal_writer, NULL) == 0)
+		writer_started = true;
+}
+
+/*
+ * waits for records and snapshots to be queued and writes them, until close_journal is called and there's nothing left to write
+ *
+ * after the first record arrives, more are waited for until JOURNAL_COMMIT_MS has passed, so they're all written and synced at once; snapshots are written before the records queued after them
+ */
+static void *journal_writer(void *arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&journal_lock);
+	for (;;)
+	{
+		journalrecord_t *records;
+		snapshot_t *snap;
+		int count, size;
+
+		while (pending_len == 0 && pending_snapshot == NULL && !journal_closing)
+			pthread_cond_wait(&journal_cond, &journal_lock);
+		if (pending_len == 0 && pending_snapshot == NULL)
+			break;
+
+		if (!journal_closing)
+		{
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += JOURNAL_COMMIT_MS * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			while (!journal_closing && pthread_cond_timedwait(&journal_cond, &journal_lock, &deadline) != ETIMEDOUT);
+		}
+
+		// Take what's queued, leaving the other buffer to queue records in while these are written
+		snap = pending_snapshot;
+		pending_snapshot = NULL;
+		records = pending;
+		count = pending_len;
+		size = pending_size;
+		pending = writing;
+		pending_size = writing_size;
+		pending_len = 0;
+		writing = records;
+		writing_size = size;
+		pthread_mutex_unlock(&journal_lock);
+
+		if (snap != NULL)
+		{
+			write_snapshot(snap);
+			free(snap->entries);
+			free(snap);
+		}
+		if (count > 0)
+			append_records(records, count);
+
+		pthread_mutex_lock(&journal_lock);
+	}
+	pthread_mutex_unlock(&journal_lock);
+
+	if (journal_fd != -1)
+	{
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	return NULL;
+}
+
+/*
+ * writes a snapshot with the next generation to a temporary file that replaces the snapshot of the deck, so it's never left half written, then starts a new journal for it
+ *
+ * returns errno on error, in which case the old snapshot and journal are kept
+ */
+static int write_snapshot(const snapshot_t *snap)
+{
+	progressheader_t header;
+	char *temp_path, *dir_path;
+	int fd, dir_fd, err = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROGRESS_MAGIC, sizeof(PROGRESS_MAGIC));
+	header.version = JOURNAL_VERSION;
+	header.count = snap->count;
+	header.generation = journal_generation + 1;
+	header.right_cards = snap->right_cards;
+	header.wrong_cards = snap->wrong_cards;
+
+	make_parent_dirs(progress_path);
+	if (asprintf(&temp_path, "%s.%ld.tmp", progress_path, (long) getpid()) == -1)
+		return ENOMEM;
+	if ((fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		err = errno;
+		free(temp_path);
+		return err;
+	}
+
+	if ((err = write_all(fd, &header, sizeof(header))) == 0
+		&& (err = write_all(fd, snap->entries, (size_t) snap->count * sizeof(journalrecord_t))) == 0
+		&& fsync(fd) != 0)
+		err = errno;
+	if (close(fd) != 0 && err == 0)
+		err = errno;
+	if (err == 0 && rename(temp_path, progress_path) != 0)
+		err = errno;
+	if (err != 0)
+	{
+		unlink(temp_path);
+		free(temp_path);
+		return err;
+	}
+	free(temp_path);
+
+	// Sync the directory so the rename isn't lost
+	if ((dir_path = strdup(progress_path)) != NULL)
+	{
+		if ((dir_fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY)) != -1)
+		{
+			fsync(dir_fd);
+			close(dir_fd);
+		}
+		free(dir_path);
+	}
+
+	// The old journal belongs to the old snapshot, so it's started over
+	journal_generation = header.generation;
+	journal_valid_len = 0;
+	return journal_fd == -1 ? open_journal_file() : reset_journal_file();
+}
+
+/*
+ * appends records to the journal and syncs it; if they can't all be written, the journal is cut back to where it was, so it never ends in a partly written record that later records would be lost after
+ *
+ * returns errno on error
+ */
+static int append_records(const journalrecord_t *records, int count)
+{
+	int err;
+
+	if (journal_fd == -1 && (err = open_journal_file()) != 0)
+		return err;
+	if ((err = write_all(journal_fd, records, (size_t) count * sizeof(journalrecord_t))) != 0
+		|| (fdatasync(journal_fd) != 0 && (err = errno) != 0))
+	{
+		if (ftruncate(journal_fd, journal_len) != 0)
+			return errno;
+		return err;
+	}
+	journal_len += (off_t) count * sizeof(journalrecord_t);
+	return 0;
+}
+
+/*
+ * opens the journal to append records to it; if it was valid when it was replayed, the part after its last whole record is cut off, and otherwise it's started over
+ *
+ * returns errno on error
+ */
+static int open_journal_file(void)
+{
+	make_parent_dirs(journal_path);
+	if ((journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1)
+		return errno;
+	if (journal_valid_len > 0 && ftruncate(journal_fd, journal_valid_len) == 0)
+	{
+		journal_len = journal_valid_len;
+		return 0;
+	}
+	return reset_journal_file();
+}
+
+/*
+ * empties the journal and writes its header with the generation of the last snapshot
+ *
+ * returns errno on error
+ */
+static int reset_journal_file(void)
+{
+	journalheader_t header;
+	int err;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+	header.version = JOURNAL_VERSION;
+	header.generation = journal_generation;
+
+	if (ftruncate(journal_fd, 0) != 0)
+		return errno;
+	if ((err = write_all(journal_fd, &header, sizeof(header))) != 0)
+		return err;
+	if (fdatasync(journal_fd) != 0)
+		return errno;
+	journal_len = sizeof(header);
+	return 0;
+}
+
+/*
+ * reads up to n bytes from fd into buf, retrying reads that are interrupted or only partly done, until n bytes are read or the end of the file
+ *
+ * returns the number of bytes read, or -1 on error
+ */
+static ssize_t read_all(int fd, void *buf, size_t n)
+{
+	char *p = buf;
+	size_t total = 0;
+	ssize_t r;
+
+	while (total < n)
+	{
+		if ((r = read(fd, p + total, n - total)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			break;
+		total += r;
+	}
+	return total;
+}
@@ -0,0 +1,68 @@
+/*
+ * journal.h
+ *
+ * This file contains the types and functions for saving the progress of a deck in a journal
+ */
+
+#ifndef	JOURNAL_H
+#define	JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "schedule.h"
+
+// Bytes at the start of every snapshot and journal
+#define	PROGRESS_MAGIC		"SSPROG"
+#define	JOURNAL_MAGIC		"SSJRNL"
+
+// Version of the snapshot and journal formats, changed whenever the layout of either file or of journalrecord_t changes
+#define	JOURNAL_VERSION		1
+
+// Milliseconds the writer waits for more records after the first one, so they're all synced together
+#define	JOURNAL_COMMIT_MS	50
+
+// Number of records in the journal after which it's compacted into a snapshot
+#define	JOURNAL_COMPACT_RECORDS	8192
+
+// Progress of a card, found by a hash of its text; the records of the journal and the entries of a snapshot
+typedef struct journalrecord{
+	uint64_t hash;
+	cardsched_t sched;
+
+	// right_cards and wrong_cards once the card was graded; unused in snapshots
+	uint32_t right_cards;
+	uint32_t wrong_cards;
+
+	// cardstate_t of the card
+	uint32_t state;
+
+	// Check of the bytes before it, so records that were only partly written are found
+	uint32_t check;
+} journalrecord_t;
+
+// Loads the saved progress of a deck of card files and gives it to the cards read so far; returns errno on error
+int open_journal(char **filenames, int filecount, bool read_only, bool reset);
+
+// Gives the saved progress of cards to cards that were just added to the end of card_list; returns errno on error
+int restore_progress(int first, int count);
+
+// Adds the state and schedule of card i and the number of cards marked right and wrong to the journal
+void journal_card(int i);
+
+// Saves the progress of every card in a snapshot, after a change to many cards
+void journal_snapshot(void);
+
+// Keeps cards deleted because they were taken out of their card files from being saved as deleted
+void forget_removed_cards(const int *cards, int count);
+
+// Finds the hashes of cards again after the text of cards changed
+void rehash_journal_cards(void);
+
+// Writes everything left in the journal and stops its writer
+void close_journal(void);
+
+// Returns the directory progress is kept in as a malloc'd string, or NULL if there isn't one
+char *get_data_dir(void);
+
+#endif
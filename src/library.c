@@ -0,0 +1,462 @@
+/*
+ * library.c
+ *
+ * This file contains functions for libraries (--library), directory trees of card files that decks are picked from.
+ *
+ * A library keeps an index (.sslib file) of the path, size, modification time and number of cards of every card file under its directory, in the same cache directory as deck caches, named after a hash of the full path of the library. Opening a library reads the index and walks the tree with stat alone; only card files that are new or whose size or modification time changed are mapped and counted again, on worker threads. Nothing is parsed into card_list until decks are picked, when they're read with read_deck like card files given on the command line. Hidden files and directories are skipped, and symbolic links to directories aren't followed.
+ */
+
+// asprintf is a GNU extension
+#define	_GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "card.h"
+#include "cardfile.h"
+#include "deckcache.h"
+#include "library.h"
+#include "scan.h"
+
+// The estimated number of card files in a library
+#define	LIBRARY_ESTSIZE		256
+
+// Library index read when a library is opened
+typedef struct libraryindex{
+	// Mapping of the index file
+	void *map;
+	size_t map_len;
+
+	const libraryrecord_t *records;
+	uint32_t count;
+	const char *paths;
+} libraryindex_t;
+
+// Card files of a library being counted by worker threads
+typedef struct libraryscan{
+	library_t *lib;
+
+	// Indexes in lib->entries of the card files to count
+	int *todo;
+	int todocount;
+
+	// Index in todo of the next card file to count
+	atomic_int next;
+} libraryscan_t;
+
+// Maps the index of a library and checks that it's valid; returns errno on error
+static int load_library_index(const library_t *lib, libraryindex_t *index);
+
+// Returns the record of a card file in a library index, or NULL if it isn't in the index
+static const libraryrecord_t *find_index_record(const libraryindex_t *index, const char *path);
+
+// Writes the index of a library
+static void save_library_index(const library_t *lib);
+
+// Adds the card files under a directory to a library; returns errno on error
+static int walk_library_dir(library_t *lib, int fd, const char *prefix, int *size);
+
+// Adds a card file to a library; returns errno on error
+static int add_library_entry(library_t *lib, int *size, char *path, const struct stat *st);
+
+// Compares the paths of two library entries for qsort
+static int compare_entries(const void *a, const void *b);
+
+// Counts the cards of card files until there are none left; used as a worker thread
+static void *count_files_worker(void *arg);
+
+/*
+ * opens the library in a directory, finding every card file in it; the number of cards of card files that haven't changed since the index was saved is taken from the index, and the rest are counted again
+ *
+ * the index is saved again if anything changed; errors saving it aren't reported, since it's only an optimization
+ *
+ * returns errno on error, after printing it
+ */
+int open_library(library_t *lib, const char *dir)
+{
+	libraryindex_t index = {NULL, 0, NULL, 0, NULL};
+	libraryscan_t scan = {lib, NULL, 0, 0};
+	char *cache_dir;
+	int fd, size = 0, error_code;
+
+	memset(lib, 0, sizeof(library_t));
+	if ((lib->dir = realpath(dir, NULL)) == NULL || (fd = open(lib->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+	{
+		error_code = errno;
+		fprintf(stderr, "sortstudycli: \"%s\": %s\n", dir, strerror(error_code));
+		free_library(lib);
+		return error_code;
+	}
+
+	if (use_deck_cache && (cache_dir = get_cache_dir()) != NULL)
+	{
+		uint64_t key = hash_bytes(lib->dir, strlen(lib->dir) + 1);
+
+		if (asprintf(&lib->index_path, "%s/library-%016" PRIx64 ".sslib", cache_dir, key) == -1)
+			lib->index_path = NULL;
+		free(cache_dir);
+	}
+	lib->index_loaded = load_library_index(lib, &index) == 0;
+
+	if ((error_code = walk_library_dir(lib, fd, "", &size)) != 0)
+	{
+		fprintf(stderr, "sortstudycli: failed to read library: %s\n", strerror(error_code));
+		goto open_library_error;
+	}
+	qsort(lib->entries, lib->len, sizeof(libraryentry_t), compare_entries);
+
+	// Card files that are new or have changed are counted again
+	if (lib->len != 0 && (scan.todo = calloc(lib->len, sizeof(int))) == NULL)
+	{
+		error_code = errno;
+		perror("calloc");
+		goto open_library_error;
+	}
+	for (int i = 0; i < lib->len; i++)
+	{
+		libraryentry_t *entry = &lib->entries[i];
+		const libraryrecord_t *record = find_index_record(&index, entry->path);
+
+		if (record != NULL && record->size == entry->size && record->mtime_sec == entry->mtime_sec && record->mtime_nsec == entry->mtime_nsec)
+			entry->card_count = record->card_count;
+		else
+			scan.todo[scan.todocount++] = i;
+	}
+	lib->rescanned = scan.todocount;
+
+	if (scan.todocount != 0)
+	{
+		// Pick the block scanner before any worker threads use it
+		select_scanner();
+		atomic_init(&scan.next, 0);
+		run_threads(MIN(get_cpu_count(), scan.todocount), count_files_worker, &scan);
+	}
+
+	// Files that were removed also make the index out of date
+	if (scan.todocount != 0 || !lib->index_loaded || (uint32_t) lib->len != index.count)
+		save_library_index(lib);
+
+	free(scan.todo);
+	if (index.map != NULL)
+		munmap(index.map, index.map_len);
+	return 0;
+
+	open_library_error:
+	free(scan.todo);
+	if (index.map != NULL)
+		munmap(index.map, index.map_len);
+	free_library(lib);
+	return error_code;
+}
+
+/*
+ * frees a library
+ */
+void free_library(library_t *lib)
+{
+	for (int i = 0; i < lib->len; i++)
+		free(lib->entries[i].path);
+	free(lib->entries);
+	free(lib->dir);
+	free(lib->index_path);
+	memset(lib, 0, sizeof(library_t));
+}
+
+/*
+ * returns the full path of card file i in a library as a malloc'd string, or NULL if memory can't be allocated
+ */
+char *library_file_path(const library_t *lib, int i)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%s", lib->dir, lib->entries[i].path) == -1)
+		return NULL;
+	return path;
+}
+
+/*
+ * maps the index of a library and checks that every record points into its paths and that the paths are sorted, so find_index_record can search them
+ *
+ * returns errno if the index doesn't exist or can't be used, in which case every card file is counted again
+ */
+static int load_library_index(const library_t *lib, libraryindex_t *index)
+{
+	const libraryheader_t *header;
+	struct stat st;
+	size_t paths_off;
+	int fd;
+
+	if (lib->index_path == NULL)
+		return ENOENT;
+	if ((fd = open(lib->index_path, O_RDONLY | O_CLOEXEC)) == -1)
+		return errno;
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(libraryheader_t))
+	{
+		close(fd);
+		return EINVAL;
+	}
+
+	index->map_len = st.st_size;
+	if ((index->map = mmap(NULL, index->map_len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	{
+		index->map = NULL;
+		close(fd);
+		return ENOMEM;
+	}
+	close(fd);
+
+	header = index->map;
+	paths_off = sizeof(libraryheader_t) + (size_t) header->count * sizeof(libraryrecord_t);
+	if (memcmp(header->magic, LIBRARY_MAGIC, sizeof(header->magic)) != 0 || header->version != LIBRARY_VERSION
+			|| paths_off > index->map_len || index->map_len - paths_off != header->paths_len
+			|| (header->paths_len != 0 && ((const char *) index->map)[index->map_len - 1] != '\0'))
+		goto load_library_index_error;
+
+	index->records = (const libraryrecord_t *) (header + 1);
+	index->count = header->count;
+	index->paths = (const char *) index->map + paths_off;
+	for (uint32_t i = 0; i < index->count; i++)
+	{
+		if (index->records[i].path >= header->paths_len)
+			goto load_library_index_error;
+		if (i != 0 && strcmp(index->paths + index->records[i - 1].path, index->paths + index->records[i].path) >= 0)
+			goto load_library_index_error;
+	}
+	return 0;
+
+	load_library_index_error:
+	munmap(index->map, index->map_len);
+	memset(index, 0, sizeof(libraryindex_t));
+	return EINVAL;
+}
+
+/*
+ * returns the record of the card file at path in a library index with a binary search, or NULL if it isn't in the index
+ */
+static const libraryrecord_t *find_index_record(const libraryindex_t *index, const char *path)
+{
+	uint32_t low = 0, high = index->count;
+
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		int r = strcmp(path, index->paths + index->records[mid].path);
+
+		if (r == 0)
+			return &index->records[mid];
+		if (r < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return NULL;
+}
+
+/*
+ * writes the index of a library to a temporary file that's renamed over the old index, like save_deck_cache
+ */
+static void save_library_index(const library_t *lib)
+{
+	libraryheader_t header;
+	libraryrecord_t *records;
+	char *paths = NULL, *temp_path = NULL;
+	uint64_t paths_len = 0;
+	bool written;
+	int fd;
+
+	if (lib->index_path == NULL)
+		return;
+	if ((records = calloc(MAX(lib->len, 1), sizeof(libraryrecord_t))) == NULL)
+		return;
+
+	for (int i = 0; i < lib->len; i++)
+		paths_len += strlen(lib->entries[i].path) + 1;
+	if ((paths = malloc(MAX(paths_len, 1))) == NULL)
+		goto save_library_index_end;
+
+	paths_len = 0;
+	for (int i = 0; i < lib->len; i++)
+	{
+		const libraryentry_t *entry = &lib->entries[i];
+		size_t len = strlen(entry->path) + 1;
+
+		records[i].size = entry->size;
+		records[i].mtime_sec = entry->mtime_sec;
+		records[i].mtime_nsec = entry->mtime_nsec;
+		records[i].path = paths_len;
+		records[i].card_count = entry->card_count;
+		memcpy(paths + paths_len, entry->path, len);
+		paths_len += len;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LIBRARY_MAGIC, sizeof(header.magic));
+	header.version = LIBRARY_VERSION;
+	header.count = lib->len;
+	header.paths_len = paths_len;
+
+	make_parent_dirs(lib->index_path);
+	if (asprintf(&temp_path, "%s.%ld.tmp", lib->index_path, (long) getpid()) == -1)
+	{
+		temp_path = NULL;
+		goto save_library_index_end;
+	}
+	if ((fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+		goto save_library_index_end;
+
+	written = write_all(fd, &header, sizeof(header)) == 0
+		&& write_all(fd, records, (size_t) lib->len * sizeof(libraryrecord_t)) == 0
+		&& write_all(fd, paths, paths_len) == 0;
+	if (close(fd) != 0)
+		written = false;
+	if (!written || rename(temp_path, lib->index_path) != 0)
+		unlink(temp_path);
+
+	save_library_index_end:
+	free(temp_path);
+	free(paths);
+	free(records);
+}
+
+/*
+ * adds every regular file under the directory fd refers to to a library, going into subdirectories; prefix is the path of the directory relative to the library, ending in "/" unless it's the library itself
+ *
+ * fd is closed before returning. Files and subdirectories that can't be read are skipped
+ *
+ * returns errno if memory can't be allocated
+ */
+static int walk_library_dir(library_t *lib, int fd, const char *prefix, int *size)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	int error_code = 0;
+
+	if ((dir = fdopendir(fd)) == NULL)
+	{
+		close(fd);
+		return 0;
+	}
+
+	while (error_code == 0 && (de = readdir(dir)) != NULL)
+	{
+		// Hidden files are skipped, along with "." and ".."
+		if (de->d_name[0] == '.')
+			continue;
+
+		// Symbolic links are followed to files, but not to directories, so links can't make the walk go around in circles
+		if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+		if (S_ISLNK(st.st_mode) && (fstatat(fd, de->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)))
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+		{
+			int sub_fd;
+
+			if (asprintf(&path, "%s%s/", prefix, de->d_name) == -1)
+			{
+				error_code = ENOMEM;
+				break;
+			}
+			if ((sub_fd = openat(fd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1)
+				error_code = walk_library_dir(lib, sub_fd, path, size);
+			free(path);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			if (asprintf(&path, "%s%s", prefix, de->d_name) == -1)
+			{
+				error_code = ENOMEM;
+				break;
+			}
+			if ((error_code = add_library_entry(lib, size, path, &st)) != 0)
+				free(path);
+		}
+	}
+
+	closedir(dir);
+	return error_code;
+}
+
+/*
+ * adds a card file to the end of a library, taking ownership of its path; its cards are left uncounted
+ *
+ * returns errno on error
+ */
+static int add_library_entry(library_t *lib, int *size, char *path, const struct stat *st)
+{
+	libraryentry_t *entry;
+
+	if (lib->len == *size)
+	{
+		libraryentry_t *temp;
+		int new_size = *size == 0 ? LIBRARY_ESTSIZE : *size * 2;
+
+		if (*size > INT_MAX / 2)
+			return EOVERFLOW;
+		if ((temp = reallocarray(lib->entries, new_size, sizeof(libraryentry_t))) == NULL)
+			return errno;
+		lib->entries = temp;
+		*size = new_size;
+	}
+
+	entry = &lib->entries[lib->len++];
+	entry->path = path;
+	entry->size = st->st_size;
+	entry->mtime_sec = st->st_mtim.tv_sec;
+	entry->mtime_nsec = st->st_mtim.tv_nsec;
+	entry->card_count = -1;
+	return 0;
+}
+
+/*
+ * compares the paths of two library entries, so a library is sorted the same way as its index
+ */
+static int compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const libraryentry_t *) a)->path, ((const libraryentry_t *) b)->path);
+}
+
+/*
+ * maps and counts the cards of the card files of a libraryscan_t until there are none left; files that can't be read as card files are given a card count of -1
+ */
+static void *count_files_worker(void *arg)
+{
+	libraryscan_t *scan = arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&scan->next, 1)) < scan->todocount)
+	{
+		libraryentry_t *entry = &scan->lib->entries[scan->todo[i]];
+		cardfile_t file = {NULL, 0, false};
+		loaderror_t error = {0, NULL};
+		char *path;
+
+		entry->card_count = -1;
+		if ((path = library_file_path(scan->lib, scan->todo[i])) == NULL)
+			continue;
+		if (map_card_file(path, &file, &error) == 0)
+		{
+			entry->card_count = count_file_cards(&file, &error);
+			unmap_card_file(&file);
+		}
+		free(path);
+	}
+	return NULL;
+}
@@ -0,0 +1,85 @@
+/*
+ * library.h
+ *
+ * This file contains the types and functions for libraries, directory trees of card files that decks are picked from
+ */
+
+#ifndef	LIBRARY_H
+#define	LIBRARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bytes at the start of every library index
+#define	LIBRARY_MAGIC		"SSLIB\0\0"
+
+// Version of the library index format
+#define	LIBRARY_VERSION		1
+
+// Header at the start of a library index; it's followed by a libraryrecord_t for each card file and then the paths of the card files
+typedef struct libraryheader{
+	char magic[8];
+	uint32_t version;
+
+	// Number of card files
+	uint32_t count;
+
+	// Number of bytes of paths
+	uint64_t paths_len;
+} libraryheader_t;
+
+// Card file as it's stored in a library index
+typedef struct libraryrecord{
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+
+	// Offset of the null-terminated path of the card file in the paths of the index
+	uint64_t path;
+
+	// Number of cards in the file, or -1 if it couldn't be read as a card file
+	int64_t card_count;
+} libraryrecord_t;
+
+// Card file in a library
+typedef struct libraryentry{
+	// Path of the card file relative to the library directory
+	char *path;
+
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+
+	// Number of cards in the file, or -1 if it couldn't be read as a card file
+	int card_count;
+} libraryentry_t;
+
+// Library being studied from
+typedef struct library{
+	// Library directory
+	char *dir;
+
+	// Path of the index of the library, or NULL if it can't be saved
+	char *index_path;
+
+	// Card files in the library, sorted by path
+	libraryentry_t *entries;
+	int len;
+
+	// True if the index was read when the library was opened
+	bool index_loaded;
+
+	// Number of card files read again when the library was opened because they were new or had changed
+	int rescanned;
+} library_t;
+
+// Opens a library, reading its index and rescanning the files that changed since; returns errno on error
+int open_library(library_t *lib, const char *dir);
+
+// Frees a library
+void free_library(library_t *lib);
+
+// Returns the path of a card file in a library that it can be opened with as a malloc'd string, or NULL on error
+char *library_file_path(const library_t *lib, int i);
+
+#endif
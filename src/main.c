@@ -4,12 +4,16 @@
  * This file contains the main function and functions that handle command line arguments.
  */
 
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <locale.h>
+#include <unistd.h>
 #include <wchar.h>
 
 // Include ncurses with wide character support
@@ -18,7 +22,17 @@
 
 #include "main.h"
 #include "card.h"
+#include "cardindex.h"
+#include "deckcache.h"
+#include "deckstream.h"
+#include "deckwatch.h"
+#include "library.h"
+#include "picker.h"
+#include "search.h"
+#include "schedule.h"
+#include "journal.h"
 #include "review.h"
+#include "review_act.h"
 
 #define	VERSION	"1.1.0"
 
@@ -26,12 +40,50 @@
 static bool startup_shuffle = false;
 static bool startup_noborders = false;
 static bool startup_flip = false;
+static bool startup_quiz = false;
+
+// True if the deck should be read in the background while it's reviewed
+static bool progressive_load = false;
+
+// True if deck statistics should be printed instead of starting review mode
+static bool print_stats = false;
+
+// True if the saved progress of the deck should be deleted instead of loaded
+static bool reset_progress = false;
+
+// Directory given with --library, or NULL if card files were given instead
+static const char *library_dir = NULL;
+
+// Text cards have to contain to be in the first review, given with --filter, or NULL to review every card
+static const char *filter_text = NULL;
+
+// Seed for shuffling cards given with --seed, and whether one was given
+static uint64_t shuffle_seed;
+static bool seed_given = false;
 
 // Print the text output when -h is passed
 static void print_help(void);
 
-// Handle verbose options (e.g. --shuffle)
-static void handle_verbose_option(const char *str);
+// Handle verbose options (e.g. --shuffle); returns true if the argument after the option was used as its value
+static bool handle_verbose_option(const char *str, const char *value);
+
+// Print the text output when --stats is passed
+static void print_deck_stats(void);
+
+// Print the text output when --stats is passed with --library
+static void print_library_stats(const library_t *lib);
+
+// Marks the cards containing the text given with --filter for review, exiting if none do
+static void filter_deck(void);
+
+// Opens the library given with --library and lets the user pick card files from it; returns the number of card files picked
+static int pick_from_library(char ***filenames);
+
+// Initializes ncurses, reading keys from the terminal even if standard input is a card file; returns false on error
+static bool init_screen(void);
+
+// Initializes ncurses and sets it up for review mode and the deck picker, or resumes it after endwin
+static void start_screen(void);
 
 int main(int argc, char **argv)
 {
@@ -48,22 +100,21 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
-	// Read card files if there are any in argv
+	// Count the card files in argv; they're read after options are handled, since some options change how they're read
+	char **filenames = argv + 1;
 	int filecount;
 
-	if (argv[1][0] == '-')
+	// "-" is standard input, not an option
+	if (argv[1][0] == '-' && argv[1][1] != '\0')
 	{
 		// The first argument is an option, so there were no files passed
 		filecount = 0;
 	}
 	else
 	{
-		char **filenames = argv + 1;
 		filecount = 1;
-		for (int i = 2; i < argc && argv[i][0] != '-'; i++)
+		for (int i = 2; i < argc && (argv[i][0] != '-' || argv[i][1] == '\0'); i++)
 			filecount++;
-		if (read_deck(filenames, filecount) != 0)
-			exit(EXIT_FAILURE);
 	}
 	
 	// Handle options
@@ -74,7 +125,8 @@ int main(int argc, char **argv)
 			
 		if (argv[i][1] == '-')
 		{
-			handle_verbose_option(argv[i] + 2);
+			if (handle_verbose_option(argv[i] + 2, i + 1 < argc ? argv[i + 1] : NULL))
+				i++;
 			continue;
 		}
 
@@ -96,6 +148,15 @@ int main(int argc, char **argv)
 			case 'f':
 				startup_flip = true;
 				break;
+			case 'c':
+				compact_text = true;
+				break;
+			case 'm':
+				low_memory = true;
+				break;
+			case 'p':
+				progressive_load = true;
+				break;
 			case 'h':
 				print_help();
 				exit(EXIT_SUCCESS);
@@ -108,54 +169,105 @@ int main(int argc, char **argv)
 		}
 	}
 
-	// If no card files were read, exit
+	// Low-memory mode doesn't keep card text to compare
+	if (low_memory && dedupe_mode != DEDUPE_NONE)
+	{
+		fprintf(stderr, "sortstudycli: duplicate cards can't be removed in low-memory mode\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Scheduled cards are found by their text, which low-memory mode doesn't keep, and are shown whether they're marked for review or not
+	if (scheduled_review && low_memory)
+	{
+		fprintf(stderr, "sortstudycli: cards can't be scheduled in low-memory mode\n");
+		exit(EXIT_FAILURE);
+	}
+	if (scheduled_review && filter_text != NULL)
+	{
+		fprintf(stderr, "sortstudycli: --filter can't be used with --schedule\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Card files are picked from a library instead of being given
+	if (library_dir != NULL)
+	{
+		if (filecount != 0)
+		{
+			fprintf(stderr, "sortstudycli: card files can't be given with --library\n");
+			exit(EXIT_FAILURE);
+		}
+		filecount = pick_from_library(&filenames);
+	}
+
+	// If no card files were given, exit
 	if (filecount == 0)
 	{
 		fprintf(stderr, "sortstudycli: no card files provided\n");
 		exit(EXIT_FAILURE);
 	}
 
-	// Init ncurses
-	if (initscr() == NULL)
-	{
-		fprintf(stderr, "sortstudycli: failed to initialize ncurses\n");
+	// Decks read from pipes or compressed files are always read progressively, so they can be studied while they're being written or decompressed; read_deck finds the ones that aren't standard input as it maps them
+	bool streamed = !low_memory && (progressive_load || needs_deck_stream(filenames, filecount));
+
+	if (!streamed && read_deck(filenames, filecount, low_memory ? NULL : &streamed) != 0)
 		exit(EXIT_FAILURE);
+	if (streamed)
+	{
+		if (start_deck_stream(filenames, filecount) != 0)
+			exit(EXIT_FAILURE);
+	}
+	else if (!low_memory && !print_stats)
+	{
+		// Cards in card files that are changed during the review are reloaded; the review goes on without it if they can't be watched
+		watch_deck(filenames, filecount);
 	}
 
-	// Don't draw pressed keys on the screen
-	if (noecho() == ERR)
+	// Statistics are about the whole deck
+	if (print_stats && finish_deck_stream() != 0)
+		exit(EXIT_FAILURE);
+
+	// Cards read in the background later are scheduled as they're added to the review
+	if (scheduled_review && init_schedule() != 0)
 	{
-		endwin();
-		fprintf(stderr, "sortstudycli: ncurses noecho function failed\n");
+		perror("reallocarray");
 		exit(EXIT_FAILURE);
 	}
 
-	// Enable special keys for the standard screen
-	if (keypad(stdscr, true) == ERR)
+	// Saved progress is given to cards read in the background as they're added to the review; statistics only read it
+	if ((errno = open_journal(filenames, filecount, print_stats, reset_progress)) != 0)
 	{
-		endwin();
-		fprintf(stderr, "sortstudycli: ncurses keypad function failed\n");
+		perror("open_journal");
 		exit(EXIT_FAILURE);
 	}
 
-	// Hide cursor
-	if (curs_set(0) == ERR)
+	// The whole deck has to be read before it can be filtered
+	if (filter_text != NULL)
 	{
-		endwin();
-		fprintf(stderr, "sortstudycli: ncurses curs_set(0) call failed; cursor will not be hidden\n");
-		refresh();
+		if (finish_deck_stream() != 0)
+			exit(EXIT_FAILURE);
+		filter_deck();
+		journal_snapshot();
 	}
 
+	if (print_stats)
+	{
+		print_deck_stats();
+		exit(EXIT_SUCCESS);
+	}
+
+	start_screen();
+
 	// Set random seed
-	srand(time(NULL));
+	seed_shuffle(seed_given ? shuffle_seed : (uint64_t) time(NULL));
 
-	start_review_mode(startup_shuffle, startup_noborders, startup_flip);
+	start_review_mode(startup_shuffle, startup_noborders, startup_flip, startup_quiz);
 }
 
 // Calls endwin and then exits the program
 void end_program(const int exitcode)
 {
 	endwin();
+	close_journal();
 	exit(exitcode);
 }
 
@@ -165,10 +277,24 @@ static void print_help(void)
 	printf(
 	"Sort Study CLI, version %s\n"
 	"usage: sortstudycli cardfile [cardfile2 ...] [options]\n"
+	"a cardfile of \"-\" is read from standard input\n"
 	"options:\n"
 	"\t-s, --shuffle           shuffle cards at start\n"
 	"\t-b, --no-borders        disable card borders at start\n"
 	"\t-f, --flip              flip cards at start\n"
+	"\t-c, --compact           keep card text in its multibyte form to use less memory\n"
+	"\t-p, --progressive       start reviewing while the deck is still being read\n"
+	"\t-m, --low-memory        read card text from card files as it's shown\n"
+	"\t    --no-cache          don't load or save a binary cache of the deck\n"
+	"\t    --quiz              type answers to cards instead of marking them\n"
+	"\t    --schedule          show cards when they're due with spaced repetition\n"
+	"\t    --reset-progress    forget the saved progress of the deck\n"
+	"\t    --dedupe            remove duplicate cards\n"
+	"\t    --dedupe-loose      remove duplicate cards, ignoring case and whitespace\n"
+	"\t    --library DIR       pick decks from the card files under DIR\n"
+	"\t    --filter TEXT       only review cards containing TEXT at first\n"
+	"\t    --stats             print deck statistics and exit\n"
+	"\t    --seed NUMBER       seed shuffles so they're the same every time\n"
 	"\t-h, --help              display this help text\n"
 	"\t-v, --version           display version and exit\n"
 	"basic review mode controls:\n"
@@ -186,23 +312,111 @@ static void print_help(void)
  * handles verbose options (e.g. --shuffle)
  *
  * str - string option excluding the "--"
+ * value - the argument after the option, or NULL if there isn't one
+ *
+ * returns true if value was used as the value of the option
  */
-static void handle_verbose_option(const char *str)
+static bool handle_verbose_option(const char *str, const char *value)
 {
 	if (strcmp(str, "shuffle") == 0)
 	{
 		startup_shuffle = true;
-		return;
+		return false;
 	}
 	else if (strcmp(str, "no-borders") == 0)
 	{
 		startup_noborders = true;
-		return;
+		return false;
 	}
 	else if (strcmp(str, "flip") == 0)
 	{
 		startup_flip = true;
-		return;
+		return false;
+	}
+	else if (strcmp(str, "compact") == 0)
+	{
+		compact_text = true;
+		return false;
+	}
+	else if (strcmp(str, "progressive") == 0)
+	{
+		progressive_load = true;
+		return false;
+	}
+	else if (strcmp(str, "low-memory") == 0)
+	{
+		low_memory = true;
+		return false;
+	}
+	else if (strcmp(str, "no-cache") == 0)
+	{
+		use_deck_cache = false;
+		return false;
+	}
+	else if (strcmp(str, "quiz") == 0)
+	{
+		startup_quiz = true;
+		return false;
+	}
+	else if (strcmp(str, "schedule") == 0)
+	{
+		scheduled_review = true;
+		return false;
+	}
+	else if (strcmp(str, "reset-progress") == 0)
+	{
+		reset_progress = true;
+		return false;
+	}
+	else if (strcmp(str, "dedupe") == 0)
+	{
+		dedupe_mode = DEDUPE_EXACT;
+		return false;
+	}
+	else if (strcmp(str, "dedupe-loose") == 0)
+	{
+		dedupe_mode = DEDUPE_NORMALIZED;
+		return false;
+	}
+	else if (strcmp(str, "library") == 0)
+	{
+		if (value == NULL)
+		{
+			fprintf(stderr, "sortstudycli: --library needs a directory\n");
+			exit(EXIT_FAILURE);
+		}
+		library_dir = value;
+		return true;
+	}
+	else if (strcmp(str, "filter") == 0)
+	{
+		if (value == NULL)
+		{
+			fprintf(stderr, "sortstudycli: --filter needs text to search for\n");
+			exit(EXIT_FAILURE);
+		}
+		filter_text = value;
+		return true;
+	}
+	else if (strcmp(str, "stats") == 0)
+	{
+		print_stats = true;
+		return false;
+	}
+	else if (strcmp(str, "seed") == 0)
+	{
+		char *end = NULL;
+
+		errno = 0;
+		if (value != NULL && isdigit((unsigned char) value[0]))
+			shuffle_seed = strtoull(value, &end, 10);
+		if (end == NULL || *end != '\0' || errno != 0)
+		{
+			fprintf(stderr, "sortstudycli: --seed needs a number\n");
+			exit(EXIT_FAILURE);
+		}
+		seed_given = true;
+		return true;
 	}
 	else if (strcmp(str, "help") == 0)
 	{
@@ -218,3 +432,204 @@ static void handle_verbose_option(const char *str)
 	fprintf(stderr, "sortstudycli: unknown option \"--%s\"\n", str);
 	exit(EXIT_FAILURE);
 }
+
+/*
+ * marks the cards whose front or back contains the text given with --filter for review, ignoring case, and every other card as not; the program exits if no cards contain it
+ */
+static void filter_deck(void)
+{
+	wchar_t *text;
+	size_t len;
+	int count;
+
+	if ((len = mbstowcs(NULL, filter_text, 0)) == (size_t) -1)
+	{
+		fprintf(stderr, "sortstudycli: --filter text isn't valid in this locale\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((text = calloc(len + 1, sizeof(wchar_t))) == NULL)
+	{
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	mbstowcs(text, filter_text, len + 1);
+
+	if ((count = review_matching_cards(text)) == -1)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	free(text);
+	if (count == 0)
+	{
+		fprintf(stderr, "sortstudycli: no cards contain \"%s\"\n", filter_text);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * prints statistics about the deck that was read
+ */
+static void print_deck_stats(void)
+{
+	printf(
+	"cards: %d\n"
+	"card text: %zu bytes\n"
+	"interning saved: %zu bytes\n"
+	"loaded from cache: %s\n"
+	, card_list_len, card_text_len * CARD_CHAR_SIZE, intern_saved_bytes, deck_cache_loaded() ? "yes" : "no");
+	if (low_memory)
+		printf("card index: %zu bytes\n", card_index_size());
+	if (dedupe_mode != DEDUPE_NONE)
+		printf("duplicates removed: %d\n", deduped_cards);
+	if (filter_text != NULL)
+		printf("cards matching filter: %d\n", count_cards(CARDSTATE_DO_REVIEW));
+	if (scheduled_review)
+		printf("cards due: %d\n", count_due_cards(time(NULL), INT_MAX));
+}
+
+/*
+ * prints statistics about a library that was opened
+ */
+static void print_library_stats(const library_t *lib)
+{
+	int decks = 0;
+	long cards = 0;
+
+	for (int i = 0; i < lib->len; i++)
+	{
+		if (lib->entries[i].card_count > 0)
+		{
+			decks++;
+			cards += lib->entries[i].card_count;
+		}
+	}
+	printf(
+	"library files: %d\n"
+	"library decks: %d\n"
+	"library cards: %ld\n"
+	"loaded from index: %s\n"
+	"files rescanned: %d\n"
+	, lib->len, decks, cards, lib->index_loaded ? "yes" : "no", lib->rescanned);
+}
+
+/*
+ * opens the library given with --library and shows the deck picker, setting filenames to the full paths of the card files picked; with --stats, statistics about the library are printed and the program exits instead
+ *
+ * the program exits if the library can't be opened, if it has no decks, or if the user quits the picker
+ *
+ * returns the number of card files picked
+ */
+static int pick_from_library(char ***filenames)
+{
+	library_t lib;
+	int *picked, count, decks = 0;
+
+	if (open_library(&lib, library_dir) != 0)
+		exit(EXIT_FAILURE);
+
+	if (print_stats)
+	{
+		print_library_stats(&lib);
+		exit(EXIT_SUCCESS);
+	}
+
+	for (int i = 0; i < lib.len; i++)
+		if (lib.entries[i].card_count > 0)
+			decks++;
+	if (decks == 0)
+	{
+		fprintf(stderr, "sortstudycli: no card files found in library\n");
+		exit(EXIT_FAILURE);
+	}
+
+	start_screen();
+	count = pick_library_decks(&lib, &picked);
+
+	// The deck is read outside of ncurses, so errors reading it are printed normally
+	endwin();
+	if (count == 0)
+		exit(EXIT_SUCCESS);
+
+	if ((*filenames = calloc(count, sizeof(char *))) == NULL)
+	{
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < count; i++)
+	{
+		if (((*filenames)[i] = library_file_path(&lib, picked[i])) == NULL)
+		{
+			perror("asprintf");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	free(picked);
+	free_library(&lib);
+	return count;
+}
+
+/*
+ * initializes ncurses on the terminal; if standard input isn't a terminal, it's probably a card file being read, so keys are read from /dev/tty instead
+ *
+ * returns false on error
+ */
+static bool init_screen(void)
+{
+	FILE *tty;
+
+	if (isatty(STDIN_FILENO))
+		return initscr() != NULL;
+	if ((tty = fopen("/dev/tty", "r")) == NULL)
+		return false;
+	return newterm(NULL, stdout, tty) != NULL;
+}
+
+/*
+ * initializes ncurses, hides the cursor, and turns off echoing and turns on special keys for stdscr
+ *
+ * if ncurses was already started and then ended with endwin, it's resumed instead
+ */
+static void start_screen(void)
+{
+	static bool started = false;
+
+	if (started)
+	{
+		refresh();
+		return;
+	}
+	started = true;
+
+	// Init ncurses
+	if (!init_screen())
+	{
+		fprintf(stderr, "sortstudycli: failed to initialize ncurses\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Don't draw pressed keys on the screen
+	if (noecho() == ERR)
+	{
+		endwin();
+		fprintf(stderr, "sortstudycli: ncurses noecho function failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Enable special keys for the standard screen
+	if (keypad(stdscr, true) == ERR)
+	{
+		endwin();
+		fprintf(stderr, "sortstudycli: ncurses keypad function failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Hide cursor
+	if (curs_set(0) == ERR)
+	{
+		endwin();
+		fprintf(stderr, "sortstudycli: ncurses curs_set(0) call failed; cursor will not be hidden\n");
+		refresh();
+	}
+}
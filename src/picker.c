@@ -0,0 +1,299 @@
+/*
+ * picker.c
+ *
+ * This file contains the deck picker of library mode, a list of the card files of a library that decks are picked from.
+ *
+ * Only card files with at least one card are listed, using the card counts in the library index, so nothing is read until the picked files are given to read_deck. Typing "/" filters the list to paths containing the text typed after it.
+ */
+
+// strcasestr is a GNU extension
+#define	_GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+// Include ncurses with wide character support (_XOPEN_SOURCE_EXTENDED is defined by _GNU_SOURCE)
+#include <ncursesw/curses.h>
+
+#include "util.h"
+#include "library.h"
+#include "picker.h"
+
+// Text
+#define	PICKER_HELP_TEXT	"Space: select  Enter: study  /: filter  Q: quit"
+
+// Longest filter that can be typed, in bytes
+#define	FILTER_MAX		255
+
+// Longest path shown, in characters
+#define	PATH_MAX_SHOWN		1023
+
+// The escape key
+#define	ESCAPE_KEY		27
+
+// Library being picked from
+static const library_t *picker_lib;
+
+// Indexes of the card files shown, which are the ones with cards whose paths match the filter
+static int *shown;
+static int shown_len;
+
+// Card files that have been selected, by index in the library
+static bool *selected;
+static int selected_count;
+
+// Position in shown of the highlighted card file and of the first card file on the screen
+static int cursor;
+static int top;
+
+// Text paths have to contain to be shown, and whether it's being typed
+static char path_filter[FILTER_MAX + 1];
+static bool typing_filter;
+
+// Fills shown with the card files that match the filter
+static void filter_decks(void);
+
+// Draws the picker
+static void draw_picker(void);
+
+// Handles a key typed while the filter is being typed
+static void type_filter(int c);
+
+// Frees the picker and returns the card files picked
+static int finish_picker(int **picked, bool pick);
+
+/*
+ * shows the card files of a library with at least one card and lets the user pick some to study; ncurses has to be initialized
+ *
+ * if no card files are selected when Enter is pressed, the highlighted card file is picked
+ *
+ * returns the number of card files picked, setting picked to a malloc'd array of their indexes in the library in order, or 0 if the user quit or memory couldn't be allocated
+ */
+int pick_library_decks(const library_t *lib, int **picked)
+{
+	int c;
+
+	picker_lib = lib;
+	shown = malloc(MAX(lib->len, 1) * sizeof(int));
+	selected = calloc(MAX(lib->len, 1), sizeof(bool));
+	if (shown == NULL || selected == NULL)
+		return finish_picker(picked, false);
+	selected_count = 0;
+	path_filter[0] = '\0';
+	typing_filter = false;
+	filter_decks();
+
+	// Escape should end typing a filter right away
+	set_escdelay(25);
+
+	for (;;)
+	{
+		int page = MAX(getmaxy(stdscr) - 2, 1);
+
+		draw_picker();
+		c = getch();
+
+		if (typing_filter)
+		{
+			type_filter(c);
+			continue;
+		}
+
+		switch (c)
+		{
+			case 'j':
+			case 'J':
+			case KEY_DOWN:
+				cursor++;
+				break;
+			case 'k':
+			case 'K':
+			case KEY_UP:
+				cursor--;
+				break;
+			case KEY_NPAGE:
+				cursor += page;
+				break;
+			case KEY_PPAGE:
+				cursor -= page;
+				break;
+			case KEY_HOME:
+				cursor = 0;
+				break;
+			case KEY_END:
+				cursor = shown_len - 1;
+				break;
+			case ' ':
+				// Select or unselect the highlighted card file and move on to the next
+				if (shown_len == 0)
+					break;
+				selected[shown[cursor]] = !selected[shown[cursor]];
+				selected_count += selected[shown[cursor]] ? 1 : -1;
+				cursor++;
+				break;
+			case '/':
+				typing_filter = true;
+				break;
+			case '\n':
+			case '\r':
+			case KEY_ENTER:
+				if (selected_count != 0 || shown_len != 0)
+					return finish_picker(picked, true);
+				break;
+			case 'q':
+			case 'Q':
+				return finish_picker(picked, false);
+		}
+
+		// Keep the cursor on a card file and on the screen
+		if (cursor >= shown_len)
+			cursor = shown_len - 1;
+		if (cursor < 0)
+			cursor = 0;
+	}
+}
+
+/*
+ * fills shown with the card files of the library that have cards and whose paths contain the filter, ignoring case, and moves the cursor back to the top
+ */
+static void filter_decks(void)
+{
+	shown_len = 0;
+	for (int i = 0; i < picker_lib->len; i++)
+	{
+		const libraryentry_t *entry = &picker_lib->entries[i];
+
+		if (entry->card_count > 0 && (path_filter[0] == '\0' || strcasestr(entry->path, path_filter) != NULL))
+			shown[shown_len++] = i;
+	}
+	cursor = top = 0;
+}
+
+/*
+ * draws the name of the library and the number of card files shown and selected on the first line, as many card files as fit under it, and the help text or the filter being typed on the last line
+ */
+static void draw_picker(void)
+{
+	static wchar_t path[PATH_MAX_SHOWN + 1];
+	int my, mx, rows;
+
+	getmaxyx(stdscr, my, mx);
+	rows = MAX(my - 2, 1);
+
+	// Scroll so the cursor is on the screen
+	if (cursor < top)
+		top = cursor;
+	else if (cursor >= top + rows)
+		top = cursor - rows + 1;
+
+	erase();
+	attron(A_BOLD);
+	mvprintw(0, 0, "%.*s", mx, picker_lib->dir);
+	attroff(A_BOLD);
+	mvprintw(0, MAX(mx - 40, 0), "%d decks, %d selected", shown_len, selected_count);
+
+	for (int row = 0; row < rows && top + row < shown_len; row++)
+	{
+		const libraryentry_t *entry = &picker_lib->entries[shown[top + row]];
+		int count_w = get_digits(entry->card_count) + 7;
+		size_t len;
+
+		if (top + row == cursor)
+			attron(A_REVERSE);
+		mvhline(row + 1, 0, ' ', mx);
+		mvaddstr(row + 1, 0, selected[shown[top + row]] ? "[x] " : "[ ] ");
+
+		// Paths that can't be decoded are shown as they are
+		if ((len = mbstowcs(path, entry->path, PATH_MAX_SHOWN)) == (size_t) -1)
+			addnstr(entry->path, MAX(mx - count_w - 5, 0));
+		else
+		{
+			path[MIN(len, PATH_MAX_SHOWN)] = L'\0';
+			addnwstr(path, MAX(mx - count_w - 5, 0));
+		}
+		mvprintw(row + 1, MAX(mx - count_w, 0), " %d cards", entry->card_count);
+		if (top + row == cursor)
+			attroff(A_REVERSE);
+	}
+
+	if (typing_filter)
+		mvprintw(my - 1, 0, "/%.*s", MAX(mx - 1, 0), path_filter);
+	else if (path_filter[0] != '\0')
+		mvprintw(my - 1, 0, "Filter: %s  " PICKER_HELP_TEXT, path_filter);
+	else
+		mvaddstr(my - 1, 0, PICKER_HELP_TEXT);
+	refresh();
+}
+
+/*
+ * adds a key to the filter being typed; Enter stops typing, Escape clears the filter, and Backspace removes the last character
+ */
+static void type_filter(int c)
+{
+	size_t len = strlen(path_filter);
+
+	switch (c)
+	{
+		case '\n':
+		case '\r':
+		case KEY_ENTER:
+			typing_filter = false;
+			return;
+		case ESCAPE_KEY:
+			typing_filter = false;
+			path_filter[0] = '\0';
+			break;
+		case KEY_BACKSPACE:
+		case 127:
+		case '\b':
+			// Remove every byte of the last multibyte character
+			while (len > 0 && (path_filter[len - 1] & 0xc0) == 0x80)
+				len--;
+			if (len > 0)
+				len--;
+			path_filter[len] = '\0';
+			break;
+		default:
+			// Bytes of multibyte characters come one at a time
+			if (c < 0 || c > 0xff || (c < 0x80 && !isprint(c)) || len == FILTER_MAX)
+				return;
+			path_filter[len] = c;
+			path_filter[len + 1] = '\0';
+			break;
+	}
+	filter_decks();
+}
+
+/*
+ * frees the picker; if pick is true, picked is set to the indexes of the selected card files, or of the highlighted card file if none are selected
+ *
+ * returns the number of card files picked
+ */
+static int finish_picker(int **picked, bool pick)
+{
+	int count = 0;
+
+	*picked = NULL;
+	if (pick && (*picked = malloc(MAX(selected_count, 1) * sizeof(int))) != NULL)
+	{
+		if (selected_count == 0)
+			(*picked)[count++] = shown[cursor];
+		for (int i = 0; i < picker_lib->len && selected_count != 0; i++)
+			if (selected[i])
+				(*picked)[count++] = i;
+	}
+
+	// Review mode draws over stdscr once ncurses is resumed, so the picker shouldn't be left on it
+	erase();
+
+	free(shown);
+	free(selected);
+	shown = NULL;
+	selected = NULL;
+	return count;
+}
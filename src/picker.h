@@ -0,0 +1,15 @@
+/*
+ * picker.h
+ *
+ * This file contains the function for the deck picker shown by library mode
+ */
+
+#ifndef	PICKER_H
+#define	PICKER_H
+
+#include "library.h"
+
+// Shows the card files of a library and lets the user pick decks to study; returns the number of files picked and sets picked to their indexes, or returns 0 if the user quit
+int pick_library_decks(const library_t *lib, int **picked);
+
+#endif
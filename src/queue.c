@@ -0,0 +1,96 @@
+/*
+ * queue.c
+ *
+ * This file contains functions for the queues of cards shown in review mode.
+ *
+ * Each review goes through a queue of the cards being reviewed instead of searching card_list for them, and the queue of the next review is made from the cards in it that are left marked for review. Reviews late in a deck only touch the few cards left in them.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "card.h"
+#include "view.h"
+#include "queue.h"
+
+/*
+ * makes sure a queue can hold size indexes without being resized
+ *
+ * returns errno on error
+ */
+int reserve_card_queue(cardqueue_t *queue, int size)
+{
+	int *temp;
+
+	if (size <= queue->size)
+		return 0;
+	if ((temp = reallocarray(queue->cards, size, sizeof(int))) == NULL)
+		return errno;
+	queue->cards = temp;
+	queue->size = size;
+	return 0;
+}
+
+/*
+ * replaces the contents of a queue with the index of every card in a view that has a state, in the order of the view
+ *
+ * views in the order of card_list are searched through the bitmap of the state, skipping cards without it a word at a time
+ *
+ * returns errno on error
+ */
+int fill_card_queue(cardqueue_t *queue, const deckview_t *view, cardstate_t state)
+{
+	int error_code;
+
+	queue->len = 0;
+	if ((error_code = reserve_card_queue(queue, count_cards(state))) != 0)
+		return error_code;
+
+	if (view->order == NULL)
+	{
+		for (int i = next_card(state, 0); i < card_list_len; i = next_card(state, i + 1))
+			queue->cards[queue->len++] = i;
+		return 0;
+	}
+
+	for (int pos = 0; pos < view->len; pos++)
+		if (get_card_state(view->order[pos]) == state)
+			queue->cards[queue->len++] = view->order[pos];
+	return 0;
+}
+
+/*
+ * adds a card to the end of a queue; space for it must have been made with reserve_card_queue
+ */
+void push_card_queue(cardqueue_t *queue, int card)
+{
+	queue->cards[queue->len++] = card;
+}
+
+/*
+ * replaces the contents of a queue with the cards in the queue from that have a state, keeping their order
+ *
+ * returns errno on error
+ */
+int filter_card_queue(cardqueue_t *queue, const cardqueue_t *from, cardstate_t state)
+{
+	int error_code;
+
+	queue->len = 0;
+	if ((error_code = reserve_card_queue(queue, from->len)) != 0)
+		return error_code;
+	for (int i = 0; i < from->len; i++)
+		if (get_card_state(from->cards[i]) == state)
+			push_card_queue(queue, from->cards[i]);
+	return 0;
+}
+
+/*
+ * frees the indexes of a queue
+ */
+void free_card_queue(cardqueue_t *queue)
+{
+	free(queue->cards);
+	queue->cards = NULL;
+	queue->len = queue->size = 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * queue.h
+ *
+ * This file contains the card queue type and functions for the queues of cards shown in review mode
+ */
+
+#ifndef	QUEUE_H
+#define	QUEUE_H
+
+#include "card.h"
+#include "view.h"
+
+// Indexes of cards in card_list, in the order they're shown
+typedef struct cardqueue{
+	int *cards;
+
+	// Number of indexes in the queue
+	int len;
+
+	// Number of indexes the queue can hold
+	int size;
+} cardqueue_t;
+
+// Makes sure a queue can hold size indexes; returns errno on error
+int reserve_card_queue(cardqueue_t *queue, int size);
+
+// Replaces the contents of a queue with every card in a view that has a state; returns errno on error
+int fill_card_queue(cardqueue_t *queue, const deckview_t *view, cardstate_t state);
+
+// Adds a card to the end of a queue, which must have room for it
+void push_card_queue(cardqueue_t *queue, int card);
+
+// Replaces the contents of a queue with the cards in another queue that have a state; returns errno on error
+int filter_card_queue(cardqueue_t *queue, const cardqueue_t *from, cardstate_t state);
+
+// Frees the indexes of a queue
+void free_card_queue(cardqueue_t *queue);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * quiz.c
+ *
+ * This file contains the functions for grading answers typed in quiz mode.
+ *
+ * The back text of a card can hold several accepted answers separated by QUIZ_ANSWER_SEPARATOR. An answer and the accepted answers are compared in lowercase, with runs of whitespace read as one space and whitespace at their ends ignored. An answer that isn't the same as an accepted answer is still right if the edit distance between them is small enough for the length of the accepted answer.
+ *
+ * Edit distances are found with the bit-parallel algorithm of Myers ("A fast bit-vector algorithm for approximate string matching based on dynamic programming", 1999), as adapted by Hyyrö for the distance between whole strings. Each column of the dynamic programming table is kept as bit vectors of its vertical differences, 64 rows to a word, so each character of the answer takes a few word operations per 64 characters of the accepted answer instead of one step per character.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "util.h"
+#include "quiz.h"
+
+// Bit of the last row of a full block
+#define	BLOCK_HIGH_BIT		(1ULL << 63)
+
+// Normalized text of the answer and of the accepted answer being compared with it
+static wchar_t *answer_text;
+static size_t answer_size;
+static wchar_t *accepted_text;
+static size_t accepted_size;
+
+// Hash table of the characters of the accepted answer, with the bit vector of the rows each one is in for each block
+static wint_t *peq_chars;
+static uint64_t *peq_masks;
+
+// Number of slots in the table, and the number of elements its arrays can hold
+static size_t peq_size;
+static size_t peq_chars_size;
+static size_t peq_masks_size;
+
+// Vertical positive and negative differences of the column of each block
+static uint64_t *block_pv;
+static uint64_t *block_mv;
+static size_t block_count;
+
+// Copies len characters of text to a buffer in lowercase with whitespace collapsed; returns the length of the copy, or -1 on error
+static long normalize_text(const wchar_t *text, size_t len, wchar_t **buf, size_t *size);
+
+// Returns the edit distance between two strings, or -1 on error
+static long edit_distance(const wchar_t *p, size_t m, const wchar_t *t, size_t n);
+
+// Returns the slot of c in the table of the accepted answer, which is the empty slot c would go in if it isn't there
+static size_t find_peq_slot(wint_t c);
+
+// Advances the column of one block by one character of the answer; returns the difference in the score of its last row
+static int advance_block(uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high);
+
+/*
+ * grades an answer against every accepted answer in the back text of a card; empty answers and empty accepted answers are never right
+ *
+ * returns ANSWER_RIGHT if the answer is the same as an accepted answer, ANSWER_CLOSE if it's at most one edit per QUIZ_CHARS_PER_TYPO characters away from one, and ANSWER_WRONG otherwise or if memory can't be allocated
+ */
+answergrade_t grade_answer(const wchar_t *answer, const wchar_t *back)
+{
+	answergrade_t grade = ANSWER_WRONG;
+	long alen, len, distance;
+
+	if ((alen = normalize_text(answer, wcslen(answer), &answer_text, &answer_size)) <= 0)
+		return ANSWER_WRONG;
+
+	for (const wchar_t *start = back, *end;; start = end + 1)
+	{
+		if ((end = wcschr(start, QUIZ_ANSWER_SEPARATOR)) == NULL)
+			end = start + wcslen(start);
+		if ((len = normalize_text(start, end - start, &accepted_text, &accepted_size)) == -1)
+			return grade;
+
+		if (len == alen && wmemcmp(accepted_text, answer_text, len) == 0)
+			return ANSWER_RIGHT;
+
+		// Answers whose lengths are too different can't be close enough, so their distance isn't found
+		if (len > 0 && labs(len - alen) <= len / QUIZ_CHARS_PER_TYPO
+			&& (distance = edit_distance(accepted_text, len, answer_text, alen)) != -1 && distance <= len / QUIZ_CHARS_PER_TYPO)
+			grade = ANSWER_CLOSE;
+
+		if (*end == L'\0')
+			return grade;
+	}
+}
+
+/*
+ * copies len characters of text to buf in lowercase, with runs of whitespace replaced by one space and whitespace at the start and end left out, growing buf if it's too small
+ *
+ * returns the length of the copy, or -1 if memory can't be allocated
+ */
+static long normalize_text(const wchar_t *text, size_t len, wchar_t **buf, size_t *size)
+{
+	size_t n = 0;
+	bool space = false;
+
+	if (len + 1 > *size)
+	{
+		wchar_t *temp;
+
+		if ((temp = reallocarray(*buf, len + 1, sizeof(wchar_t))) == NULL)
+			return -1;
+		*buf = temp;
+		*size = len + 1;
+	}
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if (iswspace(text[i]))
+		{
+			space = n != 0;
+			continue;
+		}
+		if (space)
+			(*buf)[n++] = L' ';
+		(*buf)[n++] = towlower(text[i]);
+		space = false;
+	}
+	(*buf)[n] = L'\0';
+	return n;
+}
+
+/*
+ * returns the edit distance between the m characters of p and the n characters of t, the fewest characters that have to be inserted, deleted or replaced to turn one into the other
+ *
+ * p is split into blocks of 64 rows, and the bit vectors of the rows of each character of p are found for every block; then each character of t moves the column of every block forward, passing the difference in the score at the bottom of each block to the block under it. The first row goes up by one each column, so the top block is always given a difference of one
+ *
+ * returns -1 if memory can't be allocated
+ */
+static long edit_distance(const wchar_t *p, size_t m, const wchar_t *t, size_t n)
+{
+	size_t blocks = (m + 63) / 64, size = 16;
+	uint64_t last_high;
+	long score = m;
+
+	if (m == 0)
+		return n;
+
+	while (size < m * 2)
+		size *= 2;
+	if (size > peq_chars_size)
+	{
+		wint_t *chars;
+
+		if ((chars = reallocarray(peq_chars, size, sizeof(wint_t))) == NULL)
+			return -1;
+		peq_chars = chars;
+		peq_chars_size = size;
+	}
+	if (size * blocks > peq_masks_size)
+	{
+		uint64_t *masks;
+
+		if ((masks = reallocarray(peq_masks, size * blocks, sizeof(uint64_t))) == NULL)
+			return -1;
+		peq_masks = masks;
+		peq_masks_size = size * blocks;
+	}
+	if (blocks > block_count)
+	{
+		uint64_t *pv, *mv;
+
+		if ((pv = reallocarray(block_pv, blocks, sizeof(uint64_t))) == NULL)
+			return -1;
+		block_pv = pv;
+		if ((mv = reallocarray(block_mv, blocks, sizeof(uint64_t))) == NULL)
+			return -1;
+		block_mv = mv;
+		block_count = blocks;
+	}
+
+	peq_size = size;
+	for (size_t i = 0; i < size; i++)
+		peq_chars[i] = WEOF;
+	memset(peq_masks, 0, size * blocks * sizeof(uint64_t));
+	for (size_t i = 0; i < m; i++)
+	{
+		size_t slot = find_peq_slot(p[i]);
+
+		peq_chars[slot] = p[i];
+		peq_masks[slot * blocks + i / 64] |= 1ULL << (i % 64);
+	}
+
+	// Every cell of the first column is one more than the cell above it
+	for (size_t b = 0; b < blocks; b++)
+	{
+		block_pv[b] = ~0ULL;
+		block_mv[b] = 0;
+	}
+	last_high = 1ULL << ((m - 1) % 64);
+
+	for (size_t j = 0; j < n; j++)
+	{
+		size_t slot = find_peq_slot(t[j]);
+		const uint64_t *eq = peq_chars[slot] == WEOF ? NULL : &peq_masks[slot * blocks];
+		int h = 1;
+
+		for (size_t b = 0; b < blocks; b++)
+			h = advance_block(&block_pv[b], &block_mv[b], eq == NULL ? 0 : eq[b], h, b == blocks - 1 ? last_high : BLOCK_HIGH_BIT);
+		score += h;
+	}
+	return score;
+}
+
+/*
+ * returns the slot of c in the table of the accepted answer, or the empty slot it would go in if it isn't there; the table is at most half full, so there's always an empty slot
+ */
+static size_t find_peq_slot(wint_t c)
+{
+	size_t mask = peq_size - 1, slot;
+
+	for (slot = ((uint32_t) c * 2654435761U) & mask; peq_chars[slot] != WEOF && peq_chars[slot] != c; slot = (slot + 1) & mask);
+	return slot;
+}
+
+/*
+ * advances the column of a block by one character of the answer, where eq has the bits of the rows of the block whose character is the same, hin is the difference in the score of the row above the block, and high is the bit of the last row of the block
+ *
+ * returns the difference in the score of the last row of the block, which is passed to the block under it
+ */
+static int advance_block(uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high)
+{
+	uint64_t xv, xh, ph, mh;
+	int hout = 0;
+
+	xv = eq | *mv;
+	if (hin < 0)
+		eq |= 1;
+	xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+	ph = *mv | ~(xh | *pv);
+	mh = *pv & xh;
+
+	if (ph & high)
+		hout = 1;
+	else if (mh & high)
+		hout = -1;
+
+	ph <<= 1;
+	mh <<= 1;
+	if (hin < 0)
+		mh |= 1;
+	else if (hin > 0)
+		ph |= 1;
+
+	*pv = mh | ~(xv | ph);
+	*mv = ph & xv;
+	return hout;
+}
@@ -0,0 +1,32 @@
+/*
+ * quiz.h
+ *
+ * This file contains the types and functions for grading answers typed in quiz mode
+ */
+
+#ifndef	QUIZ_H
+#define	QUIZ_H
+
+#include <wchar.h>
+
+// Character that separates the answers accepted for a card in its back text
+#define	QUIZ_ANSWER_SEPARATOR	L';'
+
+// Answers are right if it takes at most one edit per this many characters of an accepted answer to make them the same
+#define	QUIZ_CHARS_PER_TYPO	5
+
+// Grade of a typed answer
+typedef enum answergrade{
+	ANSWER_WRONG,
+
+	// The answer is an accepted answer with a few typos
+	ANSWER_CLOSE,
+
+	// The answer is an accepted answer
+	ANSWER_RIGHT
+} answergrade_t;
+
+// Grades an answer typed for a card against the answers accepted in its back text; returns ANSWER_WRONG if memory can't be allocated
+answergrade_t grade_answer(const wchar_t *answer, const wchar_t *back);
+
+#endif
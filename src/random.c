@@ -0,0 +1,69 @@
+/*
+ * random.c
+ *
+ * This file contains the random number generator used for shuffling cards.
+ *
+ * Numbers are generated with xoshiro256** by David Blackman and Sebastiano Vigna, which is much faster than rand() and gives 64 good bits at a time. Generators are seeded with splitmix64, so any 64-bit seed (including 0) gives a usable state.
+ */
+
+#include <stdint.h>
+
+#include "random.h"
+
+// Rotates x left by k bits
+#define	ROTL(x, k)	((x) << (k) | (x) >> (64 - (k)))
+
+/*
+ * seeds a generator by running splitmix64 on seed to fill its state
+ */
+void seed_rng(rng_t *rng, uint64_t seed)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		rng->s[i] = z ^ (z >> 31);
+	}
+}
+
+/*
+ * returns the next 64 random bits of a generator
+ */
+uint64_t next_rng(rng_t *rng)
+{
+	uint64_t *s = rng->s;
+	uint64_t result = ROTL(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = ROTL(s[3], 45);
+	return result;
+}
+
+/*
+ * returns a random number from 0 to n - 1 with no bias, using Daniel Lemire's multiply and shift method instead of a division
+ */
+uint64_t rng_below(rng_t *rng, uint64_t n)
+{
+	unsigned __int128 m = (unsigned __int128) next_rng(rng) * n;
+	uint64_t low = (uint64_t) m;
+
+	if (low < n)
+	{
+		// Numbers below this would make some results more likely than others
+		uint64_t threshold = -n % n;
+
+		while (low < threshold)
+		{
+			m = (unsigned __int128) next_rng(rng) * n;
+			low = (uint64_t) m;
+		}
+	}
+	return m >> 64;
+}
@@ -0,0 +1,26 @@
+/*
+ * random.h
+ *
+ * This file contains the random number generator type and functions used for shuffling cards
+ */
+
+#ifndef	RANDOM_H
+#define	RANDOM_H
+
+#include <stdint.h>
+
+// State of a xoshiro256** random number generator
+typedef struct rng{
+	uint64_t s[4];
+} rng_t;
+
+// Seeds a generator; generators with the same seed give the same numbers
+void seed_rng(rng_t *rng, uint64_t seed);
+
+// Returns the next 64 random bits of a generator
+uint64_t next_rng(rng_t *rng);
+
+// Returns a random number from 0 to n - 1
+uint64_t rng_below(rng_t *rng, uint64_t n);
+
+#endif
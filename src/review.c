@@ -7,24 +7,67 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <wchar.h>
+#include <wctype.h>
 
 // Include ncurses with wide character support
 #define	_XOPEN_SOURCE_EXTENDED
 #include <ncursesw/curses.h>
 
 #include "main.h"
+#include "util.h"
 #include "card.h"
+#include "view.h"
+#include "queue.h"
+#include "fenwick.h"
+#include "deckstream.h"
+#include "deckwatch.h"
+#include "search.h"
+#include "quiz.h"
+#include "schedule.h"
+#include "journal.h"
 #include "review_ui.h"
 #include "review_act.h"
 #include "review.h"
 
 // Text
-#define	REVIEW_FINISH_TEXT	L"Review Complete!\n  Press N to start the next review\n  Press S to shuffle the cards\n  Press F to flip the cards\n  Press D to delete all cards you've just marked as correct"
+#define	REVIEW_FINISH_TEXT	L"Review Complete!\n  Press N to start the next review\n  Press S to shuffle the cards\n  Press O to put the cards back in their original order\n  Press F to flip the cards\n  Press D to delete all cards you've just marked as correct"
 #define	SMALL_WIN_TEXT		"This window is too small to run sort study"
 
+// Number of cards skipped by the jump keys when no count is typed
+#define	REVIEW_SKIP_CARDS	1000
+
+// Largest count that can be typed before a jump key
+#define	MAX_JUMP_COUNT		999999999
+
+// Milliseconds to wait for a key before adding cards that have been read in the background
+#define	STREAM_POLL_MS		100
+
+// Milliseconds to wait for a key before checking if the card files of the deck have changed
+#define	WATCH_POLL_MS		250
+
+// Most milliseconds to wait for a key at once while waiting for a card to be due
+#define	DUE_POLL_MS		60000
+
+// Longest text that can be searched for, in characters
+#define	SEARCH_MAX_LEN		200
+
+// Shortest text whose cards are counted as it's typed, in characters; shorter text has no trigram to look up in the search index, so every card would be checked on each key
+#define	SEARCH_COUNT_LEN	3
+
+// Longest answer that can be typed in quiz mode, in characters
+#define	ANSWER_MAX_LEN		200
+
+// Milliseconds to wait after the escape key for the rest of a key sequence
+#define	ESCAPE_DELAY_MS		25
+
+// The escape key
+#define	ESCAPE_KEY		27
+
 // Minimum screen dimensions
 #define	MIN_SCREEN_H		18
 #define	MIN_SCREEN_W		35
@@ -37,12 +80,6 @@
 // No. of cards marked right or wrong
 int right_cards, wrong_cards;
 
-// Index of current card being read
-int cardpos;
-
-// Number of cards in the current review
-int numcards;
-
 // True if the review covers all cards
 bool is_full_review = true;
 
@@ -52,13 +89,96 @@ bool review_finished = false;
 // Text containing last action made by the user to display in the info window
 char lastaction[23];
 
-// Sets numcards based on the amount of cards with the CARDSTATE_DO_REVIEW state
-static void set_numcards(void);
+// Cards shown in the current review, and the cards shown in the next review once it's made
+static cardqueue_t review_queue;
+static cardqueue_t next_queue;
+
+// Position in review_queue of the card being reviewed, or -1 if no card is
+static int review_slot = -1;
+
+// Index of the cards in review_queue that haven't been deleted, used to number them and to jump between them
+static fenwick_t review_index;
+
+// Position in review_queue of each card in card_list, which is only right if review_queue has the card there, since entries aren't cleared when the queue changes; -1 for cards that were never in it
+static int *card_slots;
+static int card_slots_size;
+
+// True if answers are typed and graded instead of the back of each card being shown
+static bool quiz_mode = false;
+
+// Result of a key pressed at a prompt
+typedef enum promptkey{
+	// The key did nothing
+	PROMPT_IGNORED,
+
+	// The text typed was changed
+	PROMPT_EDITED,
+
+	// The screen was resized, so the prompt has to be redrawn
+	PROMPT_RESIZED,
+
+	PROMPT_ENTER,
+	PROMPT_ESCAPE
+} promptkey_t;
+
+// Fills review_queue with the cards that have the CARDSTATE_DO_REVIEW state
+static void fill_review_queue(void);
+
+// Sets up review_index for the cards in review_queue
+static void index_review_queue(void);
+
+// Records the positions of the cards in review_queue from a position to its end in card_slots
+static void record_card_slots(int first_slot);
+
+// Returns the position of a card in review_queue, or -1 if it isn't in it
+static int find_card_slot(int card);
+
+// Moves review_slot to the card numbered pos in the review
+static void jump_to_card(int pos);
+
+// Waits for a key, adding cards that have been read in the background while it waits; returns ERR if cards were added instead
+static int get_key(void);
+
+// Waits for a key like get_key, but returns ERR once the time wake comes if it isn't 0
+static int get_key_until(int64_t wake);
+
+// Shows cards as they're due in a spaced repetition schedule until the program ends
+static void run_scheduled_review(void);
+
+// Shows the screen shown when no cards are due, with the time card i is due
+static void show_wait_screen(int i);
+
+// Adds cards that have been read in the background to the deck and the current review
+static void add_streamed_cards(void);
+
+// Reloads the card files of the deck that have changed, updating the current review; returns true if any cards changed
+static bool reload_deck(void);
+
+// Adds cards that were just added to the end of card_list to the end of deck_view and the current review
+static void add_new_cards(int first, int count);
+
+// Lets the user search for cards; returns true if the cards found were marked for review
+static bool search_prompt(void);
+
+// Lets the user type an answer to the card being reviewed; returns true and sets grade if one was typed
+static bool answer_prompt(answergrade_t *grade);
+
+// Shows the back of card i after its answer was graded, letting the user change the grade; returns false if the card was deleted meanwhile
+static bool check_answer(int i, answergrade_t *grade);
+
+// Waits for a key at a prompt, editing the len characters of text typed so far
+static promptkey_t read_prompt_key(wchar_t *text, int *len, int max_len);
+
+// Redraws card i after card text may have moved
+static void redraw_card(int i);
+
+// Ends the program after a function fails to allocate memory
+static void exit_with_error(const char *func);
 
 // Toggles the drawing of borders of cards
 static void toggle_borders(void);
 
-void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startup_flip)
+void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startup_flip, bool startup_quiz)
 {
 	// Perform startup actions
 	if (startup_shuffle)
@@ -69,6 +189,8 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 	
 	if (startup_flip)
 		flip_cards();
+
+	quiz_mode = startup_quiz;
 	
 	// Check if the screen is too small
 	{
@@ -84,28 +206,44 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 		exit(EXIT_FAILURE);
 	}
 
-	numcards = card_list_len;
+	fill_review_queue();
+
+	if (scheduled_review)
+		run_scheduled_review();
+
+	// The deck may have been filtered at startup
+	is_full_review = get_numcards() == card_list_len - deleted_cards;
+
+	// Count typed before a jump key
+	int jump_count = 0;
 
-	// Keeps track of whether or not the user has marked all cards right
-	bool all_cards_right;
+	// True if lastaction was set for the review about to start, so it isn't replaced; the first review shows how many duplicate cards were removed from the deck
+	bool keep_lastaction = deduped_cards != 0;
+
+	if (keep_lastaction)
+		snprintf(lastaction, sizeof(lastaction), "Dupes removed: %d", deduped_cards);
 
 	// Review loop
 	for (;;)
 	{
 		next_review:
-		all_cards_right = true;
-		strncpy(lastaction, "New review started", 19);
-		cardpos = 0;
-		for (int i = 0; i < card_list_len; i++)
+		if (!keep_lastaction)
+			strncpy(lastaction, "New review started", 19);
+		keep_lastaction = false;
+
+		// Number of deleted cards before this review, to know if the order of the deck needs to be compacted after it
+		int deleted_before = deleted_cards;
+
+		// Only display cards that have been marked for review
+		review_slot = fenwick_find(&review_index, 1);
+		while (review_slot < review_queue.len)
 		{
-			// Don't display cards that haven't been marked for review
-			if (card_list[i]->state != CARDSTATE_DO_REVIEW)
-				continue;
-	
+			int i = review_queue.cards[review_slot];
+			int c;
+
 			// Update global variables used for drawing
-			cardpos++;
-			fronttext = card_list[i]->front;
-			backtext = card_list[i]->back;
+			fronttext = view_card_text(&deck_view, i, CARDSIDE_FRONT);
+			backtext = view_card_text(&deck_view, i, CARDSIDE_BACK);
 
 			// Hide the back of the card when a new card is shown
 			showback = false;
@@ -124,8 +262,48 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 			// Display misc info
 			REDRAW_INFOWIN();
 
+			// In quiz mode, the answer is typed before the back of the card is shown; if typing is cancelled, the card is reviewed with the usual keys
+			answergrade_t grade;
+
+			if (quiz_mode && answer_prompt(&grade))
+			{
+				if (check_answer(i, &grade))
+				{
+					set_card_state(i, grade == ANSWER_WRONG ? CARDSTATE_DO_REVIEW : CARDSTATE_DONT_REVIEW);
+					journal_card(i);
+				}
+				jump_count = 0;
+				review_slot = fenwick_find(&review_index, fenwick_rank(&review_index, review_slot + 1) + 1);
+				continue;
+			}
+
 			get_input:
-			switch (tolower(wgetch(frontwin)))
+			if ((c = get_key()) == ERR)
+			{
+				// The card was taken out of its card file, so move on to the next card
+				if (get_card_state(i) == CARDSTATE_TO_DELETE)
+				{
+					review_slot = fenwick_find(&review_index, fenwick_rank(&review_index, review_slot + 1) + 1);
+					continue;
+				}
+
+				// Cards were added or changed, and card text may have moved
+				redraw_card(i);
+				goto get_input;
+			}
+			c = tolower(c);
+
+			// Digits are typed to give a count to a jump key
+			if (isdigit(c))
+			{
+				if (jump_count <= MAX_JUMP_COUNT / 10)
+					jump_count = jump_count * 10 + c - '0';
+				snprintf(lastaction, sizeof(lastaction), "Count: %d", jump_count);
+				REDRAW_INFOWIN();
+				goto get_input;
+			}
+
+			switch (c)
 			{
 				case 'j':
 					// Toggle back of card visibility
@@ -137,52 +315,57 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 					goto get_input;
 				case 'k':
 					// Mark card as wrong
-					card_list[i]->state = CARDSTATE_DO_REVIEW;
-					all_cards_right = false;
+					set_card_state(i, CARDSTATE_DO_REVIEW);
 					wrong_cards++;
 					strncpy(lastaction, "Marked card wrong", 18);
 					break;
 				case 'l':
 					// Mark card as right
-					card_list[i]->state = CARDSTATE_DONT_REVIEW;
+					set_card_state(i, CARDSTATE_DONT_REVIEW);
 					right_cards++;
 					strncpy(lastaction, "Marked card right", 18);
 					break;
 				case 'd':
 					// Delete card
-					if (card_list_len == 1)
+					if (card_list_len - deleted_cards == 1)
 					{
 						strncpy(lastaction, "Can't delete last card", 23);
 						REDRAW_INFOWIN();
 						goto get_input;
 					}
 
-					card_list[i]->state = CARDSTATE_TO_DELETE;
-					if (delete_marked_cards() == 0)
-					{
-						// Delete successful, decrement cardpos to not skip over the next card
-						strncpy(lastaction, "Deleted card", 13);
-
-						// Update global variables for drawing
-						numcards--;
-
-						cardpos--;
-
-						// Decrement i so the next card isn't skipped over
-						i--;
-					}
-					else
-					{
-						// Delete unsuccessful
-						strncpy(lastaction, "Delete error", 13);
-						card_list[i]->state = CARDSTATE_DO_REVIEW;
-						REDRAW_INFOWIN();
-						goto get_input;
-					}
+					// The card is left in card_list as a tombstone, and removed from the review so it isn't counted or jumped to
+					delete_card(i);
+					fenwick_remove(&review_index, review_slot);
+					strncpy(lastaction, "Deleted card", 13);
 					break;
+				case 'g':
+					// Go to the card numbered by the count, or the first card
+					jump_to_card(jump_count == 0 ? 1 : jump_count);
+					jump_count = 0;
+					continue;
+				case '>':
+					// Skip ahead by the count, or by REVIEW_SKIP_CARDS
+					jump_to_card(get_cardpos() + (jump_count == 0 ? REVIEW_SKIP_CARDS : jump_count));
+					jump_count = 0;
+					continue;
+				case '<':
+					// Skip back by the count, or by REVIEW_SKIP_CARDS
+					jump_to_card(get_cardpos() - (jump_count == 0 ? REVIEW_SKIP_CARDS : jump_count));
+					jump_count = 0;
+					continue;
 				case 'b':
 					toggle_borders();
 					goto get_input;
+				case '/':
+					// Start a new review of the cards found, or go back to this card
+					jump_count = 0;
+					if (search_prompt())
+					{
+						keep_lastaction = true;
+						goto next_review;
+					}
+					goto get_input;
 				case KEY_RESIZE:
 					resize_window();
 					goto get_input;
@@ -191,20 +374,43 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 				default:
 					goto get_input;
 			}
+
+			// Save the card that was just marked or deleted
+			journal_card(i);
+
+			// Move on to the next card left in the review
+			jump_count = 0;
+			review_slot = fenwick_find(&review_index, fenwick_rank(&review_index, review_slot + 1) + 1);
 		}
 
-		// If the user marked all cards as right this review, review every card again
-		if (all_cards_right)
-			for (int i = 0; i < card_list_len; i++)
-				card_list[i]->state = CARDSTATE_DO_REVIEW;
+		// The next review has the cards of this review that are still marked for review, which are the ones marked wrong or skipped over
+		if (filter_card_queue(&next_queue, &review_queue, CARDSTATE_DO_REVIEW) != 0)
+			exit_with_error("reallocarray");
+
+		// Drop the cards deleted this review from the order of the deck
+		if (deleted_cards != deleted_before)
+			compact_view(&deck_view);
+
+		// If the user marked all cards as right this review, review every card again; otherwise review the cards marked wrong
+		if (next_queue.len == 0)
+		{
+			change_card_states(CARDSTATE_DONT_REVIEW, CARDSTATE_DO_REVIEW);
+			fill_review_queue();
+			journal_snapshot();
+		}
+		else
+		{
+			cardqueue_t temp = review_queue;
+			review_queue = next_queue;
+			next_queue = temp;
+			index_review_queue();
+		}
 
 		// Update global variables for drawing
-		cardpos = 0;
 		showback = false;
 		review_finished = true;
 		fronttext = REVIEW_FINISH_TEXT;
-		set_numcards();
-		is_full_review = numcards == card_list_len;
+		is_full_review = get_numcards() == card_list_len - deleted_cards;
 
 		// Show review finished screen
 		REDRAW_INFOWIN();
@@ -216,14 +422,14 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 
 		for (;;)
 		{
-			switch (tolower(wgetch(frontwin)))
+			switch (tolower(get_key()))
 			{
 				case 'n':
 					review_finished = false;
 					goto next_review;
 				case 'f':
 					flip_cards();
-					if (cards_flipped)
+					if (deck_view.flipped)
 						strncpy(lastaction, "Flipped cards", 14);
 					else
 						strncpy(lastaction, "Unflipped cards", 16);
@@ -231,18 +437,35 @@ void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startu
 					break;
 				case 's':
 					if (shuffle_cards() == 0)
+					{
 						strncpy(lastaction, "Shuffled cards", 15);
+						fill_review_queue();
+					}
 					else
 						strncpy(lastaction, "Shuffle calloc error", 21);
 					REDRAW_INFOWIN();
 					break;
+				case 'o':
+					unshuffle_cards();
+					strncpy(lastaction, "Unshuffled cards", 17);
+					fill_review_queue();
+					REDRAW_INFOWIN();
+					break;
 				case 'd':
-					if (delete_correct_cards() == 0)
-						strncpy(lastaction, "Deleted correct cards", 22);
-					else
-						strncpy(lastaction, "Deletion error", 15);
+					delete_correct_cards();
+					strncpy(lastaction, "Deleted correct cards", 22);
+					fill_review_queue();
+					journal_snapshot();
 					REDRAW_INFOWIN();
 					break;
+				case '/':
+					if (search_prompt())
+					{
+						review_finished = false;
+						keep_lastaction = true;
+						goto next_review;
+					}
+					break;
 				case 'q':
 					end_program(EXIT_SUCCESS);
 				case 'b':
@@ -302,14 +525,628 @@ void prevent_small_screen(int my, int mx)
 }
 
 /*
- * set numcards (the total number of cards being reviewed) to the amount of CARDSTATE_DO_REVIEW values in review_list (declared in card.c)
+ * returns the number of the card being reviewed among the cards left in the review, or 0 if no card is
+ */
+int get_cardpos(void)
+{
+	if (review_slot < 0 || review_slot >= review_queue.len)
+		return 0;
+	return fenwick_rank(&review_index, review_slot + 1);
+}
+
+/*
+ * returns the number of cards left in the review, or in the next review if a review has just finished; in a scheduled review, it's the number of cards due, counting at most one more than MAX_INFO_CARDS
+ */
+int get_numcards(void)
+{
+	if (scheduled_review)
+		return count_due_cards(time(NULL), MAX_INFO_CARDS + 1);
+	return review_index.total;
+}
+
+/*
+ * fills review_queue with the cards in the CARDSTATE_DO_REVIEW bitmap (declared in card.c) in the order of deck_view and indexes them
+ *
+ * this has to be done whenever the order of deck_view changes outside of a review
+ */
+static void fill_review_queue(void)
+{
+	if (fill_card_queue(&review_queue, &deck_view, CARDSTATE_DO_REVIEW) != 0)
+		exit_with_error("reallocarray");
+	index_review_queue();
+}
+
+/*
+ * sets up review_index so that every card in review_queue counts as left in the review
+ */
+static void index_review_queue(void)
+{
+	if (init_fenwick(&review_index, review_queue.len) != 0)
+		exit_with_error("reallocarray");
+	record_card_slots(0);
+	review_slot = -1;
+}
+
+/*
+ * records the position of every card in review_queue from first_slot to its end in card_slots, growing it to hold every card in card_list
+ */
+static void record_card_slots(int first_slot)
+{
+	if (card_list_len > card_slots_size)
+	{
+		int *temp;
+		int size = MAX(card_list_len, card_slots_size * 2);
+
+		if ((temp = reallocarray(card_slots, size, sizeof(int))) == NULL)
+			exit_with_error("reallocarray");
+		for (int i = card_slots_size; i < size; i++)
+			temp[i] = -1;
+		card_slots = temp;
+		card_slots_size = size;
+	}
+	for (int slot = first_slot; slot < review_queue.len; slot++)
+		card_slots[review_queue.cards[slot]] = slot;
+}
+
+/*
+ * returns the position of card in review_queue, or -1 if it isn't in it; each card is in review_queue at most once, so the position recorded for it is right if review_queue has it there
+ */
+static int find_card_slot(int card)
+{
+	int slot;
+
+	if (card >= card_slots_size || (slot = card_slots[card]) == -1)
+		return -1;
+	return slot < review_queue.len && review_queue.cards[slot] == card ? slot : -1;
+}
+
+/*
+ * moves review_slot to the card numbered pos among the cards left in the review, keeping pos between the first and last card
+ */
+static void jump_to_card(int pos)
+{
+	if (pos > review_index.total)
+		pos = review_index.total;
+	if (pos < 1)
+		pos = 1;
+	review_slot = fenwick_find(&review_index, pos);
+	snprintf(lastaction, sizeof(lastaction), "At card %d", pos);
+}
+
+/*
+ * waits for a key to be pressed in frontwin and returns it
+ *
+ * while the deck is still being read, the wait times out every STREAM_POLL_MS milliseconds to add the cards read so far, and while its card files are watched, every WATCH_POLL_MS milliseconds to reload the ones that changed; ERR is returned if any cards were added or changed, so the caller can update whatever refers to card text
+ */
+static int get_key(void)
+{
+	return get_key_until(0);
+}
+
+/*
+ * waits for a key like get_key, but if wake isn't 0, ERR is also returned once the time wake comes, in seconds since the epoch
+ */
+static int get_key_until(int64_t wake)
+{
+	int c;
+
+	for (;;)
+	{
+		int timeout = deck_stream_active() ? STREAM_POLL_MS : deck_watched() ? WATCH_POLL_MS : -1;
+
+		if (wake != 0)
+		{
+			int64_t left = wake - time(NULL);
+
+			if (left <= 0)
+				return ERR;
+			if (timeout == -1 || left * 1000 < timeout)
+				timeout = MIN(left * 1000, DUE_POLL_MS);
+		}
+
+		wtimeout(frontwin, timeout);
+		if ((c = wgetch(frontwin)) != ERR || (!deck_stream_active() && !deck_watched()))
+		{
+			if (c == ERR && wake != 0)
+				continue;
+			return c;
+		}
+
+		int first = card_list_len;
+		if (deck_stream_active())
+			add_streamed_cards();
+		if (reload_deck() || card_list_len != first)
+			return ERR;
+	}
+}
+
+/*
+ * adds the cards read in the background since the last call to the deck, to the end of deck_view and to the end of the current review, and redraws the info window to show the new number of cards
+ */
+static void add_streamed_cards(void)
+{
+	int first = card_list_len;
+	int count = absorb_streamed_cards();
+
+	if (count == -1)
+	{
+		count = card_list_len - first;
+		strncpy(lastaction, "Error reading cards", 20);
+	}
+
+	if (count > 0)
+		add_new_cards(first, count);
+
+	if (count != 0 || !deck_stream_active())
+	{
+		REDRAW_INFOWIN();
+	}
+}
+
+/*
+ * reloads the card files of the deck that have changed since the last call; cards added to them are added to the end of deck_view and the current review, and cards taken out of them are taken out of the current review, then the info window is redrawn
+ *
+ * returns true if any cards were added, changed or deleted
+ */
+static bool reload_deck(void)
+{
+	deckreload_t reload;
+	int files;
+
+	if ((files = reload_changed_files(&reload)) == -1)
+		exit_with_error("realloc");
+	if (files == 0 && reload.error_file == NULL)
+		return false;
+
+	if (reload.added > 0)
+		add_new_cards(reload.first_added, reload.added);
+
+	// The text of cards changed, so it has to be indexed and hashed again
+	if (reload.changed != 0)
+	{
+		invalidate_search_index();
+		rehash_journal_cards();
+	}
+
+	// Cards taken out of their card files aren't saved as deleted, so they're back if they're put back
+	forget_removed_cards(reload.deleted, reload.deleted_len);
+
+	// Deleted cards are taken out of the schedule, whether or not they're due
+	if (scheduled_review)
+	{
+		for (int j = 0; j < reload.deleted_len; j++)
+			unschedule_card(reload.deleted[j]);
+	}
+
+	// Take the deleted cards that are still left in the review out of it, so a reload costs time in the number of cards deleted instead of the length of the review
+	for (int j = 0; j < reload.deleted_len; j++)
+	{
+		int slot = find_card_slot(reload.deleted[j]);
+
+		if (slot != -1 && fenwick_rank(&review_index, slot + 1) != fenwick_rank(&review_index, slot))
+			fenwick_remove(&review_index, slot);
+	}
+
+	if (reload.error_file != NULL)
+		strncpy(lastaction, "Error reloading deck", 21);
+	else
+		snprintf(lastaction, sizeof(lastaction), "Reloaded %d file%s", files, files == 1 ? "" : "s");
+	REDRAW_INFOWIN();
+	return reload.added != 0 || reload.changed != 0 || reload.deleted_len != 0;
+}
+
+/*
+ * shows a prompt in the back card window for text to search for; the number of cards containing the text is shown as it's typed, once it's at least SEARCH_COUNT_LEN characters long. Enter marks the cards found for review and every other card as not, and Escape goes back
+ *
+ * returns true if cards were marked for review, after filling review_queue with them; the review being shown should then be left for a new one
+ */
+static bool search_prompt(void)
+{
+	static wchar_t query[SEARCH_MAX_LEN + 1];
+	static wchar_t text[SEARCH_MAX_LEN + 128];
+	int len = 0, count = 0;
+
+	// True if count is the number of cards containing the text typed
+	bool counted = false;
+
+	query[0] = L'\0';
+	set_escdelay(ESCAPE_DELAY_MS);
+	wtimeout(frontwin, -1);
+
+	for (;;)
+	{
+		// Draw the prompt over the back of the card
+		if (len == 0)
+			swprintf(text, sizeof(text) / sizeof(wchar_t), L"/\n\nType text to search for\nEnter: review cards found  Esc: cancel");
+		else if (!counted)
+			swprintf(text, sizeof(text) / sizeof(wchar_t), L"/%ls\n\nType %d or more characters to count cards\nEnter: review cards found  Esc: cancel", query, SEARCH_COUNT_LEN);
+		else
+			swprintf(text, sizeof(text) / sizeof(wchar_t), L"/%ls\n\n%d card%s found\nEnter: review cards found  Esc: cancel", query, count, count == 1 ? "" : "s");
+		werase(backwin);
+		draw_card_win(backwin, text);
+		wrefresh(backwin);
+
+		switch (read_prompt_key(query, &len, SEARCH_MAX_LEN))
+		{
+			case PROMPT_ENTER:
+				if (len == 0 || (counted && count == 0))
+					continue;
+
+				// Text too short to be counted is only searched for once Enter is pressed
+				if ((count = review_matching_cards(query)) == -1)
+					exit_with_error("malloc");
+				counted = true;
+				if (count == 0)
+					continue;
+				fill_review_queue();
+				journal_snapshot();
+				is_full_review = get_numcards() == card_list_len - deleted_cards;
+				snprintf(lastaction, sizeof(lastaction), "Found %d card%s", count, count == 1 ? "" : "s");
+				return true;
+			case PROMPT_ESCAPE:
+				// Put the back of the card back the way it was
+				wclear(backwin);
+				if (showback)
+					DRAW_BACKWIN();
+				wrefresh(backwin);
+				return false;
+			case PROMPT_EDITED:
+				break;
+			default:
+				continue;
+		}
+
+		// Count the cards containing the text typed so far
+		const int *matches;
+
+		if ((counted = len >= SEARCH_COUNT_LEN) && (count = search_cards(query, &matches)) == -1)
+			exit_with_error("malloc");
+	}
+}
+
+/*
+ * shows a prompt in the back card window for an answer to the card being reviewed, which is graded against the back of the card when Enter is pressed; Escape goes back without an answer
+ *
+ * returns true and sets grade if an answer was typed
+ */
+static bool answer_prompt(answergrade_t *grade)
+{
+	static wchar_t answer[ANSWER_MAX_LEN + 1];
+	static wchar_t text[ANSWER_MAX_LEN + 128];
+	int len = 0;
+
+	answer[0] = L'\0';
+	set_escdelay(ESCAPE_DELAY_MS);
+	wtimeout(frontwin, -1);
+
+	for (;;)
+	{
+		// Draw the prompt in place of the back of the card
+		swprintf(text, sizeof(text) / sizeof(wchar_t), L"Answer: %ls\n\nEnter: check answer  Esc: show card", answer);
+		werase(backwin);
+		draw_card_win(backwin, text);
+		wrefresh(backwin);
+
+		switch (read_prompt_key(answer, &len, ANSWER_MAX_LEN))
+		{
+			case PROMPT_ENTER:
+				if (len == 0)
+					continue;
+				*grade = grade_answer(answer, backtext);
+				return true;
+			case PROMPT_ESCAPE:
+				wclear(backwin);
+				wrefresh(backwin);
+				return false;
+			default:
+				continue;
+		}
+	}
+}
+
+/*
+ * waits for a key at a prompt; printable characters are added to the len characters of text typed so far, up to max_len of them, and backspace takes the last one away
+ *
+ * returns what the key did
+ */
+static promptkey_t read_prompt_key(wchar_t *text, int *len, int max_len)
+{
+	wint_t c;
+	int type;
+
+	if ((type = wget_wch(frontwin, &c)) == ERR)
+		return PROMPT_IGNORED;
+
+	if (type == KEY_CODE_YES && c == KEY_RESIZE)
+	{
+		resize_window();
+		return PROMPT_RESIZED;
+	}
+	else if ((type == KEY_CODE_YES && c == KEY_ENTER) || (type == OK && (c == L'\n' || c == L'\r')))
+		return PROMPT_ENTER;
+	else if (type == OK && c == ESCAPE_KEY)
+		return PROMPT_ESCAPE;
+	else if ((type == KEY_CODE_YES && c == KEY_BACKSPACE) || (type == OK && (c == 127 || c == L'\b')))
+	{
+		if (*len == 0)
+			return PROMPT_IGNORED;
+		text[--*len] = L'\0';
+		return PROMPT_EDITED;
+	}
+	else if (type == OK && iswprint(c) && *len < max_len)
+	{
+		text[(*len)++] = c;
+		text[*len] = L'\0';
+		return PROMPT_EDITED;
+	}
+	return PROMPT_IGNORED;
+}
+
+/*
+ * shows the back of card i after its answer was graded, with the grade in the info window, and waits for a key so the back can be read; K marks the card wrong and L marks it right if the answer was graded wrongly, and any other key goes on. right_cards and wrong_cards are counted for the final grade
+ *
+ * returns false if the card was deleted while it was shown, in which case it shouldn't be graded
+ */
+static bool check_answer(int i, answergrade_t *grade)
+{
+	int c;
+
+	if (*grade == ANSWER_WRONG)
+	{
+		wrong_cards++;
+		strncpy(lastaction, "Wrong answer", 13);
+	}
+	else
+	{
+		right_cards++;
+		if (*grade == ANSWER_RIGHT)
+			strncpy(lastaction, "Right answer", 13);
+		else
+			strncpy(lastaction, "Right, with typos", 18);
+	}
+
+	showback = true;
+	wclear(backwin);
+	DRAW_BACKWIN();
+	wrefresh(backwin);
+	REDRAW_INFOWIN();
+
+	for (;;)
+	{
+		if ((c = get_key()) == ERR)
+		{
+			if (get_card_state(i) == CARDSTATE_TO_DELETE)
+				return false;
+			redraw_card(i);
+			continue;
+		}
+		c = tolower(c);
+
+		if (c == 'k' && *grade != ANSWER_WRONG)
+		{
+			right_cards--;
+			wrong_cards++;
+			*grade = ANSWER_WRONG;
+			strncpy(lastaction, "Marked card wrong", 18);
+			REDRAW_INFOWIN();
+		}
+		else if (c == 'l' && *grade == ANSWER_WRONG)
+		{
+			wrong_cards--;
+			right_cards++;
+			*grade = ANSWER_RIGHT;
+			strncpy(lastaction, "Marked card right", 18);
+			REDRAW_INFOWIN();
+		}
+		else if (c == KEY_RESIZE)
+			resize_window();
+		else if (c == 'q')
+			end_program(EXIT_SUCCESS);
+		else
+			return true;
+	}
+}
+
+/*
+ * shows the cards of the deck in the order they're due in their spaced repetition schedule (schedule.h), forever, instead of in reviews; each card answered is scheduled again from its answer
+ *
+ * once no cards are due, a screen with the time the next card is due is shown until it's due or the user studies it early
+ */
+static void run_scheduled_review(void)
+{
+	answergrade_t grade;
+
+	// True if the next card is shown even if it isn't due yet
+	bool ahead = false;
+
+	strncpy(lastaction, "Spaced review started", 22);
+	for (;;)
+	{
+		int i = next_due_card();
+		int c;
+
+		if (i == -1 || (!ahead && get_card_due(i) > time(NULL)))
+		{
+			show_wait_screen(i);
+			switch (tolower(get_key_until(i == -1 ? 0 : get_card_due(i))))
+			{
+				case 'n':
+					ahead = i != -1;
+					break;
+				case 'b':
+					toggle_borders();
+					break;
+				case KEY_RESIZE:
+					resize_window();
+					break;
+				case 'q':
+					end_program(EXIT_SUCCESS);
+			}
+			continue;
+		}
+		ahead = false;
+
+		fronttext = view_card_text(&deck_view, i, CARDSIDE_FRONT);
+		backtext = view_card_text(&deck_view, i, CARDSIDE_BACK);
+		showback = false;
+		review_finished = false;
+
+		wclear(backwin);
+		wrefresh(backwin);
+		wclear(frontwin);
+		DRAW_FRONTWIN();
+		wrefresh(frontwin);
+		REDRAW_INFOWIN();
+
+		if (quiz_mode && answer_prompt(&grade))
+		{
+			if (check_answer(i, &grade))
+			{
+				reschedule_card(i, grade == ANSWER_WRONG ? SCHED_AGAIN : grade == ANSWER_CLOSE ? SCHED_HARD : SCHED_GOOD, time(NULL));
+				journal_card(i);
+			}
+			continue;
+		}
+
+		// Wait for the card to be answered
+		for (bool answered = false; !answered;)
+		{
+			if ((c = get_key()) == ERR)
+			{
+				// The card was taken out of its card file, so move on to the next card
+				if (get_card_state(i) == CARDSTATE_TO_DELETE)
+					break;
+				redraw_card(i);
+				continue;
+			}
+
+			switch (tolower(c))
+			{
+				case 'j':
+					if ((showback = showback ? false : true) == true)
+						DRAW_BACKWIN();
+					else
+						wclear(backwin);
+					wrefresh(backwin);
+					break;
+				case 'k':
+					reschedule_card(i, SCHED_AGAIN, time(NULL));
+					wrong_cards++;
+					strncpy(lastaction, "Marked card wrong", 18);
+					journal_card(i);
+					answered = true;
+					break;
+				case 'l':
+					reschedule_card(i, SCHED_GOOD, time(NULL));
+					right_cards++;
+					strncpy(lastaction, "Marked card right", 18);
+					journal_card(i);
+					answered = true;
+					break;
+				case 'd':
+					if (card_list_len - deleted_cards == 1)
+					{
+						strncpy(lastaction, "Can't delete last card", 23);
+						REDRAW_INFOWIN();
+						break;
+					}
+					delete_card(i);
+					unschedule_card(i);
+					strncpy(lastaction, "Deleted card", 13);
+					journal_card(i);
+					answered = true;
+					break;
+				case 'b':
+					toggle_borders();
+					break;
+				case KEY_RESIZE:
+					resize_window();
+					break;
+				case 'q':
+					end_program(EXIT_SUCCESS);
+			}
+		}
+	}
+}
+
+/*
+ * shows the screen shown when no cards are due in a scheduled review, with how long it is until card i is due, or without it if i is -1
+ */
+static void show_wait_screen(int i)
+{
+	static wchar_t text[160];
+	int64_t wait = i == -1 ? 0 : get_card_due(i) - time(NULL);
+
+	// The wait is rounded up to the largest unit it's at least one of
+	int64_t unit = wait < 3600 ? 60 : wait < SCHED_DAY ? 3600 : SCHED_DAY;
+	int count = (wait + unit - 1) / unit;
+
+	if (i == -1)
+		swprintf(text, sizeof(text) / sizeof(wchar_t), L"No cards are due\n  Press Q to quit");
+	else
+		swprintf(text, sizeof(text) / sizeof(wchar_t), L"No cards are due\n  The next card is due in %d %s%s\n  Press N to study it now\n  Press Q to quit",
+			count, unit == 60 ? "minute" : unit == 3600 ? "hour" : "day", count == 1 ? "" : "s");
+
+	fronttext = text;
+	showback = false;
+	review_finished = true;
+	REDRAW_INFOWIN();
+	wclear(frontwin);
+	DRAW_FRONTWIN();
+	wrefresh(frontwin);
+	wclear(backwin);
+	wrefresh(backwin);
+}
+
+/*
+ * adds count cards added to the end of card_list, starting at first, to the end of deck_view, gives them their saved progress, and adds the ones still marked for review to the end of the current review
+ */
+static void add_new_cards(int first, int count)
+{
+	int first_slot = review_queue.len;
+
+	if (extend_view(&deck_view, first, count) != 0
+		|| reserve_card_queue(&review_queue, review_queue.len + count) != 0
+		|| (scheduled_review && extend_schedule(first, count) != 0)
+		|| restore_progress(first, count) != 0)
+		exit_with_error("reallocarray");
+	for (int i = first; i < first + count; i++)
+	{
+		if (get_card_state(i) == CARDSTATE_DO_REVIEW)
+			push_card_queue(&review_queue, i);
+	}
+	if (grow_fenwick(&review_index, review_queue.len) != 0)
+		exit_with_error("reallocarray");
+	record_card_slots(first_slot);
+}
+
+/*
+ * updates fronttext and backtext for card i, whose text may have moved after cards were added or changed, and redraws the card
+ */
+static void redraw_card(int i)
+{
+	fronttext = view_card_text(&deck_view, i, CARDSIDE_FRONT);
+	backtext = view_card_text(&deck_view, i, CARDSIDE_BACK);
+	wclear(frontwin);
+	DRAW_FRONTWIN();
+	wrefresh(frontwin);
+	if (showback)
+	{
+		wclear(backwin);
+		DRAW_BACKWIN();
+		wrefresh(backwin);
+	}
+}
+
+/*
+ * ends ncurses and the program after func fails to allocate memory, writing what's left in the journal first like end_program; the error is printed before the journal is closed so errno isn't changed
  */
-static void set_numcards(void)
+static void exit_with_error(const char *func)
 {
-	numcards = 0;
-	for (int i = 0; i < card_list_len; i++)
-		if (card_list[i]->state == CARDSTATE_DO_REVIEW)
-			numcards++;
+	endwin();
+	perror(func);
+	close_journal();
+	exit(EXIT_FAILURE);
 }
 
 /*
@@ -16,12 +16,6 @@
 // Counters for cards marked right and wrong
 extern int right_cards, wrong_cards;
 
-// The index of card_list being reviewed
-extern int cardpos;
-
-// The total number of cards being reviewed
-extern int numcards;
-
 // Text containing the last action performed by the user
 extern char lastaction[23];
 
@@ -32,7 +26,13 @@ extern bool is_full_review;
 extern bool review_finished;
 
 // Starts review mode
-void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startup_flip);
+void start_review_mode(bool startup_shuffle, bool startup_noborders, bool startup_flip, bool startup_quiz);
+
+// Returns the number of the card being reviewed among the cards left in the review
+int get_cardpos(void);
+
+// Returns the total number of cards being reviewed
+int get_numcards(void);
 
 // Checks if the screen's resolution is below the minimum allowed, and pauses the program's execution if so
 void prevent_small_screen(int my, int mx);
@@ -3,115 +3,211 @@
  *
  * This file contains functions for manipulating cards in review mode through special user actions.
  *
- * These include flipping and shuffling cards.
+ * These include flipping and shuffling cards. Both only change deck_view, so card_list is left as it was read.
  */
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <wchar.h>
 
+#include "util.h"
 #include "card.h"
+#include "random.h"
+#include "view.h"
 #include "review_act.h"
 
-bool cards_flipped = false;
+// Decks with at least this many cards are shuffled by several threads
+#define	SHUFFLE_PARALLEL_MIN	(1 << 21)
+
+// Number of cards in each block shuffled by itself before blocks are merged
+#define	SHUFFLE_BLOCK_SIZE	(1 << 20)
+
+// Swaps two card indexes of an order array; needs an int named temp
+#define	SWAP_INDEXES(order, i, j)	temp = (order)[i];\
+					(order)[i] = (order)[j];\
+					(order)[j] = temp
+
+// Pass of a parallel shuffle, shared by its worker threads
+typedef struct shufflejob{
+	// Seed the generators of every range are made from
+	uint64_t seed;
+
+	// Number of the pass; the first pass shuffles blocks and later passes merge the halves of ranges
+	int pass;
+
+	// Number of cards in each range of the pass and the number of ranges
+	size_t range_size;
+	int count;
+
+	// Index of the next range to shuffle or merge
+	atomic_int next;
+} shufflejob_t;
+
+// Generator used for shuffling cards and whether it has been seeded yet
+static rng_t shuffle_rng;
+static bool shuffle_seeded = false;
+
+// Shuffles or merges ranges of a pass of a parallel shuffle until there are none left; used as a worker thread
+static void *shuffle_worker(void *arg);
+
+// Shuffles the cards in order from start up to end
+static void shuffle_range(rng_t *rng, int *order, int start, int end);
+
+// Merges the shuffled cards in order from start up to mid with the shuffled cards from mid up to end
+static void merge_ranges(rng_t *rng, int *order, int start, int mid, int end);
 
 /*
- * swaps the back text of cards with the front text
+ * swaps the back text of cards with the front text by flipping deck_view
  */
 void flip_cards(void)
 {
-	wchar_t *temp;
-	for (int i = 0; i < card_list_len; i++)
-	{
-		temp = card_list[i]->front;
-		card_list[i]->front = card_list[i]->back;
-		card_list[i]->back = temp;
-	}
-	cards_flipped = cards_flipped ? false : true;
+	deck_view.flipped = deck_view.flipped ? false : true;
 }
 
 /*
- * shuffles the order of cards while preserving what cards need to be reviewed
+ * seeds the random number generator used by shuffle_cards, so the same seed gives the same shuffles
+ */
+void seed_shuffle(uint64_t seed)
+{
+	seed_rng(&shuffle_rng, seed);
+	shuffle_seeded = true;
+}
+
+/*
+ * shuffles the order of cards in deck_view with an in-place Fisher-Yates shuffle of its card indexes; card states belong to the cards in card_list, so what cards need to be reviewed is preserved
+ *
+ * decks with at least SHUFFLE_PARALLEL_MIN cards are shuffled by several threads with MergeShuffle (by Axel Bacher, Olivier Bodini, Alexandros Hollender and Jérémie Lumbroso): blocks of SHUFFLE_BLOCK_SIZE cards are shuffled separately, then pairs of neighboring shuffled ranges are merged in passes until one range is left. The blocks and the seeds of their generators don't depend on the number of threads, so a seed gives the same shuffle on every computer
  *
  * returns errno on error, but doesn't print errors like read_deck
  */
 int shuffle_cards(void)
 {
-	// Create an array with shuffled indexes pointed to by new_indexes
-	int *new_indexes, *old_indexes, index;
+	shufflejob_t job;
+	int error_code;
 
-	if ((new_indexes = calloc(card_list_len, sizeof(int))) == NULL)
-		return errno;
-	if ((old_indexes = calloc(card_list_len, sizeof(int))) == NULL)
-	{
-		free(new_indexes);
-		return errno;
-	}
+	if (!shuffle_seeded)
+		seed_shuffle(time(NULL));
 
-	for (int i = 0; i < card_list_len; i++)
-		old_indexes[i] = i;
+	if ((error_code = order_view(&deck_view)) != 0)
+		return error_code;
 
-	for (int i = 0; i < card_list_len; i++)
+	if (deck_view.len < SHUFFLE_PARALLEL_MIN)
 	{
-		// Randomly pick a value in old_indexes other than -1
-		index = rand() % card_list_len;
-		while (old_indexes[index] == -1)
-			if (++index == card_list_len)
-				index = 0;
-
-		// Set new_indexes's next element to the value found before
-		new_indexes[i] = old_indexes[index];
-
-		// Set the value found before to -1 so it isn't picked again
-		old_indexes[index] = -1;
+		shuffle_range(&shuffle_rng, deck_view.order, 0, deck_view.len);
+		return 0;
 	}
 
-	card_t **temp_card_list;
-	if ((temp_card_list = calloc(card_list_len, sizeof(card_t *))) == NULL)
+	job.seed = next_rng(&shuffle_rng);
+	job.pass = 0;
+	for (job.range_size = SHUFFLE_BLOCK_SIZE;; job.range_size *= 2)
 	{
-		free(old_indexes);
-		free(new_indexes);
-		return errno;
+		job.count = (deck_view.len + job.range_size - 1) / job.range_size;
+		atomic_init(&job.next, 0);
+		run_threads(MIN(get_cpu_count(), job.count), shuffle_worker, &job);
+		if (job.count == 1)
+			break;
+		job.pass++;
 	}
-
-	/*
-	 * Change the order of cards in card_list by placing cards at their corresponding index in new_indexes
-	 *
-	 * (e.g. card at index 0 is placed at the index of value 0 in new_indexes)
-	 */
-	for (int i = 0; i < card_list_len; i++)
-		temp_card_list[i] = card_list[new_indexes[i]];
-	for (int i = 0; i < card_list_len; i++)
-		card_list[i] = temp_card_list[i];
-
-	// Free mem and return success
-	free(temp_card_list);
-	free(new_indexes);
-	free(old_indexes);
 	return 0;
 }
 
+/*
+ * puts the cards back in the order they were read in
+ */
+void unshuffle_cards(void)
+{
+	reset_view(&deck_view);
+}
+
 /*
  * deletes all cards that have the state CARDSTATE_DONT_REVIEW
  */
-int delete_correct_cards(void)
+void delete_correct_cards(void)
 {
 	// Set cards with CARDSTATE_DONT_REVIEW to CARDSTATE_TO_DELETE
-	for (int i = 0; i < card_list_len; i++)
-		if (card_list[i]->state == CARDSTATE_DONT_REVIEW)
-			card_list[i]->state = CARDSTATE_TO_DELETE;
-	
-	int error_code = delete_marked_cards();
-	if (error_code == 0)
+	change_card_states(CARDSTATE_DONT_REVIEW, CARDSTATE_TO_DELETE);
+	deleted_cards = count_cards(CARDSTATE_TO_DELETE);
+	compact_view(&deck_view);
+}
+
+/*
+ * shuffles or merges the ranges of a pass of a parallel shuffle until there are none left
+ *
+ * every range gets its own generator, seeded from the seed of the shuffle and the number of the pass and range
+ */
+static void *shuffle_worker(void *arg)
+{
+	shufflejob_t *job = arg;
+	int range;
+	rng_t rng;
+
+	while ((range = atomic_fetch_add(&job->next, 1)) < job->count)
 	{
-		// Success
-		return 0;
+		size_t start = range * job->range_size;
+		size_t end = MIN(start + job->range_size, (size_t) deck_view.len);
+
+		seed_rng(&rng, job->seed ^ ((uint64_t) job->pass << 32 | range));
+		if (job->pass == 0)
+			shuffle_range(&rng, deck_view.order, start, end);
+		else if (start + job->range_size / 2 < end)
+			merge_ranges(&rng, deck_view.order, start, start + job->range_size / 2, end);
 	}
+	return NULL;
+}
 
-	// Deleting has failed by this point, revert card states
-	for (int i = 0; i < card_list_len; i++)
-		if (card_list[i]->state == CARDSTATE_TO_DELETE)
-			card_list[i]->state = CARDSTATE_DONT_REVIEW;
-	return error_code;
+/*
+ * shuffles the cards in order from start up to end with a Fisher-Yates shuffle
+ */
+static void shuffle_range(rng_t *rng, int *order, int start, int end)
+{
+	int j, temp;
+
+	for (int i = end - 1; i > start; i--)
+	{
+		j = start + rng_below(rng, i - start + 1);
+		SWAP_INDEXES(order, i, j);
+	}
+}
+
+/*
+ * merges two neighboring ranges of shuffled cards into one shuffled range
+ *
+ * a random bit picks whether each position takes the next card of the first or the second range, until one runs out; the cards left over are then put at random positions like in a Fisher-Yates shuffle
+ */
+static void merge_ranges(rng_t *rng, int *order, int start, int mid, int end)
+{
+	int i = start, j = mid, k, temp;
+	uint64_t bits = 0;
+	int bits_left = 0;
+
+	for (;; i++)
+	{
+		if (bits_left == 0)
+		{
+			bits = next_rng(rng);
+			bits_left = 64;
+		}
+		bits_left--;
+
+		if (bits & 1)
+		{
+			if (j == end)
+				break;
+			SWAP_INDEXES(order, i, j);
+			j++;
+		}
+		else if (i == j)
+			break;
+		bits >>= 1;
+	}
+
+	for (; i < end; i++)
+	{
+		k = start + rng_below(rng, i - start + 1);
+		SWAP_INDEXES(order, i, k);
+	}
 }
@@ -7,16 +7,22 @@
 #ifndef	REVIEW_ACT_H
 #define	REVIEW_ACT_H
 
-// True if the deck of cards has been flipped
-extern bool cards_flipped;
+#include <stdbool.h>
+#include <stdint.h>
 
 // Swap front and back text of cards in card_list
 void flip_cards(void);
 
+// Seeds the random number generator used to shuffle cards
+void seed_shuffle(uint64_t seed);
+
 // Shuffle cards in card_list
 int shuffle_cards(void);
 
+// Puts cards in card_list back in the order they were read in
+void unshuffle_cards(void);
+
 // Deletes all cards that have the state CARDSTATE_DONT_REVIEW
-int delete_correct_cards(void);
+void delete_correct_cards(void);
 
 #endif
@@ -17,6 +17,7 @@
 #include "util.h"
 #include "review_ui.h"
 #include "review.h"
+#include "schedule.h"
 
 // The width of the info window
 #define INFO_WIN_H		3
@@ -24,6 +25,9 @@
 // The minimum x position of centered info text
 #define	MIN_INFO_CENTER_X	14
 
+// Text shown in place of the review type in a scheduled review
+#define	SCHEDULED_REVIEW_TEXT	"Spaced Review"
+
 // The distance between the edges of the screen and the horizontal sides of the card windows
 #define CARD_WIN_PADDING	2
 
@@ -83,9 +87,14 @@ int init_windows(void)
 
 void draw_infowin(void)
 {
-	// Print cardpos/numcards
+	int cardpos = get_cardpos();
+	int numcards = get_numcards();
+
+	// Print cardpos/numcards, or the number of cards due in a scheduled review
 	wmove(infowin, 0, 0);
-	if (cardpos > MAX_INFO_CARDS)
+	if (scheduled_review)
+		waddstr(infowin, "Due: ");
+	else if (cardpos > MAX_INFO_CARDS)
 		waddstr(infowin, "Card " STR(MAX_INFO_CARDS) "+/");
 	else
 		wprintw(infowin, "Card %d/", cardpos);
@@ -117,6 +126,10 @@ void draw_infowin(void)
 	else
 		review_chars += 10;
 
+	// Scheduled reviews don't have a type, since they go on until the program ends
+	if (scheduled_review)
+		review_chars = strlen(SCHEDULED_REVIEW_TEXT);
+
 	// Text-positioning variables
 
 	// Width of the screen
@@ -134,13 +147,18 @@ void draw_infowin(void)
 
 	// Printing review type
 	wmove(infowin, 0, midx - (review_chars / 2));
-	if (review_finished)
-		waddstr(infowin, "Next: ");
-	if (is_full_review)
-		waddstr(infowin, "Full Review ");
+	if (scheduled_review)
+		waddstr(infowin, SCHEDULED_REVIEW_TEXT);
 	else
-		waddstr(infowin, "Reviewing ");
-	wprintw(infowin, "%d cards", numcards);
+	{
+		if (review_finished)
+			waddstr(infowin, "Next: ");
+		if (is_full_review)
+			waddstr(infowin, "Full Review ");
+		else
+			waddstr(infowin, "Reviewing ");
+		wprintw(infowin, "%d cards", numcards);
+	}
 
 	// Printing lastaction
 	wmove(infowin, 2, midx - (last_chars / 2));
@@ -0,0 +1,173 @@
+/*
+ * scan.c
+ *
+ * This file contains the structural scanner used to find newlines, comments, and escapes in card files.
+ *
+ * Buffers are scanned 64 bytes at a time into a bitmask of structural characters, so the parser only stops at bytes it needs to handle. Blocks are scanned with AVX2 when the CPU supports it, SSE2 on other x86-64 CPUs, and a scalar loop everywhere else; all three give the same masks.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef	__SSE2__
+#define	SCAN_X86
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+// Returns the structural character mask of a 64 byte block
+typedef uint64_t (*scan_block_fn)(const char *p);
+
+// Block scanner picked by select_scanner
+static scan_block_fn scan_block = NULL;
+
+// Scans a block one byte at a time
+static uint64_t scan_block_scalar(const char *p);
+
+#ifdef	SCAN_X86
+// Scans a block 16 bytes at a time
+static uint64_t scan_block_sse2(const char *p);
+
+// Scans a block 32 bytes at a time
+static uint64_t scan_block_avx2(const char *p);
+#endif
+
+// Loads the mask of the block starting at offset block
+static uint64_t load_block(const scanner_t *s, size_t block);
+
+/*
+ * picks the fastest block scanner supported by the CPU
+ *
+ * setting the environment variable SORTSTUDYCLI_SCANNER to "scalar" or "sse2" forces a slower scanner
+ */
+void select_scanner(void)
+{
+	const char *name = getenv("SORTSTUDYCLI_SCANNER");
+
+	scan_block = scan_block_scalar;
+	if (name != NULL && strcmp(name, "scalar") == 0)
+		return;
+
+#ifdef	SCAN_X86
+	scan_block = scan_block_sse2;
+	if (name != NULL && strcmp(name, "sse2") == 0)
+		return;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan_block = scan_block_avx2;
+#endif
+}
+
+/*
+ * starts scanning len bytes of data
+ */
+void scan_init(scanner_t *s, const char *data, size_t len)
+{
+	if (scan_block == NULL)
+		select_scanner();
+
+	s->data = data;
+	s->len = len;
+	s->block = 0;
+	s->mask = len == 0 ? 0 : load_block(s, 0);
+}
+
+/*
+ * moves the scanner forward to pos; structural characters before pos are skipped
+ */
+void scan_seek(scanner_t *s, size_t pos)
+{
+	size_t block = pos & ~((size_t) SCAN_BLOCK_SIZE - 1);
+
+	if (block != s->block)
+	{
+		s->block = block;
+		s->mask = block < s->len ? load_block(s, block) : 0;
+	}
+	s->mask &= ~(uint64_t) 0 << (pos % SCAN_BLOCK_SIZE);
+}
+
+/*
+ * returns the offset of the next structural character, or the length of the buffer if there are none left
+ */
+size_t scan_next(scanner_t *s)
+{
+	size_t pos;
+
+	while (s->mask == 0)
+	{
+		s->block += SCAN_BLOCK_SIZE;
+		if (s->block >= s->len)
+			return s->len;
+		s->mask = load_block(s, s->block);
+	}
+
+	pos = s->block + __builtin_ctzll(s->mask);
+	s->mask &= s->mask - 1;
+	return pos;
+}
+
+/*
+ * loads the mask of the block starting at offset block; the last block of the buffer is copied into zeroed memory so the block scanners never read past the end
+ */
+static uint64_t load_block(const scanner_t *s, size_t block)
+{
+	char tail[SCAN_BLOCK_SIZE];
+
+	if (s->len - block >= SCAN_BLOCK_SIZE)
+		return scan_block(s->data + block);
+
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, s->data + block, s->len - block);
+	return scan_block(tail);
+}
+
+static uint64_t scan_block_scalar(const char *p)
+{
+	uint64_t mask = 0;
+
+	for (int i = 0; i < SCAN_BLOCK_SIZE; i++)
+		if (p[i] == '\n' || p[i] == '#' || p[i] == '\\')
+			mask |= (uint64_t) 1 << i;
+	return mask;
+}
+
+#ifdef	SCAN_X86
+static uint64_t scan_block_sse2(const char *p)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i hash = _mm_set1_epi8('#');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	uint64_t mask = 0;
+
+	for (int i = 0; i < SCAN_BLOCK_SIZE / 16; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + i * 16));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, hash)), _mm_cmpeq_epi8(v, backslash));
+		mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(m) << (i * 16);
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t scan_block_avx2(const char *p)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i hash = _mm256_set1_epi8('#');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	uint64_t mask = 0;
+
+	for (int i = 0; i < SCAN_BLOCK_SIZE / 32; i++)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + i * 32));
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, newline), _mm256_cmpeq_epi8(v, hash)), _mm256_cmpeq_epi8(v, backslash));
+		mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(m) << (i * 32);
+	}
+	return mask;
+}
+#endif
@@ -0,0 +1,40 @@
+/*
+ * scan.h
+ *
+ * This file contains the structural scanner used to find newlines, comments, and escapes in card files
+ */
+
+#ifndef	SCAN_H
+#define	SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of bytes scanned at a time
+#define	SCAN_BLOCK_SIZE		64
+
+// Iterator over the structural characters ('\n', '#' and '\\') of a buffer
+typedef struct scanner{
+	const char *data;
+	size_t len;
+
+	// Offset of the block being scanned
+	size_t block;
+
+	// Bits set for structural characters in the block that haven't been returned yet
+	uint64_t mask;
+} scanner_t;
+
+// Picks the fastest block scanner supported by the CPU
+void select_scanner(void);
+
+// Starts scanning a buffer
+void scan_init(scanner_t *s, const char *data, size_t len);
+
+// Moves the scanner to pos so the next structural character returned is at or after pos
+void scan_seek(scanner_t *s, size_t pos);
+
+// Returns the offset of the next structural character, or len if there are none left
+size_t scan_next(scanner_t *s);
+
+#endif
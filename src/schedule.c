@@ -0,0 +1,294 @@
+/*
+ * schedule.c
+ *
+ * This file contains the spaced repetition schedule of cards.
+ *
+ * Every card has an ease, an interval and a time it's due, which are changed with the SM-2 algorithm each time it's answered: right answers multiply the interval by the ease, and wrong answers start the card over, showing it again after SCHED_RELEARN_SECS. Cards are kept in a binary min-heap ordered by the time they're due, with the position of each card in the heap, so the card due soonest is always at the top and a card can be moved or taken out of the heap in O(log n) after it's answered or deleted. Cards that have never been reviewed are due at time 0, so they come before every reviewed card, in the order they were read.
+ *
+ * Schedules are saved with the rest of the progress of the deck by its journal (journal.h), which gives cards their saved schedules with set_card_schedule as they're read.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "card.h"
+#include "schedule.h"
+
+bool scheduled_review = false;
+
+// Schedule of each card in card_list, and the number of cards it has room for
+static cardsched_t *schedules;
+static int schedules_size;
+
+// Binary min-heap of the cards that haven't been deleted, ordered by the time they're due
+static int *heap;
+static int heap_len;
+
+// Position of each card in heap, or -1 if it isn't in the heap
+static int *heap_pos;
+
+// Returns true if card a is due before card b
+static bool due_before(int a, int b);
+
+// Puts card i at a position in heap
+static void place_card(int pos, int i);
+
+// Moves the card at a position in heap up until it's due after the card above it
+static void sift_up(int pos);
+
+// Moves the card at a position in heap down until it's due before the cards under it
+static void sift_down(int pos);
+
+// Counts the cards due at now in the part of heap under a position, counting at most limit of them
+static int count_due_under(int pos, int64_t now, int limit);
+
+/*
+ * schedules every card in card_list as a card that has never been reviewed
+ *
+ * returns errno on error
+ */
+int init_schedule(void)
+{
+	return extend_schedule(0, card_list_len);
+}
+
+/*
+ * schedules count cards added to the end of card_list, starting at first, as cards that have never been reviewed
+ *
+ * returns errno on error
+ */
+int extend_schedule(int first, int count)
+{
+	int old_len = heap_len;
+
+	if (first + count > schedules_size)
+	{
+		cardsched_t *temp_schedules;
+		int *temp_heap, *temp_pos;
+		int size = MAX(first + count, schedules_size * 2);
+
+		if ((temp_schedules = reallocarray(schedules, size, sizeof(cardsched_t))) == NULL)
+			return errno;
+		schedules = temp_schedules;
+		if ((temp_pos = reallocarray(heap_pos, size, sizeof(int))) == NULL)
+			return errno;
+		heap_pos = temp_pos;
+		if ((temp_heap = reallocarray(heap, size, sizeof(int))) == NULL)
+			return errno;
+		heap = temp_heap;
+		schedules_size = size;
+	}
+
+	for (int i = first; i < first + count; i++)
+	{
+		schedules[i] = (cardsched_t){ .due = 0, .interval = 0, .ease = SCHED_START_EASE, .reps = 0 };
+		heap_pos[i] = -1;
+		if (get_card_state(i) != CARDSTATE_TO_DELETE)
+			place_card(heap_len++, i);
+	}
+
+	// A heap made from scratch is ordered from the bottom up in O(n); cards added to a heap are moved up one at a time
+	if (old_len == 0)
+	{
+		for (int pos = heap_len / 2 - 1; pos >= 0; pos--)
+			sift_down(pos);
+	}
+	else
+	{
+		for (int pos = old_len; pos < heap_len; pos++)
+			sift_up(pos);
+	}
+	return 0;
+}
+
+/*
+ * returns the card due soonest, which may not be due yet, or -1 if every card has been deleted
+ */
+int next_due_card(void)
+{
+	return heap_len == 0 ? -1 : heap[0];
+}
+
+/*
+ * returns the time card i is due in seconds since the epoch, or 0 if it has never been reviewed
+ */
+int64_t get_card_due(int i)
+{
+	return schedules[i].due;
+}
+
+/*
+ * returns the schedule of card i
+ */
+const cardsched_t *get_card_schedule(int i)
+{
+	return &schedules[i];
+}
+
+/*
+ * gives card i a schedule, like the one it was saved with, and moves it to its new place in the heap
+ */
+void set_card_schedule(int i, const cardsched_t *sched)
+{
+	schedules[i] = *sched;
+	if (heap_pos[i] != -1)
+	{
+		sift_up(heap_pos[i]);
+		sift_down(heap_pos[i]);
+	}
+}
+
+/*
+ * returns the number of cards due at now, which are the cards at the top of the heap, counting at most limit of them so it takes O(limit)
+ */
+int count_due_cards(int64_t now, int limit)
+{
+	return count_due_under(0, now, limit);
+}
+
+/*
+ * schedules card i again with SM-2 after it was answered at now with a grade, then moves it to its new place in the heap
+ *
+ * the ease goes down for hard and wrong answers; wrong answers also start the card over, so it's due again in SCHED_RELEARN_SECS, and right answers give it an interval of 1 day, then 6 days, then the last interval times the ease
+ */
+void reschedule_card(int i, schedgrade_t grade, int64_t now)
+{
+	cardsched_t *s = &schedules[i];
+
+	// Quality of the answer on the scale of 0 to 5 SM-2 uses, and the change in ease it makes
+	int quality = grade == SCHED_AGAIN ? 1 : grade == SCHED_HARD ? 3 : 4;
+	int ease = s->ease + 100 - (5 - quality) * (80 + (5 - quality) * 20);
+
+	s->ease = MAX(ease, SCHED_MIN_EASE);
+	if (grade == SCHED_AGAIN)
+	{
+		s->reps = 0;
+		s->interval = 0;
+		s->due = now + SCHED_RELEARN_SECS;
+	}
+	else
+	{
+		uint64_t interval;
+
+		if (s->reps < UINT16_MAX)
+			s->reps++;
+		if (s->reps == 1)
+			interval = 1;
+		else if (s->reps == 2)
+			interval = 6;
+		else
+			interval = MAX(((uint64_t) s->interval * s->ease + 500) / 1000, (uint64_t) s->interval + 1);
+		s->interval = MIN(interval, SCHED_MAX_INTERVAL);
+		s->due = now + (int64_t) s->interval * SCHED_DAY;
+	}
+
+	if (heap_pos[i] != -1)
+	{
+		sift_up(heap_pos[i]);
+		sift_down(heap_pos[i]);
+	}
+}
+
+/*
+ * takes card i out of the heap after it's deleted, moving the last card in the heap into its place
+ */
+void unschedule_card(int i)
+{
+	int pos = heap_pos[i], last;
+
+	if (pos == -1)
+		return;
+	heap_pos[i] = -1;
+	if (pos == --heap_len)
+		return;
+	last = heap[heap_len];
+	place_card(pos, last);
+	sift_up(pos);
+	sift_down(heap_pos[last]);
+}
+
+/*
+ * frees the schedule
+ */
+void free_schedule(void)
+{
+	free(schedules);
+	free(heap);
+	free(heap_pos);
+	schedules = NULL;
+	heap = heap_pos = NULL;
+	schedules_size = heap_len = 0;
+}
+
+/*
+ * returns true if card a is due before card b; cards due at the same time are in the order they were read
+ */
+static bool due_before(int a, int b)
+{
+	return schedules[a].due < schedules[b].due || (schedules[a].due == schedules[b].due && a < b);
+}
+
+/*
+ * puts card i at pos in heap and records its position
+ */
+static void place_card(int pos, int i)
+{
+	heap[pos] = i;
+	heap_pos[i] = pos;
+}
+
+/*
+ * moves the card at pos in heap up, swapping it with the card above it while it's due before that card
+ */
+static void sift_up(int pos)
+{
+	int i = heap[pos];
+
+	while (pos > 0 && due_before(i, heap[(pos - 1) / 2]))
+	{
+		place_card(pos, heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+	place_card(pos, i);
+}
+
+/*
+ * moves the card at pos in heap down, swapping it with the card under it that's due first while that card is due before it
+ */
+static void sift_down(int pos)
+{
+	int i = heap[pos];
+
+	for (;;)
+	{
+		int child = pos * 2 + 1;
+
+		if (child >= heap_len)
+			break;
+		if (child + 1 < heap_len && due_before(heap[child + 1], heap[child]))
+			child++;
+		if (!due_before(heap[child], i))
+			break;
+		place_card(pos, heap[child]);
+		pos = child;
+	}
+	place_card(pos, i);
+}
+
+/*
+ * counts the cards due at now in the part of heap under pos, including pos, counting at most limit of them; the cards under a card are never due before it, so only due cards and the cards right under them are looked at
+ */
+static int count_due_under(int pos, int64_t now, int limit)
+{
+	int count;
+
+	if (limit <= 0 || pos >= heap_len || schedules[heap[pos]].due > now)
+		return 0;
+	count = 1 + count_due_under(pos * 2 + 1, now, limit - 1);
+	if (count < limit)
+		count += count_due_under(pos * 2 + 2, now, limit - count);
+	return count;
+}
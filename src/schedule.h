@@ -0,0 +1,85 @@
+/*
+ * schedule.h
+ *
+ * This file contains the types and functions for scheduling cards with spaced repetition
+ */
+
+#ifndef	SCHEDULE_H
+#define	SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Seconds in a day, the unit intervals are counted in
+#define	SCHED_DAY		86400
+
+// Ease of cards that haven't been reviewed, and the lowest ease a card can have, in thousandths
+#define	SCHED_START_EASE	2500
+#define	SCHED_MIN_EASE		1300
+
+// Longest interval a card can be given, in days
+#define	SCHED_MAX_INTERVAL	36500
+
+// Seconds before a card answered wrong is due again
+#define	SCHED_RELEARN_SECS	60
+
+// Schedule of a card
+typedef struct cardsched{
+	// Time the card is due, in seconds since the epoch, or 0 if it has never been reviewed
+	int64_t due;
+
+	// Days between the last review of the card and the time it's due
+	uint32_t interval;
+
+	// Factor the interval grows by each time the card is answered right, in thousandths
+	uint16_t ease;
+
+	// Number of times in a row the card has been answered right
+	uint16_t reps;
+} cardsched_t;
+
+// Grade of an answer to a card, which picks when it's due next
+typedef enum schedgrade{
+	// The answer was wrong, so the card is learned again
+	SCHED_AGAIN,
+
+	// The answer was right, but hard to remember
+	SCHED_HARD,
+
+	SCHED_GOOD
+} schedgrade_t;
+
+// True if cards are shown when they're due instead of in reviews
+extern bool scheduled_review;
+
+// Schedules every card in card_list as a card that has never been reviewed; returns errno on error
+int init_schedule(void);
+
+// Schedules cards that were just added to the end of card_list; returns errno on error
+int extend_schedule(int first, int count);
+
+// Returns the card due soonest, or -1 if no cards are scheduled
+int next_due_card(void);
+
+// Returns the time card i is due, or 0 if it has never been reviewed
+int64_t get_card_due(int i);
+
+// Returns the schedule of card i
+const cardsched_t *get_card_schedule(int i);
+
+// Gives card i a schedule
+void set_card_schedule(int i, const cardsched_t *sched);
+
+// Returns the number of cards due at now, counting at most limit of them
+int count_due_cards(int64_t now, int limit);
+
+// Schedules card i again after it was answered at now
+void reschedule_card(int i, schedgrade_t grade, int64_t now);
+
+// Takes card i out of the schedule after it's deleted
+void unschedule_card(int i);
+
+// Frees the schedule
+void free_schedule(void);
+
+#endif
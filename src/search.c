@@ -0,0 +1,424 @@
+/*
+ * search.c
+ *
+ * This file contains the trigram index used to find the cards that contain some text.
+ *
+ * The index is built the first time a deck is searched. Every three characters in a row of the text of a side of a card, in lowercase, make a trigram, and each trigram is hashed to one of a fixed number of buckets. Each bucket has the list of cards with a trigram in it, in the order of card_list, and the lists of every bucket are stored one after another in one array. A search only looks at the cards in every list of the trigrams of the text searched for, starting with the shortest list; since different trigrams can share a bucket, each of those cards is then checked for the text itself.
+ *
+ * Text shorter than a trigram is searched for in every card. Cards added to card_list after the index was built are also checked one by one, until there are enough of them that the index is rebuilt.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "util.h"
+#include "card.h"
+#include "search.h"
+
+// Fewest and most bits of the number of buckets
+#define	SEARCH_MIN_BUCKET_BITS	12
+#define	SEARCH_MAX_BUCKET_BITS	21
+
+// Most trigrams of the text searched for whose lists are looked at; cards are checked for the whole text anyway
+#define	SEARCH_MAX_TRIGRAMS	32
+
+// Fraction of the indexed cards that can be added to card_list after the index is built before it's rebuilt
+#define	SEARCH_REBUILD_DIVISOR	8
+
+// Bucket of the trigram made of three lowercase characters
+#define	TRIGRAM_BUCKET(a, b, c)	((uint32_t) (((((uint64_t) (a) << 42) ^ ((uint64_t) (b) << 21) ^ (uint64_t) (c)) * 0x9e3779b97f4a7c15ULL) >> (64 - bucket_bits)))
+
+// Number of bits of the number of buckets, or 0 if there's no index
+static int bucket_bits;
+
+// Offset in postings of the list of each bucket, followed by the length of postings
+static uint32_t *bucket_starts;
+
+// Cards with a trigram in each bucket
+static int *postings;
+
+// Number of cards at the start of card_list that are in the index
+static int indexed_len;
+
+// True if the index couldn't be built, so it isn't tried again until it's invalidated
+static bool index_failed;
+
+// Lowercase text of the side of a card being indexed or checked
+static wchar_t *folded;
+static size_t folded_size;
+
+// Buckets of the trigrams of the card being indexed
+static uint32_t *card_buckets;
+static size_t card_buckets_size;
+
+// Lowercase text being searched for, and the cards found by the last search; both are kept between searches so searching as text is typed doesn't allocate
+static wchar_t *search_query;
+static size_t search_query_size;
+static int *search_matches;
+static int search_matches_size;
+
+// Builds the index of every card in card_list; returns errno on error
+static int build_search_index(void);
+
+// Sets card_buckets to the buckets of the trigrams of card i; returns the number of buckets, or -1 on error
+static int find_card_buckets(int i);
+
+// Makes text lowercase, copying it to folded; returns the length of the text, or -1 on error
+static long fold_text(const wchar_t *text);
+
+// Returns c in lowercase
+static wchar_t fold_char(wchar_t c);
+
+// Returns true if card i contains query, which is lowercase
+static bool card_contains(int i, const wchar_t *query);
+
+// Returns the index of the first card at or after start in the list of a bucket that is at least card
+static uint32_t find_posting(uint32_t start, uint32_t end, int card);
+
+/*
+ * finds the cards whose front or back contains query, ignoring case; deleted cards are never found
+ *
+ * the index is built first if it hasn't been, or rebuilt if enough cards have been added since it was built. If it can't be built, every card is checked instead
+ *
+ * returns the number of cards found, setting matches to an array of their indexes in card_list in order that's kept until the next search, or -1 if memory can't be allocated
+ */
+int search_cards(const wchar_t *query, const int **matches)
+{
+	wchar_t *q;
+	long qlen;
+	int count = 0, first_unindexed = 0;
+
+	*matches = search_matches;
+	if ((qlen = fold_text(query)) <= 0)
+		return qlen;
+
+	// Checking cards folds their text into folded, so the query is copied out of it
+	if ((size_t) qlen + 1 > search_query_size)
+	{
+		wchar_t *temp;
+
+		if ((temp = reallocarray(search_query, qlen + 1, sizeof(wchar_t))) == NULL)
+			return -1;
+		search_query = temp;
+		search_query_size = qlen + 1;
+	}
+	q = wmemcpy(search_query, folded, qlen + 1);
+
+	if (card_list_len > search_matches_size)
+	{
+		int *temp;
+		int size = MAX(card_list_len, search_matches_size * 2);
+
+		if ((temp = reallocarray(search_matches, size, sizeof(int))) == NULL)
+			return -1;
+		search_matches = temp;
+		search_matches_size = size;
+	}
+	*matches = search_matches;
+
+	if (qlen >= 3)
+	{
+		if (bucket_bits != 0 && card_list_len - indexed_len > indexed_len / SEARCH_REBUILD_DIVISOR)
+			free_search_index();
+		if (bucket_bits == 0 && !index_failed)
+			index_failed = build_search_index() != 0;
+	}
+
+	if (qlen >= 3 && bucket_bits != 0)
+	{
+		uint32_t buckets[SEARCH_MAX_TRIGRAMS], starts[SEARCH_MAX_TRIGRAMS], ends[SEARCH_MAX_TRIGRAMS];
+		int lists = 0, shortest = 0;
+
+		// Find the list of each distinct bucket of the query, and the shortest of them
+		for (long j = 0; j + 2 < qlen && lists < SEARCH_MAX_TRIGRAMS; j++)
+		{
+			uint32_t bucket = TRIGRAM_BUCKET(q[j], q[j + 1], q[j + 2]);
+			bool seen = false;
+
+			for (int k = 0; k < lists && !seen; k++)
+				seen = buckets[k] == bucket;
+			if (seen)
+				continue;
+			buckets[lists] = bucket;
+			starts[lists] = bucket_starts[bucket];
+			ends[lists] = bucket_starts[bucket + 1];
+			if (ends[lists] - starts[lists] < ends[shortest] - starts[shortest])
+				shortest = lists;
+			lists++;
+		}
+
+		// Check the cards in the shortest list that are in every other list, moving through the other lists alongside it
+		for (uint32_t p = starts[shortest]; p < ends[shortest]; p++)
+		{
+			int card = postings[p];
+			bool in_all = true;
+
+			for (int k = 0; k < lists && in_all; k++)
+			{
+				if (k == shortest)
+					continue;
+				starts[k] = find_posting(starts[k], ends[k], card);
+				in_all = starts[k] < ends[k] && postings[starts[k]] == card;
+			}
+			if (in_all && card_contains(card, q))
+				search_matches[count++] = card;
+		}
+		first_unindexed = indexed_len;
+	}
+
+	// Check every card that isn't in the index
+	for (int i = first_unindexed; i < card_list_len; i++)
+		if (card_contains(i, q))
+			search_matches[count++] = i;
+
+	return count;
+}
+
+/*
+ * gives every card whose front or back contains query the state CARDSTATE_DO_REVIEW and every other card that hasn't been deleted the state CARDSTATE_DONT_REVIEW; if no cards contain query, no states are changed
+ *
+ * returns the number of cards marked for review, or -1 if memory can't be allocated
+ */
+int review_matching_cards(const wchar_t *query)
+{
+	const int *matches;
+	int count;
+
+	if ((count = search_cards(query, &matches)) <= 0)
+		return count;
+
+	change_card_states(CARDSTATE_DO_REVIEW, CARDSTATE_DONT_REVIEW);
+	for (int i = 0; i < count; i++)
+		set_card_state(matches[i], CARDSTATE_DO_REVIEW);
+	return count;
+}
+
+/*
+ * frees the index so the next search builds it again from the text of card_list as it is then
+ */
+void invalidate_search_index(void)
+{
+	free_search_index();
+	index_failed = false;
+}
+
+/*
+ * frees the index and the buffers used to build it
+ */
+void free_search_index(void)
+{
+	free(bucket_starts);
+	free(postings);
+	free(card_buckets);
+	bucket_starts = NULL;
+	postings = NULL;
+	card_buckets = NULL;
+	card_buckets_size = 0;
+	bucket_bits = 0;
+	indexed_len = 0;
+}
+
+/*
+ * builds the index of every card in card_list in two passes: the first counts the cards in each bucket, and the second fills the list of each bucket. A card is only added to the list of a bucket once, even if several of its trigrams are in it
+ *
+ * returns errno on error
+ */
+static int build_search_index(void)
+{
+	uint32_t *next = NULL;
+	int *last_card = NULL;
+	size_t buckets, total = 0;
+	int error_code = ENOMEM;
+
+	for (bucket_bits = SEARCH_MIN_BUCKET_BITS; bucket_bits < SEARCH_MAX_BUCKET_BITS && ((size_t) 1 << bucket_bits) < (size_t) card_list_len * 4; bucket_bits++);
+	buckets = (size_t) 1 << bucket_bits;
+	if ((bucket_starts = calloc(buckets + 1, sizeof(uint32_t))) == NULL
+		|| (last_card = malloc(buckets * sizeof(int))) == NULL)
+		goto build_search_index_error;
+	memset(last_card, -1, buckets * sizeof(int));
+
+	// Count the cards in each bucket
+	for (int i = 0; i < card_list_len; i++)
+	{
+		int count;
+
+		if ((count = find_card_buckets(i)) == -1)
+			goto build_search_index_error;
+		for (int j = 0; j < count; j++)
+		{
+			if (last_card[card_buckets[j]] == i)
+				continue;
+			last_card[card_buckets[j]] = i;
+			bucket_starts[card_buckets[j]]++;
+			total++;
+		}
+	}
+
+	// Error: the lists can't be referred to by 32-bit offsets
+	if (total > UINT32_MAX)
+	{
+		error_code = EOVERFLOW;
+		goto build_search_index_error;
+	}
+
+	// Turn the counts into offsets
+	for (size_t b = 0, off = 0; b <= buckets; b++)
+	{
+		size_t count = b < buckets ? bucket_starts[b] : 0;
+
+		bucket_starts[b] = off;
+		off += count;
+	}
+
+	if ((postings = reallocarray(NULL, MAX(total, 1), sizeof(int))) == NULL
+		|| (next = reallocarray(NULL, buckets, sizeof(uint32_t))) == NULL)
+		goto build_search_index_error;
+	memcpy(next, bucket_starts, buckets * sizeof(uint32_t));
+	memset(last_card, -1, buckets * sizeof(int));
+
+	// Fill the lists; cards are added in order, so every list is sorted
+	for (int i = 0; i < card_list_len; i++)
+	{
+		int count;
+
+		if ((count = find_card_buckets(i)) == -1)
+			goto build_search_index_error;
+		for (int j = 0; j < count; j++)
+		{
+			if (last_card[card_buckets[j]] == i)
+				continue;
+			last_card[card_buckets[j]] = i;
+			postings[next[card_buckets[j]]++] = i;
+		}
+	}
+
+	indexed_len = card_list_len;
+	free(last_card);
+	free(next);
+	return 0;
+
+	build_search_index_error:
+	free(last_card);
+	free(next);
+	free_search_index();
+	return error_code;
+}
+
+/*
+ * sets card_buckets to the buckets of the trigrams of both sides of card i, which can have the same bucket more than once
+ *
+ * returns the number of buckets, or -1 if memory can't be allocated
+ */
+static int find_card_buckets(int i)
+{
+	int count = 0;
+
+	for (cardside_t side = CARDSIDE_FRONT; side <= CARDSIDE_BACK; side++)
+	{
+		long len;
+
+		if ((len = fold_text(card_side_text(i, side))) == -1)
+			return -1;
+		if (len < 3)
+			continue;
+
+		if ((size_t) (count + len - 2) > card_buckets_size)
+		{
+			size_t size = MAX((size_t) (count + len - 2), card_buckets_size * 2);
+			uint32_t *temp;
+
+			if ((temp = reallocarray(card_buckets, size, sizeof(uint32_t))) == NULL)
+				return -1;
+			card_buckets = temp;
+			card_buckets_size = size;
+		}
+		for (long j = 0; j + 2 < len; j++)
+			card_buckets[count++] = TRIGRAM_BUCKET(folded[j], folded[j + 1], folded[j + 2]);
+	}
+	return count;
+}
+
+/*
+ * copies text to folded in lowercase, growing folded if it's too small
+ *
+ * returns the length of the text, or -1 if memory can't be allocated
+ */
+static long fold_text(const wchar_t *text)
+{
+	size_t len = wcslen(text);
+
+	if (len + 1 > folded_size)
+	{
+		size_t size = MAX(len + 1, folded_size * 2);
+		wchar_t *temp;
+
+		if ((temp = reallocarray(folded, size, sizeof(wchar_t))) == NULL)
+			return -1;
+		folded = temp;
+		folded_size = size;
+	}
+	for (size_t j = 0; j < len; j++)
+		folded[j] = fold_char(text[j]);
+	folded[len] = L'\0';
+	return len;
+}
+
+/*
+ * returns c in lowercase; ASCII is handled without the locale, since most card text is ASCII
+ */
+static wchar_t fold_char(wchar_t c)
+{
+	if (c < 0x80)
+		return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+	return towlower(c);
+}
+
+/*
+ * returns true if card i hasn't been deleted and its front or back contains query, which has to be lowercase
+ */
+static bool card_contains(int i, const wchar_t *query)
+{
+	if (get_card_state(i) == CARDSTATE_TO_DELETE)
+		return false;
+	for (cardside_t side = CARDSIDE_FRONT; side <= CARDSIDE_BACK; side++)
+		if (fold_text(card_side_text(i, side)) != -1 && wcsstr(folded, query) != NULL)
+			return true;
+	return false;
+}
+
+/*
+ * returns the offset of the first card in postings between start and end that is at least card, or end if there is none; the distance to it is doubled until it's passed, then binary searched, so moving through a long list alongside a short one skips most of it
+ */
+static uint32_t find_posting(uint32_t start, uint32_t end, int card)
+{
+	uint32_t step = 1, low = start, high;
+
+	if (start >= end || postings[start] >= card)
+		return start;
+
+	// postings[low] is always less than card
+	for (high = start + 1; high < end && postings[high] < card; high = start + step)
+	{
+		low = high;
+		step *= 2;
+	}
+	if (high > end)
+		high = end;
+
+	while (high - low > 1)
+	{
+		uint32_t mid = low + (high - low) / 2;
+
+		if (postings[mid] < card)
+			low = mid;
+		else
+			high = mid;
+	}
+	return high;
+}
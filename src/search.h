@@ -0,0 +1,24 @@
+/*
+ * search.h
+ *
+ * This file contains the functions for finding the cards that contain some text
+ */
+
+#ifndef	SEARCH_H
+#define	SEARCH_H
+
+#include <wchar.h>
+
+// Finds the cards whose front or back contains query, ignoring case; returns the number of cards found and sets matches to an array of them kept until the next search, or returns -1 on error
+int search_cards(const wchar_t *query, const int **matches);
+
+// Marks the cards whose front or back contains query for review and every other card as not; returns the number of cards marked, or -1 on error
+int review_matching_cards(const wchar_t *query);
+
+// Makes the next search rebuild the search index, after the text of cards has changed
+void invalidate_search_index(void);
+
+// Frees the search index
+void free_search_index(void);
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * uring.c
+ *
+ * This file contains functions for reading many small card files at once with io_uring.
+ *
+ * Mapping a deck of thousands of small files costs several system calls per file (open, fstat, a read of the first bytes to look for compression, mmap and close), which takes longer than parsing them. read_small_files instead goes through the files in four steps (statx, openat, read and close), submitting the operations of each step to an io_uring URING_ENTRIES at a time and collecting them as they complete, so a whole step takes a few io_uring_enter calls for every URING_ENTRIES files. The ring is set up with raw system calls, so liburing isn't needed.
+ *
+ * Files that aren't regular files, are larger than URING_MAX_FILE_SIZE, are compressed or have any error are left for map_card_file, which reports errors the same way it always has. If the kernel doesn't have io_uring (or doesn't allow it), read_small_files returns -1 and read_deck maps every file like before.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define	HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef	HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif
+
+#include "util.h"
+#include "cardfile.h"
+#include "decompress.h"
+#include "uring.h"
+
+#ifdef	HAVE_IO_URING
+
+// io_uring set up with io_uring_setup and mapped into memory
+typedef struct uring{
+	int fd;
+	unsigned entries;
+
+	// Submission queue
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	// Completion queue
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	// Mappings of the queues, which are the same mapping if the kernel has IORING_FEAT_SINGLE_MMAP
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	size_t sqes_len;
+} uring_t;
+
+// State of a card file read by read_small_files
+typedef struct uringfile{
+	const char *filename;
+
+	// Result of statx
+	struct statx stx;
+
+	// File descriptor, or -1 if the file isn't open
+	int fd;
+
+	// Contents of the file, or NULL if they haven't been read
+	char *buf;
+
+	// True if the last step succeeded, so the next step should be run on the file
+	bool ok;
+
+	// True while an operation on the file is in the ring; the kernel may still write to stx or buf
+	bool busy;
+} uringfile_t;
+
+// Fills in a submission queue entry for one step of one file
+typedef void (*prepare_fn)(struct io_uring_sqe *sqe, uringfile_t *file);
+
+// Handles the result of one step of one file
+typedef void (*complete_fn)(uringfile_t *file, int res);
+
+// Sets up and maps an io_uring; returns errno on error
+static int setup_uring(uring_t *ring, unsigned entries);
+
+// Unmaps and closes an io_uring
+static void close_uring(uring_t *ring);
+
+// Runs one step on every file with ok set, clearing ok for files the step fails on; returns errno on error
+static int run_step(uring_t *ring, uringfile_t *files, int count, prepare_fn prepare, complete_fn complete);
+
+// Functions for each step
+static void prepare_statx(struct io_uring_sqe *sqe, uringfile_t *file);
+static void complete_statx(uringfile_t *file, int res);
+static void prepare_open(struct io_uring_sqe *sqe, uringfile_t *file);
+static void complete_open(uringfile_t *file, int res);
+static void prepare_read(struct io_uring_sqe *sqe, uringfile_t *file);
+static void complete_read(uringfile_t *file, int res);
+static void prepare_close(struct io_uring_sqe *sqe, uringfile_t *file);
+static void complete_close(uringfile_t *file, int res);
+
+/*
+ * reads the small regular files of a deck with io_uring; for every file that was read, files[i] is set to its contents in a malloc'd buffer and read[i] is set to true, while the rest are left for map_card_file
+ *
+ * returns the number of files read, or -1 if io_uring can't be set up
+ */
+int read_small_files(char **filenames, cardfile_t *files, bool *read, int count)
+{
+	uring_t ring;
+	uringfile_t *uf;
+	int done = 0;
+	bool busy = false;
+
+	if (setup_uring(&ring, URING_ENTRIES) != 0)
+		return -1;
+	if ((uf = calloc(count, sizeof(uringfile_t))) == NULL)
+	{
+		close_uring(&ring);
+		return -1;
+	}
+
+	// Standard input is never read here, since it isn't a file that can be opened by name
+	for (int i = 0; i < count; i++)
+	{
+		uf[i].filename = filenames[i];
+		uf[i].fd = -1;
+		uf[i].ok = strcmp(filenames[i], "-") != 0;
+	}
+
+	// If a step can't be run, the files it left in the ring are given up on below
+	if (run_step(&ring, uf, count, prepare_statx, complete_statx) == 0
+			&& run_step(&ring, uf, count, prepare_open, complete_open) == 0
+			&& run_step(&ring, uf, count, prepare_read, complete_read) == 0)
+	{
+		// Every open file is closed, whether or not it was read
+		for (int i = 0; i < count; i++)
+		{
+			if (uf[i].buf != NULL && detect_compression((unsigned char *) uf[i].buf, uf[i].stx.stx_size) != COMPRESSION_NONE)
+				uf[i].ok = false;
+			read[i] = uf[i].ok;
+			uf[i].ok = uf[i].fd != -1;
+		}
+		run_step(&ring, uf, count, prepare_close, complete_close);
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		// Memory and file descriptors the kernel may still be using are left alone
+		if (uf[i].busy)
+		{
+			read[i] = false;
+			busy = true;
+			continue;
+		}
+		if (uf[i].fd != -1)
+			close(uf[i].fd);
+
+		if (read[i])
+		{
+			files[i].data = uf[i].buf;
+			files[i].len = uf[i].stx.stx_size;
+			files[i].mapped = false;
+			done++;
+		}
+		else
+			free(uf[i].buf);
+	}
+
+	// Closing the ring doesn't wait for the operations left in it, which can still write to the stx of their files, so uf is kept if any are left
+	close_uring(&ring);
+	if (!busy)
+		free(uf);
+	return done;
+}
+
+/*
+ * sets up an io_uring with room for entries submissions and maps its queues
+ *
+ * returns errno on error
+ */
+static int setup_uring(uring_t *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	int error_code;
+
+	memset(ring, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+	if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1)
+		return errno;
+	ring->entries = p.sq_entries;
+
+	ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_map_len = ring->cq_map_len = MAX(ring->sq_map_len, ring->cq_map_len);
+
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+		goto setup_uring_error;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_map = ring->sq_map;
+	else if ((ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto setup_uring_error;
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto setup_uring_error;
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_map + p.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_map + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *) ((char *) ring->sq_map + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_map + p.sq_off.array);
+	ring->cq_head = (unsigned *) ((char *) ring->cq_map + p.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_map + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *) ((char *) ring->cq_map + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_map + p.cq_off.cqes);
+	return 0;
+
+	setup_uring_error:
+	error_code = errno;
+	if (ring->sqes == MAP_FAILED)
+		ring->sqes = NULL;
+	if (ring->cq_map == MAP_FAILED)
+		ring->cq_map = NULL;
+	if (ring->sq_map == MAP_FAILED)
+		ring->sq_map = NULL;
+	close_uring(ring);
+	return error_code;
+}
+
+/*
+ * unmaps the queues of an io_uring and closes it
+ */
+static void close_uring(uring_t *ring)
+{
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_len);
+	if (ring->sq_map != NULL)
+		munmap(ring->sq_map, ring->sq_map_len);
+	close(ring->fd);
+}
+
+/*
+ * runs one step on every file with ok set, keeping up to one operation per submission queue entry in the ring and submitting new ones as others complete; the completion queue is twice as large as the submission queue, so it can't overflow
+ *
+ * returns errno if io_uring_enter fails, leaving busy set on the files whose operations are still in the ring
+ */
+static int run_step(uring_t *ring, uringfile_t *files, int count, prepare_fn prepare, complete_fn complete)
+{
+	unsigned sq_tail = *ring->sq_tail, cq_head, cq_tail, inflight = 0;
+	int next = 0;
+
+	for (;;)
+	{
+		// Queue operations until the ring is full
+		for (; next < count && inflight < ring->entries; next++)
+		{
+			struct io_uring_sqe *sqe;
+			unsigned index = sq_tail & ring->sq_mask;
+
+			if (!files[next].ok)
+				continue;
+			sqe = &ring->sqes[index];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			prepare(sqe, &files[next]);
+			sqe->user_data = next;
+			ring->sq_array[index] = index;
+			files[next].busy = true;
+			sq_tail++;
+			inflight++;
+		}
+		if (inflight == 0)
+			return 0;
+		__atomic_store_n(ring->sq_tail, sq_tail, __ATOMIC_RELEASE);
+
+		// Submit whatever the kernel hasn't taken yet and wait for at least one operation to complete
+		if (syscall(__NR_io_uring_enter, ring->fd, sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE), 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1
+				&& errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return errno;
+
+		cq_head = *ring->cq_head;
+		cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; cq_head != cq_tail; cq_head++)
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[cq_head & ring->cq_mask];
+			uringfile_t *file = &files[cqe->user_data];
+
+			file->busy = false;
+			complete(file, cqe->res);
+			inflight--;
+		}
+		__atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * looks up the type and size of a file
+ */
+static void prepare_statx(struct io_uring_sqe *sqe, uringfile_t *file)
+{
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long) file->filename;
+	sqe->len = STATX_TYPE | STATX_SIZE;
+	sqe->off = (unsigned long) &file->stx;
+}
+
+static void complete_statx(uringfile_t *file, int res)
+{
+	// Empty files are left for map_card_file, since there's nothing to read
+	file->ok = res == 0 && S_ISREG(file->stx.stx_mode) && file->stx.stx_size != 0 && file->stx.stx_size <= URING_MAX_FILE_SIZE;
+}
+
+/*
+ * opens a file and allocates a buffer for its contents
+ */
+static void prepare_open(struct io_uring_sqe *sqe, uringfile_t *file)
+{
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long) file->filename;
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+static void complete_open(uringfile_t *file, int res)
+{
+	if (res < 0)
+	{
+		file->ok = false;
+		return;
+	}
+	file->fd = res;
+	file->ok = (file->buf = malloc(file->stx.stx_size)) != NULL;
+}
+
+/*
+ * reads a whole file into its buffer; a file that has shrunk or grown since statx is left for map_card_file
+ */
+static void prepare_read(struct io_uring_sqe *sqe, uringfile_t *file)
+{
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = file->fd;
+	sqe->addr = (unsigned long) file->buf;
+	sqe->len = file->stx.stx_size;
+	sqe->off = 0;
+}
+
+static void complete_read(uringfile_t *file, int res)
+{
+	file->ok = res >= 0 && (unsigned) res == file->stx.stx_size;
+}
+
+/*
+ * closes a file
+ */
+static void prepare_close(struct io_uring_sqe *sqe, uringfile_t *file)
+{
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = file->fd;
+}
+
+static void complete_close(uringfile_t *file, int res)
+{
+	// A failed close is retried with close() by read_small_files
+	if (res == 0)
+		file->fd = -1;
+}
+
+#else
+
+/*
+ * io_uring isn't available on this system, so every file is left for map_card_file
+ */
+int read_small_files(char **filenames, cardfile_t *files, bool *read, int count)
+{
+	(void) filenames;
+	(void) files;
+	(void) read;
+	(void) count;
+	return -1;
+}
+
+#endif
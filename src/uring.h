@@ -0,0 +1,26 @@
+/*
+ * uring.h
+ *
+ * This file contains functions for reading many small card files at once with io_uring
+ */
+
+#ifndef	URING_H
+#define	URING_H
+
+#include <stdbool.h>
+
+#include "cardfile.h"
+
+// Decks with fewer files than this are read without io_uring
+#define	URING_MIN_FILES		16
+
+// Files larger than this are mapped instead, since mapping them doesn't copy them
+#define	URING_MAX_FILE_SIZE	(256 << 10)
+
+// Number of operations submitted to the ring at once
+#define	URING_ENTRIES		256
+
+// Reads the small regular files of a deck with io_uring, setting read[i] for each file read into files[i]; returns -1 if io_uring can't be used
+int read_small_files(char **filenames, cardfile_t *files, bool *read, int count);
+
+#endif
@@ -4,8 +4,17 @@
  * This file contains miscellaneous functions.
  */
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "util.h"
 
+// Maximum number of threads run by run_threads
+#define	MAX_THREADS	64
+
 // Returns the number of digits in a positive base 10 int
 int get_digits(int x)
 {
@@ -14,3 +23,76 @@ int get_digits(int x)
 		digits++;
 	return digits;
 }
+
+/*
+ * returns a 64-bit hash of len bytes, using MurmurHash64A by Austin Appleby
+ */
+uint64_t hash_bytes(const void *key, size_t len)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const unsigned char *p = key;
+	const unsigned char *end = p + (len & ~(size_t) 7);
+	uint64_t h = len * m;
+	uint64_t k;
+
+	for (; p != end; p += 8)
+	{
+		memcpy(&k, p, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	switch (len & 7)
+	{
+		case 7: h ^= (uint64_t) p[6] << 48;
+		case 6: h ^= (uint64_t) p[5] << 40;
+		case 5: h ^= (uint64_t) p[4] << 32;
+		case 4: h ^= (uint64_t) p[3] << 24;
+		case 3: h ^= (uint64_t) p[2] << 16;
+		case 2: h ^= (uint64_t) p[1] << 8;
+		case 1: h ^= (uint64_t) p[0];
+			h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+// Returns the number of CPUs available for worker threads
+int get_cpu_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		return 1;
+	return MIN(count, MAX_THREADS);
+}
+
+/*
+ * runs fn(arg) on up to count threads, one of which is the calling thread, and waits for them to return
+ *
+ * fn should take work from arg until there is none left, so all of the work still gets done if some threads can't be created
+ */
+void run_threads(int count, void *(*fn)(void *), void *arg)
+{
+	pthread_t threads[MAX_THREADS];
+	int created = 0;
+
+	count = MIN(count, MAX_THREADS);
+	for (int i = 1; i < count; i++)
+	{
+		if (pthread_create(&threads[created], NULL, fn, arg) != 0)
+			break;
+		created++;
+	}
+
+	fn(arg);
+
+	for (int i = 0; i < created; i++)
+		pthread_join(threads[i], NULL);
+}
@@ -1,12 +1,15 @@
 /*
  * util.h
  *
- * This file contains miscellaneous macros.
+ * This file contains miscellaneous macros and functions.
  */
 
 #ifndef	UTIL_H
 #define	UTIL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Returns the literal characters passed to it as a string
 #define	STR_LIT(x)	#x
 
@@ -16,7 +19,19 @@
 // Returnd the maximum of two ints
 #define	MAX(x, y)	(x > y ? x : y)
 
+// Returns the minimum of two ints
+#define	MIN(x, y)	(x < y ? x : y)
+
 // Returns the number of digits in a positive base 10 int
 int get_digits(int x);
 
+// Returns a 64-bit hash of len bytes
+uint64_t hash_bytes(const void *key, size_t len);
+
+// Returns the number of CPUs available for worker threads
+int get_cpu_count(void);
+
+// Runs fn(arg) on up to count threads, including the calling thread, and waits for them all to return
+void run_threads(int count, void *(*fn)(void *), void *arg);
+
 #endif
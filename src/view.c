@@ -0,0 +1,108 @@
+/*
+ * view.c
+ *
+ * This file contains functions for deck views, which decide the order and orientation cards are shown in.
+ *
+ * card_list isn't changed by flipping, shuffling, or deleting cards. Flipping a view just toggles its flag, and shuffling a view shuffles its array of card indexes, so several views of the same cards can exist at once. A view with no array shows cards in the order of card_list for free.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#include "card.h"
+#include "view.h"
+
+deckview_t deck_view = {NULL, 0, false};
+
+/*
+ * returns the number of positions in a view; positions of deleted cards are counted until the view is compacted
+ */
+int view_len(const deckview_t *view)
+{
+	return view->order == NULL ? card_list_len : view->len;
+}
+
+/*
+ * returns the index in card_list of the card at position pos of a view
+ */
+int view_card(const deckview_t *view, int pos)
+{
+	return view->order == NULL ? pos : view->order[pos];
+}
+
+/*
+ * returns the text of one side of card i in card_list as a wide string, swapping the sides if the view is flipped
+ */
+wchar_t *view_card_text(const deckview_t *view, int i, cardside_t side)
+{
+	if (view->flipped)
+		side = side == CARDSIDE_FRONT ? CARDSIDE_BACK : CARDSIDE_FRONT;
+	return card_side_text(i, side);
+}
+
+/*
+ * gives a view an array of the indexes of the cards in card_list that haven't been deleted, in the order of card_list, so it can be reordered; views that already have an array are left alone
+ *
+ * returns errno on error
+ */
+int order_view(deckview_t *view)
+{
+	int len = card_list_len - deleted_cards;
+
+	if (view->order != NULL)
+		return 0;
+	if ((view->order = calloc(len, sizeof(int))) == NULL)
+		return errno;
+
+	view->len = 0;
+	for (int i = 0; view->len < len; i++)
+		if (get_card_state(i) != CARDSTATE_TO_DELETE)
+			view->order[view->len++] = i;
+	return 0;
+}
+
+/*
+ * adds count cards that were just added to card_list, starting at index first, to the end of a view; views in the order of card_list already show every card in it
+ *
+ * returns errno on error
+ */
+int extend_view(deckview_t *view, int first, int count)
+{
+	int *temp;
+
+	if (view->order == NULL)
+		return 0;
+	if ((temp = reallocarray(view->order, view->len + count, sizeof(int))) == NULL)
+		return errno;
+	view->order = temp;
+	for (int i = 0; i < count; i++)
+		view->order[view->len++] = first + i;
+	return 0;
+}
+
+/*
+ * removes the positions of deleted cards from the order of a view; views in the order of card_list skip deleted cards by their state instead
+ */
+void compact_view(deckview_t *view)
+{
+	int np = 0;
+
+	if (view->order == NULL)
+		return;
+	for (int i = 0; i < view->len; i++)
+		if (get_card_state(view->order[i]) != CARDSTATE_TO_DELETE)
+			view->order[np++] = view->order[i];
+	view->len = np;
+}
+
+/*
+ * puts a view back in the order of card_list by dropping its array
+ */
+void reset_view(deckview_t *view)
+{
+	free(view->order);
+	view->order = NULL;
+	view->len = 0;
+}
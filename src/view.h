@@ -0,0 +1,51 @@
+/*
+ * view.h
+ *
+ * This file contains the deck view type and functions for the order and orientation cards are shown in
+ */
+
+#ifndef	VIEW_H
+#define	VIEW_H
+
+#include <stdbool.h>
+#include <wchar.h>
+
+#include "card.h"
+
+// Way of looking at the cards in card_list without changing it
+typedef struct deckview{
+	// Indexes in card_list of the cards in the view in the order they're shown, or NULL to show every card in the order of card_list
+	int *order;
+
+	// Number of indexes in order
+	int len;
+
+	// True if the front and back of every card are swapped
+	bool flipped;
+} deckview_t;
+
+// View of the deck used in review mode
+extern deckview_t deck_view;
+
+// Returns the number of positions in a view, including positions of deleted cards
+int view_len(const deckview_t *view);
+
+// Returns the index in card_list of the card at a position of a view
+int view_card(const deckview_t *view, int pos);
+
+// Returns the text of one side of card i in card_list as it's shown in a view
+wchar_t *view_card_text(const deckview_t *view, int i, cardside_t side);
+
+// Gives a view its own order of the cards that haven't been deleted, if it doesn't have one; returns errno on error
+int order_view(deckview_t *view);
+
+// Adds cards that were just added to card_list to the end of a view; returns errno on error
+int extend_view(deckview_t *view, int first, int count);
+
+// Removes deleted cards from the order of a view
+void compact_view(deckview_t *view);
+
+// Puts a view back in the order of card_list
+void reset_view(deckview_t *view);
+
+#endif